@@ -1,7 +1,7 @@
 #ifndef CAPABILITYGUARD_H
 #define CAPABILITYGUARD_H
 
-#include <glad/glad.h>
+#include "gl-state.h"
 
 class CapabilityGuard
 {
@@ -12,17 +12,13 @@ public:
     CapabilityGuard(GLenum cap, bool enable)
         : _cap(cap)
     {
-        _prevValue = glIsEnabled(cap) ? 1 : 0;
+        // The shadowed state answers without asking the driver
+        auto &state = GlState::current();
+
+        _prevValue = state.isEnabled(cap) ? 1 : 0;
         if (enable != (_prevValue == 1))
         {
-            if (enable)
-            {
-                glEnable(_cap);
-            }
-            else
-            {
-                glDisable(_cap);
-            }
+            state.setEnabled(_cap, enable);
         }
         else
         {
@@ -31,13 +27,9 @@ public:
     }
     virtual ~CapabilityGuard()
     {
-        if (_prevValue == 1)
-        {
-            glEnable(_cap);
-        }
-        else if (_prevValue == 0)
+        if (_prevValue != -1)
         {
-            glDisable(_cap);
+            GlState::current().setEnabled(_cap, _prevValue == 1);
         }
     }
 };
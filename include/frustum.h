@@ -0,0 +1,182 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Axis aligned boxes with one array per bound, so a test can run over many boxes at once
+struct BoxArrays
+{
+    std::vector<float> minX;
+    std::vector<float> minY;
+    std::vector<float> minZ;
+    std::vector<float> maxX;
+    std::vector<float> maxY;
+    std::vector<float> maxZ;
+
+    size_t size() const
+    {
+        return minX.size();
+    }
+
+    void clear()
+    {
+        minX.clear();
+        minY.clear();
+        minZ.clear();
+        maxX.clear();
+        maxY.clear();
+        maxZ.clear();
+    }
+
+    void push(
+        glm::vec3 const &min,
+        glm::vec3 const &max)
+    {
+        minX.push_back(min.x);
+        minY.push_back(min.y);
+        minZ.push_back(min.z);
+        maxX.push_back(max.x);
+        maxY.push_back(max.y);
+        maxZ.push_back(max.z);
+    }
+
+    void set(
+        size_t index,
+        glm::vec3 const &min,
+        glm::vec3 const &max)
+    {
+        minX[index] = min.x;
+        minY[index] = min.y;
+        minZ[index] = min.z;
+        maxX[index] = max.x;
+        maxY[index] = max.y;
+        maxZ[index] = max.z;
+    }
+};
+
+class Frustum
+{
+    // Planes are stored as (normal, distance) with the normal pointing inwards
+    glm::vec4 _planes[6];
+
+public:
+    Frustum() = default;
+
+    explicit Frustum(
+        glm::mat4 const &projectionView)
+    {
+        update(projectionView);
+    }
+
+    void update(
+        glm::mat4 const &projectionView)
+    {
+        // Gribb/Hartmann plane extraction, glm matrices are column-major
+        glm::vec4 row0(projectionView[0][0], projectionView[1][0], projectionView[2][0], projectionView[3][0]);
+        glm::vec4 row1(projectionView[0][1], projectionView[1][1], projectionView[2][1], projectionView[3][1]);
+        glm::vec4 row2(projectionView[0][2], projectionView[1][2], projectionView[2][2], projectionView[3][2]);
+        glm::vec4 row3(projectionView[0][3], projectionView[1][3], projectionView[2][3], projectionView[3][3]);
+
+        _planes[0] = row3 + row0; // left
+        _planes[1] = row3 - row0; // right
+        _planes[2] = row3 + row1; // bottom
+        _planes[3] = row3 - row1; // top
+        _planes[4] = row3 + row2; // near
+        _planes[5] = row3 - row2; // far
+
+        for (auto &plane : _planes)
+        {
+            plane /= glm::length(glm::vec3(plane));
+        }
+    }
+
+    glm::vec4 const &plane(
+        int index) const
+    {
+        return _planes[index];
+    }
+
+    float distance(
+        int plane,
+        glm::vec3 const &point) const
+    {
+        return glm::dot(glm::vec3(_planes[plane]), point) + _planes[plane].w;
+    }
+
+    // True when both points are on the outside of the same plane, the segment can
+    // still be invisible when this returns false but it is never rejected wrongly.
+    bool isSegmentOutside(
+        glm::vec3 const &from,
+        glm::vec3 const &to) const
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            if (distance(i, from) < 0.0f && distance(i, to) < 0.0f)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // True when the whole box is on the outside of one plane. Only the corner furthest
+    // along the plane normal has to be tested for that.
+    bool isBoxOutside(
+        glm::vec3 const &min,
+        glm::vec3 const &max) const
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            auto corner = glm::vec3(
+                _planes[i].x > 0.0f ? max.x : min.x,
+                _planes[i].y > 0.0f ? max.y : min.y,
+                _planes[i].z > 0.0f ? max.z : min.z);
+
+            if (distance(i, corner) < 0.0f)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // isBoxOutside() for every box at once, visible gets 0 for boxes that are outside and
+    // 1 for the rest. The corner is picked per plane instead of per box, which leaves
+    // an inner loop without branches that the compiler turns into vector instructions.
+    void testBoxes(
+        BoxArrays const &boxes,
+        uint8_t *visible) const
+    {
+        auto count = boxes.size();
+
+        for (size_t i = 0; i < count; i++)
+        {
+            visible[i] = 1;
+        }
+
+        for (auto &plane : _planes)
+        {
+            auto x = (plane.x > 0.0f ? boxes.maxX : boxes.minX).data();
+            auto y = (plane.y > 0.0f ? boxes.maxY : boxes.minY).data();
+            auto z = (plane.z > 0.0f ? boxes.maxZ : boxes.minZ).data();
+
+            // Copies, the output could alias the planes as far as the compiler knows
+            auto nx = plane.x;
+            auto ny = plane.y;
+            auto nz = plane.z;
+            auto w = plane.w;
+
+            for (size_t i = 0; i < count; i++)
+            {
+                auto d = (nx * x[i]) + (ny * y[i]) + (nz * z[i]) + w;
+                visible[i] &= uint8_t(d >= 0.0f);
+            }
+        }
+    }
+};
+
+#endif // FRUSTUM_H
@@ -0,0 +1,92 @@
+#ifndef GLCAMERAUNIFORMS_H
+#define GLCAMERAUNIFORMS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// The block every shader declares for the camera, the members keep the names the
+// shaders used for their own uniforms so the rest of the source stays the same
+#define CAMERA_UNIFORM_BLOCK        \
+    "layout(std140) uniform Camera" \
+    "{"                             \
+    "    mat4 u_projection;"        \
+    "    mat4 u_view;"              \
+    "};"
+
+// Projection and view for all programs in one std140 uniform buffer. It is filled once
+// per frame and stays bound, so a draw only has to upload what is its own.
+class CameraUniformBuffer
+{
+public:
+    static const GLuint BINDING = 0;
+
+    CameraUniformBuffer()
+        : _bufferId(0)
+    {}
+
+    virtual ~CameraUniformBuffer() {}
+
+    // Connects the Camera block of a linked program to the binding point, programs without it are left alone
+    static void bindProgram(
+        GLuint program)
+    {
+        auto index = glGetUniformBlockIndex(program, "Camera");
+        if (index == GL_INVALID_INDEX)
+        {
+            return;
+        }
+
+        glUniformBlockBinding(program, index, BINDING);
+    }
+
+    bool setup()
+    {
+        if (_bufferId != 0)
+        {
+            return true;
+        }
+
+        glGenBuffers(1, &_bufferId);
+
+        glBindBuffer(GL_UNIFORM_BUFFER, _bufferId);
+        glBufferData(GL_UNIFORM_BUFFER, GLsizeiptr(sizeof(glm::mat4) * 2), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        return true;
+    }
+
+    // Uploads the matrices and binds the buffer, call once per frame before drawing
+    void update(
+        glm::mat4 const &projection,
+        glm::mat4 const &view)
+    {
+        // Two column major mat4 are laid out in std140 exactly as glm keeps them
+        glm::mat4 matrices[2] = {projection, view};
+
+        glBindBuffer(GL_UNIFORM_BUFFER, _bufferId);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, GLsizeiptr(sizeof(matrices)), glm::value_ptr(matrices[0]));
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        bind();
+    }
+
+    void bind() const
+    {
+        glBindBufferBase(GL_UNIFORM_BUFFER, BINDING, _bufferId);
+    }
+
+    void cleanup()
+    {
+        if (_bufferId != 0)
+        {
+            glDeleteBuffers(1, &_bufferId);
+            _bufferId = 0;
+        }
+    }
+
+private:
+    uint32_t _bufferId;
+};
+
+#endif // GLCAMERAUNIFORMS_H
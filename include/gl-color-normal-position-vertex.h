@@ -1,15 +1,23 @@
 #ifndef GLCOLORNORMALPOSITIONVERTEX_H
 #define GLCOLORNORMALPOSITIONVERTEX_H
 
+#include "gl-camera-uniforms.h"
+#include "gl-draw-ranges.h"
+#include "gl-program-cache.h"
+#include "gl-state.h"
+#include "meshsimplify.h"
+#include "vertexcache.h"
 #include <cmath>
 #include <fstream>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <iostream>
 #include <map>
 #include <sstream>
+#include <tuple>
 #include <vector>
 
 #if FALSE
@@ -294,33 +302,50 @@ public:
     glm::vec3 nor;
 };
 
+// The same vertex in half the bytes, the color as RGBA8 and the normal as signed 10:10:10:2
+class PackedVertexType
+{
+public:
+    glm::vec3 pos;
+    uint32_t col;
+    uint32_t nor;
+};
+
+inline PackedVertexType packVertex(
+    VertexType const &vertex)
+{
+    // Ten bits only hold the direction of a unit normal
+    auto length = glm::length(vertex.nor);
+    auto normal = length > 0.0f ? vertex.nor / length : vertex.nor;
+
+    return PackedVertexType({vertex.pos, glm::packUnorm4x8(vertex.col), glm::packSnorm3x10_1x2(glm::vec4(normal, 0.0f))});
+}
+
 class ShaderType
 {
     GLuint _shaderId;
-    GLuint _projectionUniformId;
-    GLuint _viewUniformId;
     GLuint _modelUniformId;
+    GLuint _instancedUniformId;
 
-    std::string _projectionUniformName;
-    std::string _viewUniformName;
     std::string _modelUniformName;
+    std::string _instancedUniformName;
 
     std::string _vertexAttributeName;
     std::string _colorAttributeName;
     std::string _normalAttributeName;
+    std::string _instanceAttributeName;
 
 public:
     ShaderType()
         : _shaderId(0),
-          _projectionUniformId(0),
-          _viewUniformId(0),
           _modelUniformId(0),
-          _projectionUniformName("u_projection"),
-          _viewUniformName("u_view"),
+          _instancedUniformId(0),
           _modelUniformName("u_model"),
+          _instancedUniformName("u_instanced"),
           _vertexAttributeName("vertex"),
           _colorAttributeName("color"),
-          _normalAttributeName("normal")
+          _normalAttributeName("normal"),
+          _instanceAttributeName("instance")
     {}
 
     virtual ~ShaderType() {}
@@ -332,7 +357,7 @@ public:
 
     void use() const
     {
-        glUseProgram(_shaderId);
+        GlState::current().useProgram(_shaderId);
     }
 
     virtual bool compileFromFile(
@@ -350,156 +375,99 @@ public:
         return compile(vertShaderStr, fragShaderStr);
     }
 
-    bool compileDefaultShader()
+    static std::string defaultVertexShader()
     {
-        static GLuint defaultShader = 0;
-
-        if (defaultShader == 0)
-        {
-            std::string const vshader(
-                "#version 150\n"
-
-                "in vec3 vertex;\n"
-                "in vec4 color;\n"
-                "in vec3 normal;\n"
-
-                "uniform mat4 u_projection;\n"
-                "uniform mat4 u_view;\n"
-                "uniform mat4 u_model;\n"
-
-                "out vec4 f_color;\n"
-
-                "void main()\n"
-                "{\n"
-                "    gl_Position = u_projection * u_view * u_model * vec4(vertex.xyz, 1.0);\n"
-                "    f_color = color;\n"
-
-                "    vec3 vertexPosition_cameraspace  = (u_view * u_model * vec4(vertex, 0)).xyz;\n"
-                "    vec3 EyeDirection_cameraspace = vec3(0,0,0) - vertexPosition_cameraspace;\n"
-                "    vec3 LightPosition_cameraspace = (u_view * vec4(-500.0, -500.0, 500.0,1)).xyz;\n"
-                "    vec3 LightDirection_cameraspace = LightPosition_cameraspace + EyeDirection_cameraspace;\n"
-                "    vec3 Normal_cameraspace = (u_view * u_model * vec4(normal, 0)).xyz;\n"
-                "    vec3 n = normalize( Normal_cameraspace );\n"
-                "    vec3 l = normalize( LightDirection_cameraspace );\n"
-                "    float cosTheta = clamp(dot(n, l), 0.3, 1);\n"
-
-                "    f_color = (cosTheta * color) + (color * vec4(0.8, 0.8, 0.8, 1.0));\n"
-                "}\n");
-
-            std::string const fshader(
-                "#version 150\n"
-
-                "in vec4 f_color;\n"
-                "out vec4 color;\n"
+        return std::string(
+            "#version 150\n"
+
+            "in vec3 vertex;\n"
+            "in vec4 color;\n"
+            "in vec3 normal;\n"
+            "in mat4 instance;\n"
+
+            CAMERA_UNIFORM_BLOCK "\n"
+            "uniform mat4 u_model;\n"
+            "uniform bool u_instanced;\n"
+
+            "out vec4 f_color;\n"
+
+            "void main()\n"
+            "{\n"
+            "    mat4 model = u_instanced ? u_model * instance : u_model;\n"
+            "    gl_Position = u_projection * u_view * model * vec4(vertex.xyz, 1.0);\n"
+            "    f_color = color;\n"
+
+            "    vec3 vertexPosition_cameraspace  = (u_view * model * vec4(vertex, 0)).xyz;\n"
+            "    vec3 EyeDirection_cameraspace = vec3(0,0,0) - vertexPosition_cameraspace;\n"
+            "    vec3 LightPosition_cameraspace = (u_view * vec4(-500.0, -500.0, 500.0,1)).xyz;\n"
+            "    vec3 LightDirection_cameraspace = LightPosition_cameraspace + EyeDirection_cameraspace;\n"
+            "    vec3 Normal_cameraspace = (u_view * model * vec4(normal, 0)).xyz;\n"
+            "    vec3 n = normalize( Normal_cameraspace );\n"
+            "    vec3 l = normalize( LightDirection_cameraspace );\n"
+            "    float cosTheta = clamp(dot(n, l), 0.3, 1);\n"
+
+            "    f_color = (cosTheta * color) + (color * vec4(0.8, 0.8, 0.8, 1.0));\n"
+            "}\n");
+    }
 
-                "void main()\n"
-                "{\n"
-                "   color = f_color;\n"
-                "}\n");
+    static std::string defaultFragmentShader()
+    {
+        return std::string(
+            "#version 150\n"
 
-            if (compile(vshader, fshader))
-            {
-                defaultShader = _shaderId;
+            "in vec4 f_color;\n"
+            "out vec4 color;\n"
 
-                return true;
-            }
+            "void main()\n"
+            "{\n"
+            "   color = f_color;\n"
+            "}\n");
+    }
 
-            return false;
-        }
+    // Starts building the default program ahead of compileDefaultShader()
+    static void requestDefaultShader()
+    {
+        ProgramCache::current().request(defaultVertexShader(), defaultFragmentShader());
+    }
 
-        return true;
+    bool compileDefaultShader()
+    {
+        return compile(defaultVertexShader(), defaultFragmentShader());
     }
 
+    // Instances with the same sources share one program from the cache
     virtual bool compile(
         std::string const &vertShaderStr,
         std::string const &fragShaderStr)
     {
-        GLuint vertShader = glCreateShader(GL_VERTEX_SHADER);
-        GLuint fragShader = glCreateShader(GL_FRAGMENT_SHADER);
-        const char *vertShaderSrc = vertShaderStr.c_str();
-        const char *fragShaderSrc = fragShaderStr.c_str();
-
-        GLint result = GL_FALSE;
-        GLint logLength;
-
-        // Compile vertex shader
-        glShaderSource(vertShader, 1, &vertShaderSrc, NULL);
-        glCompileShader(vertShader);
-
-        // Check vertex shader
-        glGetShaderiv(vertShader, GL_COMPILE_STATUS, &result);
-        if (result == GL_FALSE)
-        {
-            glGetShaderiv(vertShader, GL_INFO_LOG_LENGTH, &logLength);
-            std::vector<GLchar> vertShaderError(static_cast<size_t>((logLength > 1) ? logLength : 1));
-            glGetShaderInfoLog(vertShader, logLength, NULL, &vertShaderError[0]);
-            std::cout << &vertShaderError[0] << std::endl;
-
-            return false;
-        }
-
-        // Compile fragment shader
-        glShaderSource(fragShader, 1, &fragShaderSrc, NULL);
-        glCompileShader(fragShader);
-
-        // Check fragment shader
-        glGetShaderiv(fragShader, GL_COMPILE_STATUS, &result);
-        if (result == GL_FALSE)
-        {
-            glGetShaderiv(fragShader, GL_INFO_LOG_LENGTH, &logLength);
-            std::vector<GLchar> fragShaderError(static_cast<size_t>((logLength > 1) ? logLength : 1));
-            glGetShaderInfoLog(fragShader, logLength, NULL, &fragShaderError[0]);
-            std::cout << &fragShaderError[0] << std::endl;
-
-            return false;
-        }
-
-        _shaderId = glCreateProgram();
-        glAttachShader(_shaderId, vertShader);
-        glAttachShader(_shaderId, fragShader);
-        glLinkProgram(_shaderId);
-
-        glGetProgramiv(_shaderId, GL_LINK_STATUS, &result);
-        if (result == GL_FALSE)
+        _shaderId = ProgramCache::current().program(vertShaderStr, fragShaderStr);
+        if (_shaderId == 0)
         {
-            glGetProgramiv(_shaderId, GL_INFO_LOG_LENGTH, &logLength);
-            std::vector<GLchar> programError(static_cast<size_t>((logLength > 1) ? logLength : 1));
-            glGetProgramInfoLog(_shaderId, logLength, NULL, &programError[0]);
-            std::cout << &programError[0] << std::endl;
-
             return false;
         }
 
-        glDeleteShader(vertShader);
-        glDeleteShader(fragShader);
+        CameraUniformBuffer::bindProgram(_shaderId);
 
-        _projectionUniformId = glGetUniformLocation(_shaderId, _projectionUniformName.c_str());
-        _viewUniformId = glGetUniformLocation(_shaderId, _viewUniformName.c_str());
         _modelUniformId = glGetUniformLocation(_shaderId, _modelUniformName.c_str());
+        _instancedUniformId = glGetUniformLocation(_shaderId, _instancedUniformName.c_str());
 
         return true;
     }
 
-    void setupMatrices(
-        glm::mat4 const &projection,
-        glm::mat4 const &view,
+    // Projection and view come from the camera buffer, this only uploads the model of the next draw
+    void setupModel(
         glm::mat4 const &model)
     {
-        use();
-
-        glUniformMatrix4fv(_projectionUniformId, 1, false, glm::value_ptr(projection));
-        glUniformMatrix4fv(_viewUniformId, 1, false, glm::value_ptr(view));
         glUniformMatrix4fv(_modelUniformId, 1, false, glm::value_ptr(model));
+        glUniform1i(_instancedUniformId, 0);
     }
 
-    void setupMatrices(
-        glm::mat4 const &projectionView,
-        glm::mat4 const &model)
+    // For BufferType::renderInstanced(), every instance is placed by its own matrix after the model matrix
+    void setupInstancedModel(
+        glm::mat4 const &model = glm::mat4(1.0f))
     {
-        use();
-
-        glUniformMatrix4fv(_projectionUniformId, 1, false, glm::value_ptr(projectionView));
         glUniformMatrix4fv(_modelUniformId, 1, false, glm::value_ptr(model));
+        glUniform1i(_instancedUniformId, 1);
     }
 
     void setupAttributes() const
@@ -541,6 +509,74 @@ public:
 
         glEnableVertexAttribArray(GLuint(normalAttrib));
     }
+
+    // For buffers with PackedVertexType, the shader sees the same attributes
+    void setupPackedAttributes() const
+    {
+        auto vertexSize = sizeof(PackedVertexType);
+
+        auto vertexAttrib = glGetAttribLocation(_shaderId, _vertexAttributeName.c_str());
+
+        glVertexAttribPointer(
+            GLuint(vertexAttrib),
+            sizeof(PackedVertexType::pos) / sizeof(float),
+            GL_FLOAT,
+            GL_FALSE,
+            static_cast<GLsizei>(vertexSize),
+            0);
+
+        glEnableVertexAttribArray(GLuint(vertexAttrib));
+
+        auto colorAttrib = glGetAttribLocation(_shaderId, _colorAttributeName.c_str());
+
+        glVertexAttribPointer(
+            GLuint(colorAttrib),
+            sizeof(PackedVertexType::col),
+            GL_UNSIGNED_BYTE,
+            GL_TRUE,
+            static_cast<GLsizei>(vertexSize),
+            reinterpret_cast<const GLvoid *>(sizeof(PackedVertexType::pos)));
+
+        glEnableVertexAttribArray(GLuint(colorAttrib));
+
+        // Packed formats always have four components, the shader ignores the fourth
+        auto normalAttrib = glGetAttribLocation(_shaderId, _normalAttributeName.c_str());
+
+        glVertexAttribPointer(
+            GLuint(normalAttrib),
+            4,
+            GL_INT_2_10_10_10_REV,
+            GL_TRUE,
+            static_cast<GLsizei>(vertexSize),
+            reinterpret_cast<const GLvoid *>(sizeof(PackedVertexType::pos) + sizeof(PackedVertexType::col)));
+
+        glEnableVertexAttribArray(GLuint(normalAttrib));
+    }
+
+    // The instance matrix takes four attribute locations, one per column, that advance per instance
+    void setupInstanceAttributes() const
+    {
+        auto instanceAttrib = glGetAttribLocation(_shaderId, _instanceAttributeName.c_str());
+        if (instanceAttrib < 0)
+        {
+            return;
+        }
+
+        for (GLuint column = 0; column < 4; column++)
+        {
+            glVertexAttribPointer(
+                GLuint(instanceAttrib) + column,
+                4,
+                GL_FLOAT,
+                GL_FALSE,
+                static_cast<GLsizei>(sizeof(glm::mat4)),
+                reinterpret_cast<const GLvoid *>(column * sizeof(glm::vec4)));
+
+            glVertexAttribDivisor(GLuint(instanceAttrib) + column, 1);
+
+            glEnableVertexAttribArray(GLuint(instanceAttrib) + column);
+        }
+    }
 };
 
 class BufferType
@@ -551,9 +587,17 @@ public:
         : _shader(shader),
           _vertexCount(0),
           _nextColor(glm::vec4(1.0f)),
+          _boundsMin(glm::vec3(0.0f)),
+          _boundsMax(glm::vec3(0.0f)),
           _vertexArrayId(0),
           _vertexBufferId(0),
-          _drawMode(GL_TRIANGLES)
+          _indexBufferId(0),
+          _indexCount(0),
+          _instanceBufferId(0),
+          _instanceCapacity(0),
+          _instanceCount(0),
+          _drawMode(GL_TRIANGLES),
+          _packVertices(false)
     {}
 
     virtual ~BufferType() {}
@@ -578,11 +622,12 @@ public:
         _drawMode = mode;
     }
 
+    // A range of vertices, or of indices once the buffer is indexed
     void addFace(
         int start,
         int count)
     {
-        _faces.insert(std::make_pair(start, count));
+        _faces.add(GLint(start), GLsizei(count));
     }
 
     size_t vertexCount() const
@@ -590,6 +635,59 @@ public:
         return _vertexCount;
     }
 
+    uint32_t vertexArrayId() const
+    {
+        return _vertexArrayId;
+    }
+
+    // Zero when the vertices are drawn as they are, without an index buffer.
+    // Only counts the full mesh, the simpler levels come after it in the index buffer.
+    size_t indexCount() const
+    {
+        return _indexCount;
+    }
+
+    // The full mesh and the levels generateLods() added to it
+    size_t lodCount() const
+    {
+        return _lodFirsts.size() + 1;
+    }
+
+    size_t lodTriangleCount(
+        size_t lod) const
+    {
+        if (lod == 0 || lod >= lodCount())
+        {
+            return (_indexCount > 0 ? _indexCount : _vertexCount) / 3;
+        }
+
+        return _lodCounts[lod - 1] / 3;
+    }
+
+    // The simplest level that may be used at this distance from the camera
+    size_t lodForDistance(
+        float distance) const
+    {
+        size_t lod = 0;
+        while (lod < _lodDistances.size() && distance >= _lodDistances[lod])
+        {
+            lod++;
+        }
+
+        return lod;
+    }
+
+    // Box around the vertices in model space, known after setup()
+    glm::vec3 const &boundsMin() const
+    {
+        return _boundsMin;
+    }
+
+    glm::vec3 const &boundsMax() const
+    {
+        return _boundsMax;
+    }
+
     BufferType &vertex(
         glm::vec3 const &position)
     {
@@ -750,6 +848,11 @@ public:
             return *this;
         }
 
+        // Corners that share position, normal and material become one vertex in the index buffer
+        std::map<std::tuple<int, int, int>, uint32_t> known;
+        std::vector<VertexType> loaded;
+        std::vector<uint32_t> indices;
+
         for (size_t s = 0; s < shapes.size(); s++)
         {
             if (shapes[s].name == shapeName)
@@ -759,47 +862,134 @@ public:
                 auto faceCount = shapes[s].mesh.num_face_vertices.size();
                 for (size_t f = 0; f < faceCount; f++)
                 {
-                    if (materials.size() > 0 && shapes[s].mesh.material_ids[f] >= 0)
+                    auto materialId = shapes[s].mesh.material_ids[f];
+                    if (materials.size() > 0 && materialId >= 0)
                     {
                         // per-face material
-                        auto m = materials[shapes[s].mesh.material_ids[f]];
+                        auto m = materials[materialId];
 
                         this->color(glm::vec4(m.diffuse[0], m.diffuse[1], m.diffuse[2], 1.0f));
                     }
 
-                    int fv = shapes[s].mesh.num_face_vertices[f];
+                    size_t fv = shapes[s].mesh.num_face_vertices[f];
 
                     // Loop over vertices in the face.
                     for (size_t v = 0; v < fv; v++)
                     {
                         // access to vertex
                         tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
+
+                        auto key = std::make_tuple(idx.vertex_index, idx.normal_index, materialId);
+                        auto found = known.find(key);
+                        if (found != known.end())
+                        {
+                            indices.push_back(found->second);
+                            continue;
+                        }
+
                         tinyobj::real_t vx = attrib.vertices[3 * idx.vertex_index + 0];
                         tinyobj::real_t vy = attrib.vertices[3 * idx.vertex_index + 1];
                         tinyobj::real_t vz = attrib.vertices[3 * idx.vertex_index + 2];
                         tinyobj::real_t nx = attrib.normals[3 * idx.normal_index + 0];
                         tinyobj::real_t ny = attrib.normals[3 * idx.normal_index + 1];
                         tinyobj::real_t nz = attrib.normals[3 * idx.normal_index + 2];
-                        // tinyobj::real_t tx = attrib.texcoords[2 * idx.texcoord_index + 0];
-                        // tinyobj::real_t ty = attrib.texcoords[2 * idx.texcoord_index + 1];
-                        // Optional: vertex colors
-                        // tinyobj::real_t red = attrib.colors[3*idx.vertex_index+0];
-                        // tinyobj::real_t green = attrib.colors[3*idx.vertex_index+1];
-                        // tinyobj::real_t blue = attrib.colors[3*idx.vertex_index+2];
-
-                        this->normal(glm::vec3(nx, ny, nz))
-                            .vertex(glm::vec3(vx, vy, vz));
+
+                        auto index = uint32_t(loaded.size());
+                        known.insert(std::make_pair(key, index));
+                        indices.push_back(index);
+
+                        loaded.push_back(VertexType({glm::vec3(vx, vy, vz), _nextColor, glm::vec3(nx, ny, nz)}));
                     }
                     index_offset += fv;
                 }
             }
         }
 
+        // Triangles in cache order, then the vertices in the order the triangles use them
+        VertexCache::optimizeTriangles(indices, loaded.size());
+        VertexCache::optimizeVertices(loaded, indices);
+
+        auto first = uint32_t(_verts.size());
+        for (auto index : indices)
+        {
+            _indices.push_back(first + index);
+        }
+        _verts.insert(_verts.end(), loaded.begin(), loaded.end());
+        _vertexCount = _verts.size();
+
         return *this;
     }
 
 #endif
 
+    // Adds simpler versions of an indexed triangle mesh after the full one in the index buffer,
+    // each with about half the triangles of the level before it. A level is used from a distance
+    // that grows with the size of the mesh and doubles for every level.
+    BufferType &generateLods(
+        size_t levels)
+    {
+        // Levels start at this many times the radius of the mesh
+        const float firstLodDistance = 16.0f;
+
+        if (!_lodFirsts.empty())
+        {
+            _indices.resize(_lodFirsts[0]);
+        }
+        _lodFirsts.clear();
+        _lodCounts.clear();
+        _lodDistances.clear();
+
+        if (_indices.empty() || !_faces.empty())
+        {
+            return *this;
+        }
+
+        auto boundsMin = _verts[0].pos;
+        auto boundsMax = _verts[0].pos;
+        for (auto &v : _verts)
+        {
+            boundsMin = glm::min(boundsMin, v.pos);
+            boundsMax = glm::max(boundsMax, v.pos);
+        }
+        auto radius = glm::length(boundsMax - boundsMin) * 0.5f;
+
+        // Every level starts again from the full mesh, so the errors do not add up
+        std::vector<uint32_t> full(_indices);
+        auto previousCount = full.size();
+        std::vector<uint32_t> lod;
+        for (size_t level = 1; level <= levels; level++)
+        {
+            auto target = (full.size() >> level) / 3 * 3;
+            MeshSimplify::simplify(_verts, full, target, lod);
+
+            // Stop when the mesh will not get much simpler
+            if (lod.empty() || lod.size() > previousCount * 3 / 4)
+            {
+                break;
+            }
+
+            VertexCache::optimizeTriangles(lod, _verts.size());
+
+            _lodFirsts.push_back(_indices.size());
+            _lodCounts.push_back(lod.size());
+            _lodDistances.push_back(radius * firstLodDistance * float(1 << (level - 1)));
+            _indices.insert(_indices.end(), lod.begin(), lod.end());
+            previousCount = lod.size();
+        }
+        _vertexCount = _verts.size();
+
+        return *this;
+    }
+
+    // The vertex buffer gets PackedVertexType instead of VertexType, set before setup()
+    BufferType &packVertices(
+        bool packed = true)
+    {
+        _packVertices = packed;
+
+        return *this;
+    }
+
     bool setup()
     {
         return setup(_drawMode);
@@ -809,54 +999,236 @@ public:
     {
         _drawMode = mode;
         _vertexCount = _verts.size();
+        _faces.merge(_drawMode);
+
+        if (!_verts.empty())
+        {
+            _boundsMin = _boundsMax = _verts[0].pos;
+            for (auto &v : _verts)
+            {
+                _boundsMin = glm::min(_boundsMin, v.pos);
+                _boundsMax = glm::max(_boundsMax, v.pos);
+            }
+        }
 
         glGenVertexArrays(1, &_vertexArrayId);
         glGenBuffers(1, &_vertexBufferId);
 
-        glBindVertexArray(_vertexArrayId);
-        glBindBuffer(GL_ARRAY_BUFFER, _vertexBufferId);
+        GlState::current().bindVertexArray(_vertexArrayId);
+        GlState::current().bindArrayBuffer(_vertexBufferId);
+
+        if (_packVertices)
+        {
+            std::vector<PackedVertexType> packed;
+            packed.reserve(_verts.size());
+            for (auto &v : _verts)
+            {
+                packed.push_back(packVertex(v));
+            }
+
+            glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(packed.size() * sizeof(PackedVertexType)), reinterpret_cast<const GLvoid *>(packed.data()), GL_STATIC_DRAW);
+
+            _shader.setupPackedAttributes();
+        }
+        else
+        {
+            glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(_verts.size() * sizeof(VertexType)), 0, GL_STATIC_DRAW);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, GLsizeiptr(_verts.size() * sizeof(VertexType)), reinterpret_cast<const GLvoid *>(&_verts[0]));
 
-        glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(_verts.size() * sizeof(VertexType)), 0, GL_STATIC_DRAW);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, GLsizeiptr(_verts.size() * sizeof(VertexType)), reinterpret_cast<const GLvoid *>(&_verts[0]));
+            _shader.setupAttributes();
+        }
 
-        _shader.setupAttributes();
+        // The element buffer binding is part of the vertex array, so it stays bound with it
+        _indexCount = _lodFirsts.empty() ? _indices.size() : _lodFirsts[0];
+        if (_indexCount > 0)
+        {
+            glGenBuffers(1, &_indexBufferId);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _indexBufferId);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, GLsizeiptr(_indices.size() * sizeof(uint32_t)), reinterpret_cast<const GLvoid *>(&_indices[0]), GL_STATIC_DRAW);
+        }
 
-        glBindVertexArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        GlState::current().bindVertexArray(0);
+        GlState::current().bindArrayBuffer(0);
 
         _verts.clear();
+        _indices.clear();
 
         return true;
     }
 
     void render()
     {
-        glBindVertexArray(_vertexArrayId);
-        if (_faces.empty())
+        GlState::current().bindVertexArray(_vertexArrayId);
+        if (!_faces.empty())
+        {
+            if (_indexCount > 0)
+            {
+                _faces.drawElements(_drawMode);
+            }
+            else
+            {
+                _faces.drawArrays(_drawMode);
+            }
+        }
+        else if (_indexCount > 0)
+        {
+            glDrawElements(_drawMode, static_cast<GLsizei>(_indexCount), GL_UNSIGNED_INT, 0);
+        }
+        else
         {
             glDrawArrays(_drawMode, 0, static_cast<GLsizei>(_vertexCount));
         }
+    }
+
+    void render(
+        size_t lod)
+    {
+        if (lod == 0 || lod >= lodCount())
+        {
+            render();
+
+            return;
+        }
+
+        GlState::current().bindVertexArray(_vertexArrayId);
+        glDrawElements(_drawMode, static_cast<GLsizei>(_lodCounts[lod - 1]), GL_UNSIGNED_INT, lodOffset(lod));
+    }
+
+    // Replaces the matrices renderInstanced() draws the mesh with, one per instance.
+    // The buffer only grows and is orphaned on every call, so it can change every frame.
+    void setInstances(
+        glm::mat4 const *matrices,
+        size_t count)
+    {
+        _instanceCount = count;
+
+        if (count == 0)
+        {
+            return;
+        }
+
+        if (_instanceBufferId == 0)
+        {
+            glGenBuffers(1, &_instanceBufferId);
+
+            GlState::current().bindVertexArray(_vertexArrayId);
+            GlState::current().bindArrayBuffer(_instanceBufferId);
+
+            _shader.setupInstanceAttributes();
+        }
         else
         {
-            for (auto pair : _faces)
+            GlState::current().bindArrayBuffer(_instanceBufferId);
+        }
+
+        if (count > _instanceCapacity)
+        {
+            _instanceCapacity = count > _instanceCapacity * 2 ? count : _instanceCapacity * 2;
+        }
+
+        glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(_instanceCapacity * sizeof(glm::mat4)), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, GLsizeiptr(count * sizeof(glm::mat4)), reinterpret_cast<const GLvoid *>(matrices));
+    }
+
+    size_t instanceCount() const
+    {
+        return _instanceCount;
+    }
+
+    // Draws all instances set with setInstances() in one call, after ShaderType::setupInstancedModel()
+    void renderInstanced()
+    {
+        if (_instanceCount == 0)
+        {
+            return;
+        }
+
+        GlState::current().bindVertexArray(_vertexArrayId);
+        auto instanceCount = static_cast<GLsizei>(_instanceCount);
+        if (!_faces.empty())
+        {
+            if (_indexCount > 0)
             {
-                glDrawArrays(_drawMode, pair.first, pair.second);
+                _faces.drawElementsInstanced(_drawMode, instanceCount);
             }
+            else
+            {
+                _faces.drawArraysInstanced(_drawMode, instanceCount);
+            }
+        }
+        else if (_indexCount > 0)
+        {
+            glDrawElementsInstanced(_drawMode, static_cast<GLsizei>(_indexCount), GL_UNSIGNED_INT, 0, instanceCount);
+        }
+        else
+        {
+            glDrawArraysInstanced(_drawMode, 0, static_cast<GLsizei>(_vertexCount), instanceCount);
+        }
+    }
+
+    // Draws count instances from first on, at one level of detail. Instances at
+    // other levels can go in the same setInstances() call, sorted by level.
+    void renderInstanced(
+        size_t lod,
+        size_t firstInstance,
+        size_t count)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+
+        if (firstInstance == 0 && count == _instanceCount && (lod == 0 || lod >= lodCount()))
+        {
+            renderInstanced();
+
+            return;
+        }
+
+        GlState::current().bindVertexArray(_vertexArrayId);
+        auto instanceCount = static_cast<GLsizei>(count);
+        auto baseInstance = static_cast<GLuint>(firstInstance);
+        if (lod > 0 && lod < lodCount())
+        {
+            glDrawElementsInstancedBaseInstance(_drawMode, static_cast<GLsizei>(_lodCounts[lod - 1]), GL_UNSIGNED_INT, lodOffset(lod), instanceCount, baseInstance);
+        }
+        else if (_indexCount > 0)
+        {
+            glDrawElementsInstancedBaseInstance(_drawMode, static_cast<GLsizei>(_indexCount), GL_UNSIGNED_INT, 0, instanceCount, baseInstance);
+        }
+        else
+        {
+            glDrawArraysInstancedBaseInstance(_drawMode, 0, static_cast<GLsizei>(_vertexCount), instanceCount, baseInstance);
         }
-        glBindVertexArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
     }
 
     void cleanup()
     {
+        if (_instanceBufferId != 0)
+        {
+            GlState::current().deleteBuffer(_instanceBufferId);
+            _instanceBufferId = 0;
+        }
+        _instanceCapacity = 0;
+        _instanceCount = 0;
+        if (_indexBufferId != 0)
+        {
+            glDeleteBuffers(1, &_indexBufferId);
+            _indexBufferId = 0;
+        }
+        _indexCount = 0;
+        _lodFirsts.clear();
+        _lodCounts.clear();
+        _lodDistances.clear();
+        _faces.cleanup();
         if (_vertexBufferId != 0)
         {
-            glDeleteBuffers(1, &_vertexBufferId);
+            GlState::current().deleteBuffer(_vertexBufferId);
             _vertexBufferId = 0;
         }
         if (_vertexArrayId != 0)
         {
-            glDeleteVertexArrays(1, &_vertexArrayId);
+            GlState::current().deleteVertexArray(_vertexArrayId);
             _vertexArrayId = 0;
         }
     }
@@ -867,10 +1239,28 @@ private:
     std::vector<VertexType> _verts;
     glm::vec4 _nextColor;
     glm::vec3 _nextNormal;
+    glm::vec3 _boundsMin;
+    glm::vec3 _boundsMax;
     uint32_t _vertexArrayId;
     uint32_t _vertexBufferId;
+    std::vector<uint32_t> _indices;
+    uint32_t _indexBufferId;
+    size_t _indexCount;
+    uint32_t _instanceBufferId;
+    size_t _instanceCapacity;
+    size_t _instanceCount;
     GLenum _drawMode;
-    std::map<int, int> _faces;
+    DrawRanges _faces;
+    bool _packVertices;
+    std::vector<size_t> _lodFirsts;
+    std::vector<size_t> _lodCounts;
+    std::vector<float> _lodDistances;
+
+    const GLvoid *lodOffset(
+        size_t lod) const
+    {
+        return reinterpret_cast<const GLvoid *>(_lodFirsts[lod - 1] * sizeof(uint32_t));
+    }
 };
 
 #endif // GLCOLORNORMALPOSITIONVERTEX_H
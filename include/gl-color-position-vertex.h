@@ -1,6 +1,10 @@
 #ifndef GLCOLORPOSITIONVERTEX_H
 #define GLCOLORPOSITIONVERTEX_H
 
+#include "gl-camera-uniforms.h"
+#include "gl-draw-ranges.h"
+#include "gl-program-cache.h"
+#include "gl-state.h"
 #include <cmath>
 #include <fstream>
 #include <glad/glad.h>
@@ -8,7 +12,6 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <iostream>
-#include <map>
 #include <sstream>
 #include <vector>
 
@@ -22,16 +25,31 @@ namespace ColorPosition
         glm::vec4 col;
     };
 
+    // Compact vertex for streamed geometry, the color is stored as normalized RGBA8
+    class PackedVertexType
+    {
+    public:
+        glm::vec3 pos;
+        uint32_t col;
+    };
+
+    inline uint32_t packColor(
+        glm::vec4 const &color)
+    {
+        auto r = static_cast<uint32_t>(glm::clamp(color.x, 0.0f, 1.0f) * 255.0f + 0.5f);
+        auto g = static_cast<uint32_t>(glm::clamp(color.y, 0.0f, 1.0f) * 255.0f + 0.5f);
+        auto b = static_cast<uint32_t>(glm::clamp(color.z, 0.0f, 1.0f) * 255.0f + 0.5f);
+        auto a = static_cast<uint32_t>(glm::clamp(color.w, 0.0f, 1.0f) * 255.0f + 0.5f);
+
+        return r | (g << 8) | (b << 16) | (a << 24);
+    }
+
     class ShaderType
     {
     public:
         ShaderType()
             : _shaderId(0),
-              _projectionUniformId(0),
-              _viewUniformId(0),
               _modelUniformId(0),
-              _projectionUniformName("u_projection"),
-              _viewUniformName("u_view"),
               _modelUniformName("u_model"),
               _vertexAttributeName("vertex"),
               _colorAttributeName("color")
@@ -46,7 +64,7 @@ namespace ColorPosition
 
         void use() const
         {
-            glUseProgram(_shaderId);
+            GlState::current().useProgram(_shaderId);
         }
 
         virtual bool compileFromFile(
@@ -64,21 +82,15 @@ namespace ColorPosition
             return compile(vertShaderStr, fragShaderStr);
         }
 
-        bool compileDefaultShader()
+        static std::string defaultVertexShader()
         {
-            if (ShaderType::defaultShader != 0)
-            {
-                return true;
-            }
-
-            std::string const vshader(
+            return std::string(
                 "#version 150\n"
 
                 "in vec3 vertex;"
                 "in vec4 color;"
 
-                "uniform mat4 u_projection;"
-                "uniform mat4 u_view;"
+                CAMERA_UNIFORM_BLOCK
                 "uniform mat4 u_model;"
 
                 "out vec4 f_color;"
@@ -88,8 +100,11 @@ namespace ColorPosition
                 "    gl_Position = u_projection * u_view * u_model * vec4(vertex.xyz, 1.0);"
                 "    f_color = color;"
                 "}");
+        }
 
-            std::string const fshader(
+        static std::string defaultFragmentShader()
+        {
+            return std::string(
                 "#version 150\n"
 
                 "in vec4 f_color;"
@@ -99,106 +114,45 @@ namespace ColorPosition
                 "{"
                 "   color = f_color;"
                 "}");
+        }
 
-            if (!compile(vshader, fshader))
-            {
-                return false;
-            }
-
-            ShaderType::defaultShader = _shaderId;
+        // Starts building the default program ahead of compileDefaultShader()
+        static void requestDefaultShader()
+        {
+            ProgramCache::current().request(defaultVertexShader(), defaultFragmentShader());
+        }
 
-            return true;
+        bool compileDefaultShader()
+        {
+            return compile(defaultVertexShader(), defaultFragmentShader());
         }
 
+        // Instances with the same sources share one program from the cache
         virtual bool compile(
             std::string const &vertShaderStr,
             std::string const &fragShaderStr)
         {
-            GLuint vertShader = glCreateShader(GL_VERTEX_SHADER);
-            GLuint fragShader = glCreateShader(GL_FRAGMENT_SHADER);
-            const char *vertShaderSrc = vertShaderStr.c_str();
-            const char *fragShaderSrc = fragShaderStr.c_str();
-
-            GLint result = GL_FALSE;
-            GLint logLength;
-
-            // Compile vertex shader
-            glShaderSource(vertShader, 1, &vertShaderSrc, NULL);
-            glCompileShader(vertShader);
-
-            // Check vertex shader
-            glGetShaderiv(vertShader, GL_COMPILE_STATUS, &result);
-            if (result == GL_FALSE)
-            {
-                glGetShaderiv(vertShader, GL_INFO_LOG_LENGTH, &logLength);
-                std::vector<GLchar> vertShaderError(static_cast<size_t>((logLength > 1) ? logLength : 1));
-                glGetShaderInfoLog(vertShader, logLength, NULL, &vertShaderError[0]);
-                std::cout << &vertShaderError[0] << std::endl;
-
-                return false;
-            }
-
-            // Compile fragment shader
-            glShaderSource(fragShader, 1, &fragShaderSrc, NULL);
-            glCompileShader(fragShader);
-
-            // Check fragment shader
-            glGetShaderiv(fragShader, GL_COMPILE_STATUS, &result);
-            if (result == GL_FALSE)
-            {
-                glGetShaderiv(fragShader, GL_INFO_LOG_LENGTH, &logLength);
-                std::vector<GLchar> fragShaderError(static_cast<size_t>((logLength > 1) ? logLength : 1));
-                glGetShaderInfoLog(fragShader, logLength, NULL, &fragShaderError[0]);
-                std::cout << &fragShaderError[0] << std::endl;
-
-                return false;
-            }
-
-            _shaderId = glCreateProgram();
-            glAttachShader(_shaderId, vertShader);
-            glAttachShader(_shaderId, fragShader);
-            glLinkProgram(_shaderId);
-
-            glGetProgramiv(_shaderId, GL_LINK_STATUS, &result);
-            if (result == GL_FALSE)
+            _shaderId = ProgramCache::current().program(vertShaderStr, fragShaderStr);
+            if (_shaderId == 0)
             {
-                glGetProgramiv(_shaderId, GL_INFO_LOG_LENGTH, &logLength);
-                std::vector<GLchar> programError(static_cast<size_t>((logLength > 1) ? logLength : 1));
-                glGetProgramInfoLog(_shaderId, logLength, NULL, &programError[0]);
-                std::cout << &programError[0] << std::endl;
-
                 return false;
             }
 
-            glDeleteShader(vertShader);
-            glDeleteShader(fragShader);
-
-            _projectionUniformId = glGetUniformLocation(_shaderId, _projectionUniformName.c_str());
-            _viewUniformId = glGetUniformLocation(_shaderId, _viewUniformName.c_str());
-            _modelUniformId = glGetUniformLocation(_shaderId, _modelUniformName.c_str());
+            CameraUniformBuffer::bindProgram(_shaderId);
+            setupUniforms();
 
             return true;
         }
 
-        void setupMatrices(
-            glm::mat4 const &projection,
-            glm::mat4 const &view,
-            glm::mat4 const &model)
+        void setupUniforms()
         {
-            use();
-
-            glUniformMatrix4fv(_projectionUniformId, 1, false, glm::value_ptr(projection));
-            glUniformMatrix4fv(_viewUniformId, 1, false, glm::value_ptr(view));
-            glUniformMatrix4fv(_modelUniformId, 1, false, glm::value_ptr(model));
+            _modelUniformId = glGetUniformLocation(_shaderId, _modelUniformName.c_str());
         }
 
-        void setupMatrices(
-            glm::mat4 const &projectionView,
+        // Projection and view come from the camera buffer, this only uploads the model of the next draw
+        void setupModel(
             glm::mat4 const &model)
         {
-            use();
-
-            glUniformMatrix4fv(_projectionUniformId, 1, false, glm::value_ptr(projectionView));
             glUniformMatrix4fv(_modelUniformId, 1, false, glm::value_ptr(model));
         }
 
@@ -233,24 +187,47 @@ namespace ColorPosition
                 GLuint(colorAttrib));
         }
 
+        void setupPackedAttributes() const
+        {
+            auto vertexSize = sizeof(PackedVertexType);
+
+            auto vertexAttrib = glGetAttribLocation(_shaderId, _vertexAttributeName.c_str());
+
+            glVertexAttribPointer(
+                GLuint(vertexAttrib),
+                sizeof(PackedVertexType::pos) / sizeof(float),
+                GL_FLOAT,
+                GL_FALSE,
+                static_cast<GLsizei>(vertexSize),
+                0);
+
+            glEnableVertexAttribArray(
+                GLuint(vertexAttrib));
+
+            auto colorAttrib = glGetAttribLocation(_shaderId, _colorAttributeName.c_str());
+
+            glVertexAttribPointer(
+                GLuint(colorAttrib),
+                sizeof(PackedVertexType::col),
+                GL_UNSIGNED_BYTE,
+                GL_TRUE,
+                static_cast<GLsizei>(vertexSize),
+                reinterpret_cast<const GLvoid *>(sizeof(PackedVertexType::pos)));
+
+            glEnableVertexAttribArray(
+                GLuint(colorAttrib));
+        }
+
     private:
         GLuint _shaderId;
-        GLuint _projectionUniformId;
-        GLuint _viewUniformId;
         GLuint _modelUniformId;
 
-        std::string _projectionUniformName;
-        std::string _viewUniformName;
         std::string _modelUniformName;
 
         std::string _vertexAttributeName;
         std::string _colorAttributeName;
-
-        static GLuint defaultShader;
     };
 
-    GLuint ShaderType::defaultShader = 0;
-
     class BufferType
     {
     public:
@@ -289,7 +266,7 @@ namespace ColorPosition
             int start,
             int count)
         {
-            _faces.insert(std::make_pair(start, count));
+            _faces.add(GLint(start), GLsizei(count));
         }
 
         size_t vertexCount() const
@@ -423,20 +400,21 @@ namespace ColorPosition
         {
             _drawMode = mode;
             _vertexCount = _verts.size();
+            _faces.merge(_drawMode);
 
             glGenVertexArrays(1, &_vertexArrayId);
             glGenBuffers(1, &_vertexBufferId);
 
-            glBindVertexArray(_vertexArrayId);
-            glBindBuffer(GL_ARRAY_BUFFER, _vertexBufferId);
+            GlState::current().bindVertexArray(_vertexArrayId);
+            GlState::current().bindArrayBuffer(_vertexBufferId);
 
             glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(_verts.size() * sizeof(VertexType)), 0, GL_STATIC_DRAW);
             glBufferSubData(GL_ARRAY_BUFFER, 0, GLsizeiptr(_verts.size() * sizeof(VertexType)), reinterpret_cast<const GLvoid *>(&_verts[0]));
 
             _shader.setupAttributes();
 
-            glBindVertexArray(0);
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            GlState::current().bindVertexArray(0);
+            GlState::current().bindArrayBuffer(0);
 
             _verts.clear();
 
@@ -445,32 +423,27 @@ namespace ColorPosition
 
         void render()
         {
-            glBindVertexArray(_vertexArrayId);
+            GlState::current().bindVertexArray(_vertexArrayId);
             if (_faces.empty())
             {
                 glDrawArrays(_drawMode, 0, static_cast<GLsizei>(_vertexCount));
             }
             else
             {
-                for (auto pair : _faces)
-                {
-                    glDrawArrays(_drawMode, pair.first, pair.second);
-                }
+                _faces.drawArrays(_drawMode);
             }
-            glBindVertexArray(0);
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
         }
 
         void cleanup()
         {
             if (_vertexBufferId != 0)
             {
-                glDeleteBuffers(1, &_vertexBufferId);
+                GlState::current().deleteBuffer(_vertexBufferId);
                 _vertexBufferId = 0;
             }
             if (_vertexArrayId != 0)
             {
-                glDeleteVertexArrays(1, &_vertexArrayId);
+                GlState::current().deleteVertexArray(_vertexArrayId);
                 _vertexArrayId = 0;
             }
         }
@@ -483,7 +456,145 @@ namespace ColorPosition
         uint32_t _vertexArrayId;
         uint32_t _vertexBufferId;
         GLenum _drawMode;
-        std::map<int, int> _faces;
+        DrawRanges _faces;
+    };
+
+    // Buffer for geometry that is rebuilt every frame. The GL objects are created once
+    // and the storage only grows, each upload orphans the previous storage so the
+    // driver does not have to wait until the last frame is done drawing from it.
+    class StreamingBufferType
+    {
+    public:
+        StreamingBufferType(
+            ShaderType const &shader)
+            : _shader(shader),
+              _vertexArrayId(0),
+              _vertexBufferId(0),
+              _capacity(0),
+              _uploadedCount(0),
+              _drawMode(GL_LINES)
+        {}
+
+        virtual ~StreamingBufferType() {}
+
+        void setDrawMode(
+            GLenum mode)
+        {
+            _drawMode = mode;
+        }
+
+        size_t vertexCount() const
+        {
+            return _verts.size();
+        }
+
+        size_t capacity() const
+        {
+            return _capacity;
+        }
+
+        void clear()
+        {
+            // Keeps the allocated memory around for the next frame
+            _verts.clear();
+        }
+
+        StreamingBufferType &vertex(
+            glm::vec3 const &position,
+            uint32_t color)
+        {
+            _verts.push_back(PackedVertexType({position, color}));
+
+            return *this;
+        }
+
+        StreamingBufferType &line(
+            glm::vec3 const &from,
+            glm::vec3 const &to,
+            uint32_t color)
+        {
+            _verts.push_back(PackedVertexType({from, color}));
+            _verts.push_back(PackedVertexType({to, color}));
+
+            return *this;
+        }
+
+        bool setup()
+        {
+            if (_vertexArrayId != 0)
+            {
+                return true;
+            }
+
+            glGenVertexArrays(1, &_vertexArrayId);
+            glGenBuffers(1, &_vertexBufferId);
+
+            GlState::current().bindVertexArray(_vertexArrayId);
+            GlState::current().bindArrayBuffer(_vertexBufferId);
+
+            _shader.setupPackedAttributes();
+
+            GlState::current().bindVertexArray(0);
+            GlState::current().bindArrayBuffer(0);
+
+            return true;
+        }
+
+        void upload()
+        {
+            _uploadedCount = _verts.size();
+
+            if (_verts.empty())
+            {
+                return;
+            }
+
+            GlState::current().bindArrayBuffer(_vertexBufferId);
+
+            if (_verts.size() > _capacity)
+            {
+                _capacity = _verts.size() > _capacity * 2 ? _verts.size() : _capacity * 2;
+            }
+
+            glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(_capacity * sizeof(PackedVertexType)), nullptr, GL_STREAM_DRAW);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, GLsizeiptr(_verts.size() * sizeof(PackedVertexType)), reinterpret_cast<const GLvoid *>(&_verts[0]));
+        }
+
+        void render()
+        {
+            if (_uploadedCount == 0)
+            {
+                return;
+            }
+
+            GlState::current().bindVertexArray(_vertexArrayId);
+            glDrawArrays(_drawMode, 0, static_cast<GLsizei>(_uploadedCount));
+        }
+
+        void cleanup()
+        {
+            if (_vertexBufferId != 0)
+            {
+                GlState::current().deleteBuffer(_vertexBufferId);
+                _vertexBufferId = 0;
+            }
+            if (_vertexArrayId != 0)
+            {
+                GlState::current().deleteVertexArray(_vertexArrayId);
+                _vertexArrayId = 0;
+            }
+            _capacity = 0;
+            _uploadedCount = 0;
+        }
+
+    private:
+        const ShaderType &_shader;
+        std::vector<PackedVertexType> _verts;
+        uint32_t _vertexArrayId;
+        uint32_t _vertexBufferId;
+        size_t _capacity;
+        size_t _uploadedCount;
+        GLenum _drawMode;
     };
 
 } // namespace ColorPosition
@@ -0,0 +1,170 @@
+#ifndef GLDRAWRANGES_H
+#define GLDRAWRANGES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <glad/glad.h>
+#include <vector>
+
+// The faces of a buffer as ranges of vertices, or of indices for indexed buffers. All ranges
+// are submitted with one multi-draw call. Instanced draws have no multi-draw of their own, they
+// go through an indirect buffer that is written again when the instance count changes.
+class DrawRanges
+{
+public:
+    DrawRanges()
+        : _indirectBufferId(0),
+          _indirectInstanceCount(0),
+          _indirectIndexed(false),
+          _indirectDirty(true)
+    {}
+
+    virtual ~DrawRanges() {}
+
+    bool empty() const
+    {
+        return _firsts.empty();
+    }
+
+    size_t size() const
+    {
+        return _firsts.size();
+    }
+
+    void add(
+        GLint first,
+        GLsizei count)
+    {
+        _firsts.push_back(first);
+        _counts.push_back(count);
+        _offsets.push_back(reinterpret_cast<const GLvoid *>(size_t(first) * sizeof(uint32_t)));
+        _indirectDirty = true;
+    }
+
+    // Joins ranges that follow each other without a gap. Strips, loops and fans would be
+    // connected to the previous range, so only lists can be merged.
+    void merge(
+        GLenum mode)
+    {
+        if (mode != GL_TRIANGLES && mode != GL_LINES && mode != GL_POINTS)
+        {
+            return;
+        }
+
+        size_t last = 0;
+        for (size_t i = 1; i < _firsts.size(); i++)
+        {
+            if (_firsts[i] == _firsts[last] + _counts[last])
+            {
+                _counts[last] += _counts[i];
+                continue;
+            }
+
+            last++;
+            _firsts[last] = _firsts[i];
+            _counts[last] = _counts[i];
+            _offsets[last] = _offsets[i];
+        }
+
+        if (!_firsts.empty())
+        {
+            _firsts.resize(last + 1);
+            _counts.resize(last + 1);
+            _offsets.resize(last + 1);
+        }
+        _indirectDirty = true;
+    }
+
+    void drawArrays(
+        GLenum mode) const
+    {
+        glMultiDrawArrays(mode, _firsts.data(), _counts.data(), static_cast<GLsizei>(_firsts.size()));
+    }
+
+    // Draws from the element buffer of the bound vertex array, with 32 bit indices
+    void drawElements(
+        GLenum mode) const
+    {
+        glMultiDrawElements(mode, _counts.data(), GL_UNSIGNED_INT, _offsets.data(), static_cast<GLsizei>(_firsts.size()));
+    }
+
+    void drawArraysInstanced(
+        GLenum mode,
+        GLsizei instanceCount)
+    {
+        updateIndirect(instanceCount, false);
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _indirectBufferId);
+        glMultiDrawArraysIndirect(mode, nullptr, static_cast<GLsizei>(_firsts.size()), 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    void drawElementsInstanced(
+        GLenum mode,
+        GLsizei instanceCount)
+    {
+        updateIndirect(instanceCount, true);
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _indirectBufferId);
+        glMultiDrawElementsIndirect(mode, GL_UNSIGNED_INT, nullptr, static_cast<GLsizei>(_firsts.size()), 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    void cleanup()
+    {
+        if (_indirectBufferId != 0)
+        {
+            glDeleteBuffers(1, &_indirectBufferId);
+            _indirectBufferId = 0;
+        }
+        _indirectDirty = true;
+    }
+
+private:
+    std::vector<GLint> _firsts;
+    std::vector<GLsizei> _counts;
+    std::vector<const GLvoid *> _offsets;
+    uint32_t _indirectBufferId;
+    GLsizei _indirectInstanceCount;
+    bool _indirectIndexed;
+    bool _indirectDirty;
+
+    void updateIndirect(
+        GLsizei instanceCount,
+        bool indexed)
+    {
+        if (!_indirectDirty && instanceCount == _indirectInstanceCount && indexed == _indirectIndexed)
+        {
+            return;
+        }
+
+        // The layouts of DrawArraysIndirectCommand and DrawElementsIndirectCommand
+        std::vector<GLuint> commands;
+        for (size_t i = 0; i < _firsts.size(); i++)
+        {
+            commands.push_back(GLuint(_counts[i]));
+            commands.push_back(GLuint(instanceCount));
+            commands.push_back(GLuint(_firsts[i]));
+            if (indexed)
+            {
+                commands.push_back(0); // base vertex
+            }
+            commands.push_back(0); // base instance
+        }
+
+        if (_indirectBufferId == 0)
+        {
+            glGenBuffers(1, &_indirectBufferId);
+        }
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _indirectBufferId);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, GLsizeiptr(commands.size() * sizeof(GLuint)), commands.data(), GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+        _indirectInstanceCount = instanceCount;
+        _indirectIndexed = indexed;
+        _indirectDirty = false;
+    }
+};
+
+#endif // GLDRAWRANGES_H
@@ -1,14 +1,18 @@
 #ifndef GLMASKEDTEXTURES_H
 #define GLMASKEDTEXTURES_H
 
+#include "gl-camera-uniforms.h"
+#include "gl-draw-ranges.h"
+#include "gl-program-cache.h"
+#include "gl-state.h"
 #include <cmath>
 #include <fstream>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <iostream>
-#include <map>
 #include <sstream>
 #include <vector>
 
@@ -23,24 +27,48 @@ namespace MaskedTexturesBuffer
         glm::vec4 uvs;
     };
 
+    // The shader only reads the first two texture coordinates, the color goes in RGBA8
+    class PackedVertexType
+    {
+    public:
+        glm::vec3 pos;
+        uint32_t col;
+        glm::vec2 uvs;
+    };
+
+    // Same, with the texture coordinates as half floats
+    class HalfUvsVertexType
+    {
+    public:
+        glm::vec3 pos;
+        uint32_t col;
+        uint32_t uvs;
+    };
+
+    // Half floats hold about three decimals, coordinates that move further than this when
+    // rounded to them would make the textures swim, a quarter texel of a 1024 texture
+    const float HALF_UVS_TOLERANCE = 1.0f / 4096.0f;
+
     class ShaderType
     {
         GLuint _shaderId;
-        GLuint _projectionUniformId;
-        GLuint _viewUniformId;
         GLuint _modelUniformId;
         GLuint _textureUniform1Id;
         GLuint _textureUniform2Id;
         GLuint _textureUniform3Id;
         GLuint _textureUniformMaskId;
+        GLuint _textureUniformPageTableId;
+        GLuint _textureUniformSnowDepthId;
+        GLuint _maskSizeUniformId;
 
-        std::string _projectionUniformName;
-        std::string _viewUniformName;
         std::string _modelUniformName;
         std::string _textureUniform1Name;
         std::string _textureUniform2Name;
         std::string _textureUniform3Name;
         std::string _textureUniformMaskName;
+        std::string _textureUniformPageTableName;
+        std::string _textureUniformSnowDepthName;
+        std::string _maskSizeUniformName;
 
         std::string _vertexAttributeName;
         std::string _colorAttributeName;
@@ -49,16 +77,15 @@ namespace MaskedTexturesBuffer
     public:
         ShaderType()
             : _shaderId(0),
-              _projectionUniformId(0),
-              _viewUniformId(0),
               _modelUniformId(0),
-              _projectionUniformName("u_projection"),
-              _viewUniformName("u_view"),
               _modelUniformName("u_model"),
               _textureUniform1Name("u_texture1"),
               _textureUniform2Name("u_texture2"),
               _textureUniform3Name("u_texture3"),
               _textureUniformMaskName("u_mask"),
+              _textureUniformPageTableName("u_pageTable"),
+              _textureUniformSnowDepthName("u_snowDepth"),
+              _maskSizeUniformName("u_maskSize"),
               _vertexAttributeName("vertex"),
               _colorAttributeName("color"),
               _uvsAttributeName("uvs")
@@ -73,7 +100,7 @@ namespace MaskedTexturesBuffer
 
         void use() const
         {
-            glUseProgram(_shaderId);
+            GlState::current().useProgram(_shaderId);
         }
 
         virtual bool compileFromFile(
@@ -91,159 +118,157 @@ namespace MaskedTexturesBuffer
             return compile(vertShaderStr, fragShaderStr);
         }
 
-        bool compileDefaultShader()
+        static std::string defaultVertexShader()
         {
-            static GLuint defaultShader = 0;
+            return std::string(
+                "#version 150\n"
 
-            if (defaultShader == 0)
-            {
-                std::string const vshader(
-                    "#version 150\n"
-
-                    "in vec3 vertex;\n"
-                    "in vec4 color;\n"
-                    "in vec4 uvs;\n"
-
-                    "uniform mat4 u_projection;\n"
-                    "uniform mat4 u_view;\n"
-                    "uniform mat4 u_model;\n"
-
-                    "out vec4 f_color;\n"
-                    "out vec4 f_uvs;\n"
-
-                    "void main()\n"
-                    "{\n"
-                    "    gl_Position = u_projection * u_view * u_model * vec4(vertex.xyz, 1.0);\n"
-                    "    f_color = color;\n"
-                    "    f_uvs = vec4(uvs.st, vertex.x > 0 ? 1.0f : 0.0f, vertex.y > 0 ? 1.0f : 0.0f);\n"
-                    "}\n");
-
-                std::string const fshader(
-                    "#version 150\n"
-
-                    "uniform sampler2D u_texture1;\n"
-                    "uniform sampler2D u_texture2;\n"
-                    "uniform sampler2D u_texture3;\n"
-                    "uniform sampler2D u_mask;\n"
-
-                    "in vec4 f_color;\n"
-                    "in vec4 f_uvs;\n"
-                    "out vec4 color;\n"
-
-                    "void main()\n"
-                    "{\n"
-                    "   vec4 mask = texture(u_mask, f_uvs.zw);\n"
-                    "   vec4 color1 = (texture(u_texture2, f_uvs.st) * mask.x)\n"
-                    "               + (texture(u_texture1, f_uvs.st) * (1.0 - mask.x));\n"
-                    "   vec4 color2 = (color1 * mask.y)\n"
-                    "               + (texture(u_texture3, f_uvs.st) * (1.0 - mask.y));\n"
-                    "   color = color2;\n"
-                    "}\n");
-
-                if (compile(vshader, fshader))
-                {
-                    defaultShader = _shaderId;
+                "in vec3 vertex;\n"
+                "in vec4 color;\n"
+                "in vec4 uvs;\n"
 
-                    return true;
-                }
+                CAMERA_UNIFORM_BLOCK "\n"
+                "uniform mat4 u_model;\n"
 
-                return false;
-            }
+                "out vec4 f_color;\n"
+                "out vec4 f_uvs;\n"
 
-            return true;
+                "void main()\n"
+                "{\n"
+                "    gl_Position = u_projection * u_view * u_model * vec4(vertex.xyz, 1.0);\n"
+                "    f_color = color;\n"
+                "    f_uvs = vec4(uvs.st, vertex.x > 0 ? 1.0f : 0.0f, vertex.y > 0 ? 1.0f : 0.0f);\n"
+                "}\n");
         }
 
-        virtual bool compile(
-            std::string const &vertShaderStr,
-            std::string const &fragShaderStr)
+        static std::string defaultFragmentShader()
         {
-            GLuint vertShader = glCreateShader(GL_VERTEX_SHADER);
-            GLuint fragShader = glCreateShader(GL_FRAGMENT_SHADER);
-            const char *vertShaderSrc = vertShaderStr.c_str();
-            const char *fragShaderSrc = fragShaderStr.c_str();
-
-            GLint result = GL_FALSE;
-            GLint logLength;
-
-            // Compile vertex shader
-            glShaderSource(vertShader, 1, &vertShaderSrc, NULL);
-            glCompileShader(vertShader);
-
-            // Check vertex shader
-            glGetShaderiv(vertShader, GL_COMPILE_STATUS, &result);
-            if (result == GL_FALSE)
-            {
-                glGetShaderiv(vertShader, GL_INFO_LOG_LENGTH, &logLength);
-                std::vector<GLchar> vertShaderError(static_cast<size_t>((logLength > 1) ? logLength : 1));
-                glGetShaderInfoLog(vertShader, logLength, NULL, &vertShaderError[0]);
-                std::cout << &vertShaderError[0] << std::endl;
-
-                return false;
-            }
-
-            // Compile fragment shader
-            glShaderSource(fragShader, 1, &fragShaderSrc, NULL);
-            glCompileShader(fragShader);
-
-            // Check fragment shader
-            glGetShaderiv(fragShader, GL_COMPILE_STATUS, &result);
-            if (result == GL_FALSE)
-            {
-                glGetShaderiv(fragShader, GL_INFO_LOG_LENGTH, &logLength);
-                std::vector<GLchar> fragShaderError(static_cast<size_t>((logLength > 1) ? logLength : 1));
-                glGetShaderInfoLog(fragShader, logLength, NULL, &fragShaderError[0]);
-                std::cout << &fragShaderError[0] << std::endl;
+            return std::string(
+                "#version 150\n"
+
+                "uniform sampler2D u_texture1;\n"
+                "uniform sampler2D u_texture2;\n"
+                "uniform sampler2D u_texture3;\n"
+                "uniform sampler2D u_mask;\n"
+                "uniform usampler2D u_pageTable;\n"
+                "uniform sampler2D u_snowDepth;\n"
+                "uniform vec2 u_maskSize;\n"
+
+                "in vec4 f_color;\n"
+                "in vec4 f_uvs;\n"
+                "out vec4 color;\n"
+
+                "const int TileSize = 64;\n"
+
+                "const uint PageUniform = 0xffffu;\n"
+
+                // The page table holds either the value of a uniform tile (red PageUniform) or where its pixels are in the atlas.
+                // A mask byte packs the road level in the top 3 bits and how far the snow is cleared in the bottom 5.
+                "vec2 maskTexel(ivec2 texel)\n"
+                "{\n"
+                "   texel = clamp(texel, ivec2(0), ivec2(u_maskSize) - 1);\n"
+                "   uvec4 page = texelFetch(u_pageTable, texel / TileSize, 0);\n"
+                "   int value = int(page.g);\n"
+                "   if (page.r != PageUniform)\n"
+                "   {\n"
+                "       ivec2 slot = ivec2(page.rg);\n"
+                "       value = int(texelFetch(u_mask, (slot * TileSize) + (texel % TileSize), 0).r * 255.0 + 0.5);\n"
+                "   }\n"
+                "   return vec2(float(value >> 5) / 7.0, float(value & 31) / 31.0);\n"
+                "}\n"
+
+                // Bilinear filtering by hand, neighbouring texels can live in different atlas slots
+                "vec2 maskSample(vec2 uv)\n"
+                "{\n"
+                "   vec2 p = (uv * u_maskSize) - 0.5;\n"
+                "   ivec2 i = ivec2(floor(p));\n"
+                "   vec2 f = p - floor(p);\n"
+                "   vec2 bottom = mix(maskTexel(i), maskTexel(i + ivec2(1, 0)), f.x);\n"
+                "   vec2 top = mix(maskTexel(i + ivec2(0, 1)), maskTexel(i + ivec2(1, 1)), f.x);\n"
+                "   return mix(bottom, top, f.y);\n"
+                "}\n"
+
+                // Snow depth the same way from blue and alpha, normalized like the 16 bit atlas
+                "float depthTexel(ivec2 texel)\n"
+                "{\n"
+                "   texel = clamp(texel, ivec2(0), ivec2(u_maskSize) - 1);\n"
+                "   uvec4 page = texelFetch(u_pageTable, texel / TileSize, 0);\n"
+                "   if (page.b == PageUniform)\n"
+                "   {\n"
+                "       return float(page.a) / 65535.0;\n"
+                "   }\n"
+                "   return texelFetch(u_snowDepth, (ivec2(page.ba) * TileSize) + (texel % TileSize), 0).r;\n"
+                "}\n"
+
+                "float depthSample(vec2 uv)\n"
+                "{\n"
+                "   vec2 p = (uv * u_maskSize) - 0.5;\n"
+                "   ivec2 i = ivec2(floor(p));\n"
+                "   vec2 f = p - floor(p);\n"
+                "   float bottom = mix(depthTexel(i), depthTexel(i + ivec2(1, 0)), f.x);\n"
+                "   float top = mix(depthTexel(i + ivec2(0, 1)), depthTexel(i + ivec2(1, 1)), f.x);\n"
+                "   return mix(bottom, top, f.y);\n"
+                "}\n"
+
+                "void main()\n"
+                "{\n"
+                "   vec2 mask = maskSample(f_uvs.zw);\n"
+
+                // Berms and the walls of the plowed track are shaded from the slope of the snow depth
+                "   vec2 texel = 1.0 / u_maskSize;\n"
+                "   float dx = depthSample(f_uvs.zw + vec2(texel.x, 0.0)) - depthSample(f_uvs.zw - vec2(texel.x, 0.0));\n"
+                "   float dy = depthSample(f_uvs.zw + vec2(0.0, texel.y)) - depthSample(f_uvs.zw - vec2(0.0, texel.y));\n"
+                "   float light = clamp(1.0 - ((dx + dy) * 150.0), 0.6, 1.25);\n"
+
+                "   vec4 color1 = (texture(u_texture2, f_uvs.st) * mask.x)\n"
+                "               + (texture(u_texture1, f_uvs.st) * (1.0 - mask.x));\n"
+                "   vec4 color2 = (color1 * mask.y)\n"
+                "               + (texture(u_texture3, f_uvs.st) * light * (1.0 - mask.y));\n"
+                "   color = color2;\n"
+                "}\n");
+        }
 
-                return false;
-            }
+        // Starts building the default program ahead of compileDefaultShader()
+        static void requestDefaultShader()
+        {
+            ProgramCache::current().request(defaultVertexShader(), defaultFragmentShader());
+        }
 
-            _shaderId = glCreateProgram();
-            glAttachShader(_shaderId, vertShader);
-            glAttachShader(_shaderId, fragShader);
-            glLinkProgram(_shaderId);
+        bool compileDefaultShader()
+        {
+            return compile(defaultVertexShader(), defaultFragmentShader());
+        }
 
-            glGetProgramiv(_shaderId, GL_LINK_STATUS, &result);
-            if (result == GL_FALSE)
+        // Instances with the same sources share one program from the cache
+        virtual bool compile(
+            std::string const &vertShaderStr,
+            std::string const &fragShaderStr)
+        {
+            _shaderId = ProgramCache::current().program(vertShaderStr, fragShaderStr);
+            if (_shaderId == 0)
             {
-                glGetProgramiv(_shaderId, GL_INFO_LOG_LENGTH, &logLength);
-                std::vector<GLchar> programError(static_cast<size_t>((logLength > 1) ? logLength : 1));
-                glGetProgramInfoLog(_shaderId, logLength, NULL, &programError[0]);
-                std::cout << &programError[0] << std::endl;
-
                 return false;
             }
 
-            glDeleteShader(vertShader);
-            glDeleteShader(fragShader);
+            CameraUniformBuffer::bindProgram(_shaderId);
 
-            _projectionUniformId = glGetUniformLocation(_shaderId, _projectionUniformName.c_str());
-            _viewUniformId = glGetUniformLocation(_shaderId, _viewUniformName.c_str());
             _modelUniformId = glGetUniformLocation(_shaderId, _modelUniformName.c_str());
 
             _textureUniform1Id = glGetUniformLocation(_shaderId, _textureUniform1Name.c_str());
             _textureUniform2Id = glGetUniformLocation(_shaderId, _textureUniform2Name.c_str());
             _textureUniform3Id = glGetUniformLocation(_shaderId, _textureUniform3Name.c_str());
             _textureUniformMaskId = glGetUniformLocation(_shaderId, _textureUniformMaskName.c_str());
+            _textureUniformPageTableId = glGetUniformLocation(_shaderId, _textureUniformPageTableName.c_str());
+            _textureUniformSnowDepthId = glGetUniformLocation(_shaderId, _textureUniformSnowDepthName.c_str());
+            _maskSizeUniformId = glGetUniformLocation(_shaderId, _maskSizeUniformName.c_str());
 
             return true;
         }
 
-        void setupMatrices(glm::mat4 const &projection, glm::mat4 const &view, glm::mat4 const &model)
-        {
-            use();
-
-            glUniformMatrix4fv(_projectionUniformId, 1, false, glm::value_ptr(projection));
-            glUniformMatrix4fv(_viewUniformId, 1, false, glm::value_ptr(view));
-            glUniformMatrix4fv(_modelUniformId, 1, false, glm::value_ptr(model));
-        }
-
-        void setupMatrices(
-            glm::mat4 const &projectionView,
+        // Projection and view come from the camera buffer, this only uploads the model of the next draw
+        void setupModel(
             glm::mat4 const &model)
         {
-            use();
-
-            glUniformMatrix4fv(_projectionUniformId, 1, false, glm::value_ptr(projectionView));
             glUniformMatrix4fv(_modelUniformId, 1, false, glm::value_ptr(model));
         }
 
@@ -251,23 +276,32 @@ namespace MaskedTexturesBuffer
             uint32_t texture1,
             uint32_t texture2,
             uint32_t texture3,
-            uint32_t mask) const
+            uint32_t mask,
+            uint32_t pageTable,
+            uint32_t snowDepth,
+            glm::vec2 const &maskSize) const
         {
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, texture1);
+            GlState::current().bindTexture(GL_TEXTURE0, texture1);
             glUniform1i(_textureUniform1Id, 0);
 
-            glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, texture2);
+            GlState::current().bindTexture(GL_TEXTURE1, texture2);
             glUniform1i(_textureUniform2Id, 1);
 
-            glActiveTexture(GL_TEXTURE2);
-            glBindTexture(GL_TEXTURE_2D, texture3);
+            GlState::current().bindTexture(GL_TEXTURE2, texture3);
             glUniform1i(_textureUniform3Id, 2);
 
-            glActiveTexture(GL_TEXTURE3);
-            glBindTexture(GL_TEXTURE_2D, mask);
+            GlState::current().bindTexture(GL_TEXTURE3, mask);
             glUniform1i(_textureUniformMaskId, 3);
+
+            GlState::current().bindTexture(GL_TEXTURE4, pageTable);
+            glUniform1i(_textureUniformPageTableId, 4);
+
+            GlState::current().bindTexture(GL_TEXTURE5, snowDepth);
+            glUniform1i(_textureUniformSnowDepthId, 5);
+
+            glUniform2f(_maskSizeUniformId, maskSize.x, maskSize.y);
+
+            GlState::current().activeTexture(GL_TEXTURE0);
         }
 
         void setupAttributes() const
@@ -310,6 +344,49 @@ namespace MaskedTexturesBuffer
 
             glEnableVertexAttribArray(GLuint(uvsAttrib));
         }
+
+        // For buffers with PackedVertexType, or HalfUvsVertexType when halfUvs is set
+        void setupPackedAttributes(
+            bool halfUvs) const
+        {
+            auto vertexSize = halfUvs ? sizeof(HalfUvsVertexType) : sizeof(PackedVertexType);
+
+            auto vertexAttrib = glGetAttribLocation(_shaderId, _vertexAttributeName.c_str());
+
+            glVertexAttribPointer(
+                GLuint(vertexAttrib),
+                sizeof(PackedVertexType::pos) / sizeof(float),
+                GL_FLOAT,
+                GL_FALSE,
+                static_cast<GLsizei>(vertexSize),
+                0);
+
+            glEnableVertexAttribArray(GLuint(vertexAttrib));
+
+            auto colorAttrib = glGetAttribLocation(_shaderId, _colorAttributeName.c_str());
+
+            glVertexAttribPointer(
+                GLuint(colorAttrib),
+                sizeof(PackedVertexType::col),
+                GL_UNSIGNED_BYTE,
+                GL_TRUE,
+                static_cast<GLsizei>(vertexSize),
+                reinterpret_cast<const GLvoid *>(sizeof(PackedVertexType::pos)));
+
+            glEnableVertexAttribArray(GLuint(colorAttrib));
+
+            auto uvsAttrib = glGetAttribLocation(_shaderId, _uvsAttributeName.c_str());
+
+            glVertexAttribPointer(
+                GLuint(uvsAttrib),
+                2,
+                halfUvs ? GL_HALF_FLOAT : GL_FLOAT,
+                GL_FALSE,
+                static_cast<GLsizei>(vertexSize),
+                reinterpret_cast<const GLvoid *>(sizeof(PackedVertexType::pos) + sizeof(PackedVertexType::col)));
+
+            glEnableVertexAttribArray(GLuint(uvsAttrib));
+        }
     };
 
     class BufferType
@@ -321,7 +398,8 @@ namespace MaskedTexturesBuffer
               _vertexCount(0),
               _vertexArrayId(0),
               _vertexBufferId(0),
-              _drawMode(GL_TRIANGLES)
+              _drawMode(GL_TRIANGLES),
+              _packVertices(false)
         {}
 
         virtual ~BufferType() {}
@@ -350,7 +428,7 @@ namespace MaskedTexturesBuffer
             int start,
             int count)
         {
-            _faces.insert(std::make_pair(start, count));
+            _faces.add(GLint(start), GLsizei(count));
         }
 
         size_t vertexCount() const
@@ -443,6 +521,16 @@ namespace MaskedTexturesBuffer
             return (*this);
         }
 
+        // The vertex buffer gets a packed vertex instead of VertexType, set before setup(). The
+        // texture coordinates are half floats when that does not move them, floats otherwise.
+        BufferType &packVertices(
+            bool packed = true)
+        {
+            _packVertices = packed;
+
+            return *this;
+        }
+
         bool setup()
         {
             return setup(_drawMode);
@@ -453,54 +541,96 @@ namespace MaskedTexturesBuffer
         {
             _drawMode = mode;
             _vertexCount = _verts.size();
+            _faces.merge(_drawMode);
 
             glGenVertexArrays(1, &_vertexArrayId);
             glGenBuffers(1, &_vertexBufferId);
 
-            glBindVertexArray(_vertexArrayId);
-            glBindBuffer(GL_ARRAY_BUFFER, _vertexBufferId);
+            GlState::current().bindVertexArray(_vertexArrayId);
+            GlState::current().bindArrayBuffer(_vertexBufferId);
+
+            auto halfUvs = _packVertices;
+            for (auto &v : _verts)
+            {
+                auto uvs = glm::vec2(v.uvs);
+                auto rounded = glm::unpackHalf2x16(glm::packHalf2x16(uvs));
+                if (std::fabs(rounded.x - uvs.x) > HALF_UVS_TOLERANCE || std::fabs(rounded.y - uvs.y) > HALF_UVS_TOLERANCE)
+                {
+                    halfUvs = false;
+                    break;
+                }
+            }
+
+            if (halfUvs)
+            {
+                std::vector<HalfUvsVertexType> packed;
+                packed.reserve(_verts.size());
+                for (auto &v : _verts)
+                {
+                    packed.push_back(HalfUvsVertexType({v.pos, glm::packUnorm4x8(v.col), glm::packHalf2x16(glm::vec2(v.uvs))}));
+                }
+
+                glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(packed.size() * sizeof(HalfUvsVertexType)), reinterpret_cast<const GLvoid *>(packed.data()), GL_STATIC_DRAW);
+
+                _shader.setupPackedAttributes(true);
+            }
+            else if (_packVertices)
+            {
+                std::vector<PackedVertexType> packed;
+                packed.reserve(_verts.size());
+                for (auto &v : _verts)
+                {
+                    packed.push_back(PackedVertexType({v.pos, glm::packUnorm4x8(v.col), glm::vec2(v.uvs)}));
+                }
 
-            glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(_verts.size() * sizeof(VertexType)), 0, GL_STATIC_DRAW);
-            glBufferSubData(GL_ARRAY_BUFFER, 0, GLsizeiptr(_verts.size() * sizeof(VertexType)), reinterpret_cast<const GLvoid *>(&_verts[0]));
+                glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(packed.size() * sizeof(PackedVertexType)), reinterpret_cast<const GLvoid *>(packed.data()), GL_STATIC_DRAW);
+
+                _shader.setupPackedAttributes(false);
+            }
+            else
+            {
+                glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(_verts.size() * sizeof(VertexType)), 0, GL_STATIC_DRAW);
+                glBufferSubData(GL_ARRAY_BUFFER, 0, GLsizeiptr(_verts.size() * sizeof(VertexType)), reinterpret_cast<const GLvoid *>(&_verts[0]));
 
-            _shader.setupAttributes();
+                _shader.setupAttributes();
+            }
 
-            glBindVertexArray(0);
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            GlState::current().bindVertexArray(0);
+            GlState::current().bindArrayBuffer(0);
 
             _verts.clear();
 
             return true;
         }
 
+        uint32_t vertexArrayId() const
+        {
+            return _vertexArrayId;
+        }
+
         void render()
         {
-            glBindVertexArray(_vertexArrayId);
+            GlState::current().bindVertexArray(_vertexArrayId);
             if (_faces.empty())
             {
                 glDrawArrays(_drawMode, 0, static_cast<GLsizei>(_vertexCount));
             }
             else
             {
-                for (auto pair : _faces)
-                {
-                    glDrawArrays(_drawMode, pair.first, pair.second);
-                }
+                _faces.drawArrays(_drawMode);
             }
-            glBindVertexArray(0);
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
         }
 
         void cleanup()
         {
             if (_vertexBufferId != 0)
             {
-                glDeleteBuffers(1, &_vertexBufferId);
+                GlState::current().deleteBuffer(_vertexBufferId);
                 _vertexBufferId = 0;
             }
             if (_vertexArrayId != 0)
             {
-                glDeleteVertexArrays(1, &_vertexArrayId);
+                GlState::current().deleteVertexArray(_vertexArrayId);
                 _vertexArrayId = 0;
             }
         }
@@ -513,7 +643,8 @@ namespace MaskedTexturesBuffer
         uint32_t _vertexArrayId;
         uint32_t _vertexBufferId;
         GLenum _drawMode;
-        std::map<int, int> _faces;
+        DrawRanges _faces;
+        bool _packVertices;
     };
 
 } // namespace MaskedTexturesBuffer
@@ -0,0 +1,312 @@
+#ifndef GLPARTICLES_H
+#define GLPARTICLES_H
+
+#include "gl-camera-uniforms.h"
+#include "gl-program-cache.h"
+#include "gl-state.h"
+#include <fstream>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+namespace Particles
+{
+
+    // Draws every particle as a camera facing quad. The quad corners come from
+    // gl_VertexID, the only per instance data is the position, one float attribute
+    // per axis so the arrays of the simulation can be uploaded as they are.
+    class ShaderType
+    {
+    public:
+        ShaderType()
+            : _shaderId(0),
+              _sizeUniformId(0),
+              _colorUniformId(0),
+              _sizeUniformName("u_size"),
+              _colorUniformName("u_color"),
+              _xAttributeName("x"),
+              _yAttributeName("y"),
+              _zAttributeName("z")
+        {}
+
+        virtual ~ShaderType() {}
+
+        GLuint id() const
+        {
+            return _shaderId;
+        }
+
+        void use() const
+        {
+            GlState::current().useProgram(_shaderId);
+        }
+
+        static std::string defaultVertexShader()
+        {
+            return std::string(
+                "#version 150\n"
+
+                "in float x;"
+                "in float y;"
+                "in float z;"
+
+                CAMERA_UNIFORM_BLOCK
+                "uniform float u_size;"
+
+                "out vec2 f_corner;"
+
+                "void main()"
+                "{"
+                "    f_corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1)) * 2.0 - 1.0;"
+                "    vec4 center = u_view * vec4(x, y, z, 1.0);"
+                "    gl_Position = u_projection * (center + vec4(f_corner * u_size, 0.0, 0.0));"
+                "}");
+        }
+
+        static std::string defaultFragmentShader()
+        {
+            return std::string(
+                "#version 150\n"
+
+                "in vec2 f_corner;"
+
+                "uniform vec4 u_color;"
+
+                "out vec4 color;"
+
+                "void main()"
+                "{"
+                "    float d = dot(f_corner, f_corner);"
+                "    if (d > 1.0) discard;"
+                "    color = vec4(u_color.rgb, u_color.a * (1.0 - d));"
+                "}");
+        }
+
+        // Starts building the default program ahead of compileDefaultShader()
+        static void requestDefaultShader()
+        {
+            ProgramCache::current().request(defaultVertexShader(), defaultFragmentShader());
+        }
+
+        bool compileDefaultShader()
+        {
+            return compile(defaultVertexShader(), defaultFragmentShader());
+        }
+
+        // Instances with the same sources share one program from the cache
+        virtual bool compile(
+            std::string const &vertShaderStr,
+            std::string const &fragShaderStr)
+        {
+            _shaderId = ProgramCache::current().program(vertShaderStr, fragShaderStr);
+            if (_shaderId == 0)
+            {
+                return false;
+            }
+
+            CameraUniformBuffer::bindProgram(_shaderId);
+            setupUniforms();
+
+            return true;
+        }
+
+        void setupUniforms()
+        {
+            _sizeUniformId = glGetUniformLocation(_shaderId, _sizeUniformName.c_str());
+            _colorUniformId = glGetUniformLocation(_shaderId, _colorUniformName.c_str());
+        }
+
+        // Half the width of a particle in meters, and its color in the center
+        void setupParticles(
+            float size,
+            glm::vec4 const &color)
+        {
+            use();
+
+            glUniform1f(_sizeUniformId, size);
+            glUniform4fv(_colorUniformId, 1, glm::value_ptr(color));
+        }
+
+        // The positions are three planes of capacity floats in the bound buffer
+        void setupInstanceAttributes(
+            size_t capacity) const
+        {
+            std::string const *names[] = {&_xAttributeName, &_yAttributeName, &_zAttributeName};
+
+            for (size_t axis = 0; axis < 3; axis++)
+            {
+                auto attrib = glGetAttribLocation(_shaderId, names[axis]->c_str());
+
+                glVertexAttribPointer(
+                    GLuint(attrib),
+                    1,
+                    GL_FLOAT,
+                    GL_FALSE,
+                    sizeof(float),
+                    reinterpret_cast<const GLvoid *>(axis * capacity * sizeof(float)));
+
+                glVertexAttribDivisor(
+                    GLuint(attrib),
+                    1);
+
+                glEnableVertexAttribArray(
+                    GLuint(attrib));
+            }
+        }
+
+    private:
+        GLuint _shaderId;
+        GLuint _sizeUniformId;
+        GLuint _colorUniformId;
+
+        std::string _sizeUniformName;
+        std::string _colorUniformName;
+
+        std::string _xAttributeName;
+        std::string _yAttributeName;
+        std::string _zAttributeName;
+    };
+
+    // Instance positions that are uploaded again every frame and drawn with one
+    // instanced draw. Like ColorPosition::StreamingBufferType the storage only grows
+    // and is orphaned with every upload.
+    class InstanceBufferType
+    {
+    public:
+        InstanceBufferType(
+            ShaderType const &shader)
+            : _shader(shader),
+              _vertexArrayId(0),
+              _instanceBufferId(0),
+              _capacity(0),
+              _instanceCount(0)
+        {}
+
+        virtual ~InstanceBufferType() {}
+
+        size_t instanceCount() const
+        {
+            return _instanceCount;
+        }
+
+        size_t capacity() const
+        {
+            return _capacity;
+        }
+
+        bool setup()
+        {
+            if (_vertexArrayId != 0)
+            {
+                return true;
+            }
+
+            glGenVertexArrays(1, &_vertexArrayId);
+            glGenBuffers(1, &_instanceBufferId);
+
+            return true;
+        }
+
+        void upload(
+            float const *x,
+            float const *y,
+            float const *z,
+            size_t count)
+        {
+            upload(x, y, z, count, 0, count);
+        }
+
+        // Uploads the run of count particles from first in arrays used as a ring of ringSize,
+        // the part that wraps around the end of the ring goes right after the rest
+        void upload(
+            float const *x,
+            float const *y,
+            float const *z,
+            size_t ringSize,
+            size_t first,
+            size_t count)
+        {
+            _instanceCount = count;
+
+            if (count == 0)
+            {
+                return;
+            }
+
+            GlState::current().bindVertexArray(_vertexArrayId);
+            GlState::current().bindArrayBuffer(_instanceBufferId);
+
+            // The attribute offsets depend on the capacity, so they only change when the buffer grows
+            if (count > _capacity)
+            {
+                _capacity = count > _capacity * 2 ? count : _capacity * 2;
+                _shader.setupInstanceAttributes(_capacity);
+            }
+
+            auto head = (first + count > ringSize ? ringSize - first : count);
+            auto headBytes = GLsizeiptr(head * sizeof(float));
+            auto tailBytes = GLsizeiptr((count - head) * sizeof(float));
+            auto planeOffset = GLintptr(_capacity * sizeof(float));
+
+            glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(_capacity * 3 * sizeof(float)), nullptr, GL_STREAM_DRAW);
+
+            float const *planes[] = {x, y, z};
+            for (size_t axis = 0; axis < 3; axis++)
+            {
+                auto offset = planeOffset * GLintptr(axis);
+
+                glBufferSubData(GL_ARRAY_BUFFER, offset, headBytes, reinterpret_cast<const GLvoid *>(planes[axis] + first));
+                if (tailBytes > 0)
+                {
+                    glBufferSubData(GL_ARRAY_BUFFER, offset + headBytes, tailBytes, reinterpret_cast<const GLvoid *>(planes[axis]));
+                }
+            }
+        }
+
+        uint32_t vertexArrayId() const
+        {
+            return _vertexArrayId;
+        }
+
+        void render()
+        {
+            if (_instanceCount == 0)
+            {
+                return;
+            }
+
+            GlState::current().bindVertexArray(_vertexArrayId);
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(_instanceCount));
+        }
+
+        void cleanup()
+        {
+            if (_instanceBufferId != 0)
+            {
+                GlState::current().deleteBuffer(_instanceBufferId);
+                _instanceBufferId = 0;
+            }
+            if (_vertexArrayId != 0)
+            {
+                GlState::current().deleteVertexArray(_vertexArrayId);
+                _vertexArrayId = 0;
+            }
+            _capacity = 0;
+            _instanceCount = 0;
+        }
+
+    private:
+        const ShaderType &_shader;
+        uint32_t _vertexArrayId;
+        uint32_t _instanceBufferId;
+        size_t _capacity;
+        size_t _instanceCount;
+    };
+
+} // namespace Particles
+
+#endif // GLPARTICLES_H
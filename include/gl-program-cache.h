@@ -0,0 +1,401 @@
+#ifndef GLPROGRAMCACHE_H
+#define GLPROGRAMCACHE_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <glad/glad.h>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+// Linked programs by the hash of their sources. Every shader instance with the same sources
+// gets the same program, and linked programs are written to disk as driver binaries, so the
+// next start loads them instead of compiling. request() starts a build without waiting for it;
+// with GL_KHR_parallel_shader_compile the driver builds all requested programs at once, and
+// program() only waits for the one it returns.
+class ProgramCache
+{
+public:
+    // There is only one context
+    static ProgramCache &current()
+    {
+        static ProgramCache cache;
+
+        return cache;
+    }
+
+    // Binaries go in the directory, none are read or written when it is empty. Call with a
+    // current context before the first request, the driver strings are part of every binary.
+    void setup(
+        std::string const &directory)
+    {
+        _directory = directory;
+
+        if (GLAD_GL_KHR_parallel_shader_compile)
+        {
+            glMaxShaderCompilerThreadsKHR(0xffffffff);
+        }
+        else if (GLAD_GL_ARB_parallel_shader_compile)
+        {
+            glMaxShaderCompilerThreadsARB(0xffffffff);
+        }
+
+        // Binaries from another driver, or another version of it, would be refused anyway
+        _driverHash = FNV_OFFSET;
+        GLenum const strings[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+        for (auto name : strings)
+        {
+            auto value = reinterpret_cast<char const *>(glGetString(name));
+            _driverHash = hash(_driverHash, value != nullptr ? value : "");
+        }
+
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        if (formats == 0)
+        {
+            _directory.clear();
+        }
+    }
+
+    // Starts building the program when no instance asked for these sources before
+    void request(
+        std::string const &vertexSource,
+        std::string const &fragmentSource)
+    {
+        auto key = hash(hash(FNV_OFFSET, vertexSource), fragmentSource);
+        if (_programs.find(key) != _programs.end())
+        {
+            return;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+
+        auto &entry = _programs[key];
+        entry.vertexSource = vertexSource;
+        entry.fragmentSource = fragmentSource;
+        entry.program = glCreateProgram();
+        entry.fromBinary = loadBinary(key, entry.program);
+        if (!entry.fromBinary)
+        {
+            build(entry);
+        }
+
+        _buildMilliseconds += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // The linked program for the sources, or 0 when they do not compile
+    GLuint program(
+        std::string const &vertexSource,
+        std::string const &fragmentSource)
+    {
+        auto key = hash(hash(FNV_OFFSET, vertexSource), fragmentSource);
+        auto found = _programs.find(key);
+        if (found == _programs.end())
+        {
+            request(vertexSource, fragmentSource);
+            found = _programs.find(key);
+        }
+        else if (found->second.done)
+        {
+            _sharedPrograms++;
+        }
+
+        auto &entry = found->second;
+        if (!entry.done)
+        {
+            auto start = std::chrono::steady_clock::now();
+
+            finish(key, entry);
+
+            _buildMilliseconds += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        return entry.linked ? entry.program : 0;
+    }
+
+    size_t compiledPrograms() const
+    {
+        return _compiledPrograms;
+    }
+
+    size_t loadedBinaries() const
+    {
+        return _loadedBinaries;
+    }
+
+    size_t sharedPrograms() const
+    {
+        return _sharedPrograms;
+    }
+
+    // Time spent issuing and waiting for builds, the driver threads are not in it
+    float buildMilliseconds() const
+    {
+        return _buildMilliseconds;
+    }
+
+private:
+    static const uint64_t FNV_OFFSET = 14695981039346656037ull;
+    static const uint32_t BINARY_MAGIC = 0x50474a53; // "SJGP"
+    static const uint32_t BINARY_VERSION = 1;
+
+    struct BinaryHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t driverHash;
+        uint64_t sourceHash;
+        uint32_t format;
+        uint32_t length;
+    };
+
+    static_assert(sizeof(BinaryHeader) == 32, "BinaryHeader layout changed");
+
+    struct Entry
+    {
+        std::string vertexSource;
+        std::string fragmentSource;
+        GLuint program = 0;
+        GLuint vertexShader = 0;
+        GLuint fragmentShader = 0;
+        bool fromBinary = false;
+        bool done = false;
+        bool linked = false;
+    };
+
+    std::map<uint64_t, Entry> _programs;
+    std::string _directory;
+    uint64_t _driverHash;
+    size_t _compiledPrograms;
+    size_t _loadedBinaries;
+    size_t _sharedPrograms;
+    float _buildMilliseconds;
+
+    ProgramCache()
+        : _driverHash(FNV_OFFSET),
+          _compiledPrograms(0),
+          _loadedBinaries(0),
+          _sharedPrograms(0),
+          _buildMilliseconds(0.0f)
+    {}
+
+    // FNV-1a, the terminating zero goes in too so "ab" + "c" and "a" + "bc" differ
+    static uint64_t hash(
+        uint64_t hash,
+        std::string const &text)
+    {
+        for (auto c : text)
+        {
+            hash = (hash ^ uint64_t(static_cast<unsigned char>(c))) * 1099511628211ull;
+        }
+
+        return hash * 1099511628211ull;
+    }
+
+    std::string binaryFilename(
+        uint64_t key) const
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "program-%016llx.bin", static_cast<unsigned long long>(key));
+
+        return _directory + "/" + name;
+    }
+
+    // Compiles and links without asking for the result, so the driver can do it in the background
+    void build(
+        Entry &entry)
+    {
+        const char *vertexSource = entry.vertexSource.c_str();
+        const char *fragmentSource = entry.fragmentSource.c_str();
+
+        entry.vertexShader = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(entry.vertexShader, 1, &vertexSource, NULL);
+        glCompileShader(entry.vertexShader);
+
+        entry.fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(entry.fragmentShader, 1, &fragmentSource, NULL);
+        glCompileShader(entry.fragmentShader);
+
+        glAttachShader(entry.program, entry.vertexShader);
+        glAttachShader(entry.program, entry.fragmentShader);
+        if (!_directory.empty())
+        {
+            glProgramParameteri(entry.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+        glLinkProgram(entry.program);
+
+        _compiledPrograms++;
+    }
+
+    // Asking for the link status is what waits for the build
+    void finish(
+        uint64_t key,
+        Entry &entry)
+    {
+        GLint result = GL_FALSE;
+        glGetProgramiv(entry.program, GL_LINK_STATUS, &result);
+
+        // The driver may still refuse a binary it wrote, then the sources are compiled after all
+        if (result == GL_FALSE && entry.fromBinary)
+        {
+            _loadedBinaries--;
+            glDeleteProgram(entry.program);
+            entry.program = glCreateProgram();
+            entry.fromBinary = false;
+            build(entry);
+            glGetProgramiv(entry.program, GL_LINK_STATUS, &result);
+        }
+
+        entry.done = true;
+        entry.linked = (result != GL_FALSE);
+
+        if (!entry.linked)
+        {
+            printLog(entry.vertexShader, false);
+            printLog(entry.fragmentShader, false);
+            printLog(entry.program, true);
+        }
+        else if (!entry.fromBinary)
+        {
+            saveBinary(key, entry.program);
+        }
+
+        if (entry.vertexShader != 0)
+        {
+            glDetachShader(entry.program, entry.vertexShader);
+            glDeleteShader(entry.vertexShader);
+            entry.vertexShader = 0;
+        }
+        if (entry.fragmentShader != 0)
+        {
+            glDetachShader(entry.program, entry.fragmentShader);
+            glDeleteShader(entry.fragmentShader);
+            entry.fragmentShader = 0;
+        }
+    }
+
+    void printLog(
+        GLuint object,
+        bool isProgram)
+    {
+        if (object == 0)
+        {
+            return;
+        }
+
+        GLint logLength = 0;
+        if (isProgram)
+        {
+            glGetProgramiv(object, GL_INFO_LOG_LENGTH, &logLength);
+        }
+        else
+        {
+            glGetShaderiv(object, GL_INFO_LOG_LENGTH, &logLength);
+        }
+        if (logLength <= 1)
+        {
+            return;
+        }
+
+        std::vector<GLchar> log(static_cast<size_t>(logLength));
+        if (isProgram)
+        {
+            glGetProgramInfoLog(object, logLength, NULL, &log[0]);
+        }
+        else
+        {
+            glGetShaderInfoLog(object, logLength, NULL, &log[0]);
+        }
+        std::cout << &log[0] << std::endl;
+    }
+
+    bool loadBinary(
+        uint64_t key,
+        GLuint program)
+    {
+        if (_directory.empty())
+        {
+            return false;
+        }
+
+        std::ifstream file(binaryFilename(key), std::ios::binary);
+        if (!file)
+        {
+            return false;
+        }
+
+        std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        BinaryHeader header;
+        if (data.size() < sizeof(header))
+        {
+            return false;
+        }
+        memcpy(&header, data.data(), sizeof(header));
+
+        if (header.magic != BINARY_MAGIC || header.version != BINARY_VERSION || header.driverHash != _driverHash ||
+            header.sourceHash != key || header.length != data.size() - sizeof(header))
+        {
+            return false;
+        }
+
+        glProgramBinary(program, header.format, data.data() + sizeof(header), GLsizei(header.length));
+        _loadedBinaries++;
+
+        return true;
+    }
+
+    void saveBinary(
+        uint64_t key,
+        GLuint program)
+    {
+        if (_directory.empty())
+        {
+            return;
+        }
+
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+        {
+            return;
+        }
+
+        std::vector<char> data(static_cast<size_t>(length));
+        GLenum format = 0;
+        glGetProgramBinary(program, length, &length, &format, data.data());
+
+        BinaryHeader header;
+        memset(&header, 0, sizeof(header));
+        header.magic = BINARY_MAGIC;
+        header.version = BINARY_VERSION;
+        header.driverHash = _driverHash;
+        header.sourceHash = key;
+        header.format = format;
+        header.length = uint32_t(length);
+
+        // Written next to the old binary and renamed, a crash while writing leaves no half file
+        auto filename = binaryFilename(key);
+        auto temporary = filename + ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+            file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+            file.write(data.data(), std::streamsize(length));
+            if (!file)
+            {
+                std::cerr << "could not write " << temporary << std::endl;
+
+                return;
+            }
+        }
+        std::remove(filename.c_str());
+        std::rename(temporary.c_str(), filename.c_str());
+    }
+};
+
+#endif // GLPROGRAMCACHE_H
@@ -0,0 +1,171 @@
+#ifndef GLRENDERQUEUE_H
+#define GLRENDERQUEUE_H
+
+#include "gl-state.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <glad/glad.h>
+#include <utility>
+#include <vector>
+
+// Layers are drawn in this order, whatever the rest of the key says
+enum class RenderLayer
+{
+    Background,
+    Opaque,
+    Transparent,
+    Overlay,
+};
+
+// The fixed function state a draw needs, everything else is left as the queue found it
+struct RenderState
+{
+    bool depthTest = false;
+    bool depthWrite = true;
+    bool blend = false;
+    bool cullFace = false;
+    GLenum frontFace = GL_CCW;
+
+    uint64_t bits() const
+    {
+        return (depthTest ? 1u : 0u) | (depthWrite ? 2u : 0u) | (blend ? 4u : 0u) | (cullFace ? 8u : 0u) | (frontFace == GL_CW ? 16u : 0u);
+    }
+
+    void apply() const
+    {
+        auto &state = GlState::current();
+
+        state.setEnabled(GL_DEPTH_TEST, depthTest);
+        state.depthMask(depthWrite);
+        state.setEnabled(GL_BLEND, blend);
+        if (blend)
+        {
+            state.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        }
+        state.setEnabled(GL_CULL_FACE, cullFace);
+        state.frontFace(frontFace);
+    }
+};
+
+// Per-frame command buffer of draw packets. Packets are sorted on a 64 bit key so draws
+// that share state, program and mesh end up next to each other, and then executed through
+// GlState so only the changes between neighbours reach the driver.
+//
+// Key layout from the top bit down:
+//   layer 2 | state 6 | program 16 | mesh 16 | depth 24        front to back
+//   layer 2 | depth 24 | state 6 | program 16 | mesh 16        transparent, back to front
+class RenderQueue
+{
+public:
+    typedef std::function<void()> DrawFunction;
+
+    RenderQueue()
+        : _lastPacketCount(0),
+          _lastSortMilliseconds(0.0f)
+    {}
+
+    virtual ~RenderQueue() {}
+
+    // Depth goes from 0 at the eye to 1 at the far plane. The draw function sets the
+    // uniforms of the packet and draws, the program is already in use.
+    void submit(
+        RenderLayer layer,
+        RenderState const &state,
+        GLuint program,
+        GLuint mesh,
+        float depth,
+        DrawFunction const &draw)
+    {
+        Packet packet;
+
+        packet.state = state;
+        packet.program = program;
+        packet.draw = draw;
+
+        _keys.push_back(std::make_pair(makeKey(layer, state, program, mesh, depth), uint32_t(_packets.size())));
+        _packets.push_back(packet);
+    }
+
+    // Sorts, draws and empties the queue. The state is put back to the defaults afterwards,
+    // a depth mask that stays off would keep the next clear from clearing depth.
+    void execute()
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        // Equal keys keep the order they were submitted in, the packet index breaks the tie
+        std::sort(_keys.begin(), _keys.end());
+
+        _lastSortMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        for (auto &key : _keys)
+        {
+            auto &packet = _packets[key.second];
+
+            packet.state.apply();
+            if (packet.program != 0)
+            {
+                GlState::current().useProgram(packet.program);
+            }
+            packet.draw();
+        }
+
+        RenderState().apply();
+
+        _lastPacketCount = _packets.size();
+        _keys.clear();
+        _packets.clear();
+    }
+
+    size_t lastPacketCount() const
+    {
+        return _lastPacketCount;
+    }
+
+    float lastSortMilliseconds() const
+    {
+        return _lastSortMilliseconds;
+    }
+
+    static uint64_t makeKey(
+        RenderLayer layer,
+        RenderState const &state,
+        GLuint program,
+        GLuint mesh,
+        float depth)
+    {
+        // Names only group packets, when two collide in 16 bits it costs state changes and nothing else
+        uint64_t layerBits = uint64_t(layer) & 0x3;
+        uint64_t stateBits = state.bits() & 0x3f;
+        uint64_t programBits = uint64_t(program) & 0xffff;
+        uint64_t meshBits = uint64_t(mesh) & 0xffff;
+        uint64_t depthBits = uint64_t(std::min(std::max(depth, 0.0f), 1.0f) * float(0xffffff)) & 0xffffff;
+
+        if (layer == RenderLayer::Transparent)
+        {
+            // Blending needs the far packets first
+            depthBits = 0xffffff - depthBits;
+
+            return (layerBits << 62) | (depthBits << 38) | (stateBits << 32) | (programBits << 16) | meshBits;
+        }
+
+        return (layerBits << 62) | (stateBits << 56) | (programBits << 40) | (meshBits << 24) | depthBits;
+    }
+
+private:
+    struct Packet
+    {
+        RenderState state;
+        GLuint program;
+        DrawFunction draw;
+    };
+
+    std::vector<std::pair<uint64_t, uint32_t>> _keys;
+    std::vector<Packet> _packets;
+    size_t _lastPacketCount;
+    float _lastSortMilliseconds;
+};
+
+#endif // GLRENDERQUEUE_H
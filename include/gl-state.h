@@ -0,0 +1,264 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <cstddef>
+#include <glad/glad.h>
+#include <map>
+
+// Shadow copy of the GL state the game changes. Calls that would not change anything are
+// skipped, and the driver is never asked for the current state. It starts out with the
+// defaults of a new context, so all code that changes the tracked state has to go
+// through here. ImGui changes it too, but puts everything back when it is done.
+class GlState
+{
+public:
+    static const int TEXTURE_UNITS = 16;
+
+    // There is only one context
+    static GlState &current()
+    {
+        static GlState state;
+
+        return state;
+    }
+
+    bool isEnabled(
+        GLenum cap)
+    {
+        return capability(cap);
+    }
+
+    void setEnabled(
+        GLenum cap,
+        bool enabled)
+    {
+        auto &value = capability(cap);
+        if (!counted(value != enabled))
+        {
+            return;
+        }
+
+        value = enabled;
+        if (enabled)
+        {
+            glEnable(cap);
+        }
+        else
+        {
+            glDisable(cap);
+        }
+    }
+
+    void useProgram(
+        GLuint program)
+    {
+        if (counted(_program != program))
+        {
+            _program = program;
+            glUseProgram(program);
+        }
+    }
+
+    void bindVertexArray(
+        GLuint vertexArray)
+    {
+        if (counted(_vertexArray != vertexArray))
+        {
+            _vertexArray = vertexArray;
+            glBindVertexArray(vertexArray);
+        }
+    }
+
+    // Only GL_ARRAY_BUFFER is tracked, the element buffer belongs to the vertex array
+    void bindArrayBuffer(
+        GLuint buffer)
+    {
+        if (counted(_arrayBuffer != buffer))
+        {
+            _arrayBuffer = buffer;
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        }
+    }
+
+    void activeTexture(
+        GLenum unit)
+    {
+        if (counted(_activeTexture != unit))
+        {
+            _activeTexture = unit;
+            glActiveTexture(unit);
+        }
+    }
+
+    // Binds a 2D texture to the active unit
+    void bindTexture(
+        GLuint texture)
+    {
+        auto &bound = _textures[_activeTexture - GL_TEXTURE0];
+        if (counted(bound != texture))
+        {
+            bound = texture;
+            glBindTexture(GL_TEXTURE_2D, texture);
+        }
+    }
+
+    // Binds a 2D texture to the given unit, the active unit only changes when the texture does
+    void bindTexture(
+        GLenum unit,
+        GLuint texture)
+    {
+        if (_textures[unit - GL_TEXTURE0] == texture)
+        {
+            _skipped++;
+
+            return;
+        }
+
+        activeTexture(unit);
+        bindTexture(texture);
+    }
+
+    void frontFace(
+        GLenum mode)
+    {
+        if (counted(_frontFace != mode))
+        {
+            _frontFace = mode;
+            glFrontFace(mode);
+        }
+    }
+
+    void depthMask(
+        bool enabled)
+    {
+        if (counted(_depthMask != enabled))
+        {
+            _depthMask = enabled;
+            glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+        }
+    }
+
+    void blendFunc(
+        GLenum source,
+        GLenum destination)
+    {
+        if (counted(_blendSource != source || _blendDestination != destination))
+        {
+            _blendSource = source;
+            _blendDestination = destination;
+            glBlendFunc(source, destination);
+        }
+    }
+
+    // Deleting an object unbinds it, the shadow has to follow or a new object
+    // that gets the same name would not be bound
+    void deleteBuffer(
+        GLuint buffer)
+    {
+        if (_arrayBuffer == buffer)
+        {
+            _arrayBuffer = 0;
+        }
+        glDeleteBuffers(1, &buffer);
+    }
+
+    void deleteVertexArray(
+        GLuint vertexArray)
+    {
+        if (_vertexArray == vertexArray)
+        {
+            _vertexArray = 0;
+        }
+        glDeleteVertexArrays(1, &vertexArray);
+    }
+
+    void deleteTexture(
+        GLuint texture)
+    {
+        for (auto &bound : _textures)
+        {
+            if (bound == texture)
+            {
+                bound = 0;
+            }
+        }
+        glDeleteTextures(1, &texture);
+    }
+
+    size_t issuedChanges() const
+    {
+        return _issued;
+    }
+
+    size_t skippedChanges() const
+    {
+        return _skipped;
+    }
+
+    void resetCounters()
+    {
+        _issued = 0;
+        _skipped = 0;
+    }
+
+private:
+    std::map<GLenum, bool> _capabilities;
+    GLuint _program;
+    GLuint _vertexArray;
+    GLuint _arrayBuffer;
+    GLenum _activeTexture;
+    GLuint _textures[TEXTURE_UNITS];
+    GLenum _frontFace;
+    bool _depthMask;
+    GLenum _blendSource;
+    GLenum _blendDestination;
+    size_t _issued;
+    size_t _skipped;
+
+    GlState()
+        : _program(0),
+          _vertexArray(0),
+          _arrayBuffer(0),
+          _activeTexture(GL_TEXTURE0),
+          _textures{},
+          _frontFace(GL_CCW),
+          _depthMask(true),
+          _blendSource(GL_ONE),
+          _blendDestination(GL_ZERO),
+          _issued(0),
+          _skipped(0)
+    {}
+
+    bool &capability(
+        GLenum cap)
+    {
+        auto found = _capabilities.find(cap);
+        if (found != _capabilities.end())
+        {
+            return found->second;
+        }
+
+        // Only dithering and multisampling are on in a new context
+        auto enabled = (cap == GL_DITHER || cap == GL_MULTISAMPLE);
+
+        return _capabilities.insert(std::make_pair(cap, enabled)).first->second;
+    }
+
+    // Counts the call as issued or skipped, and passes on whether it has to be issued
+    bool counted(
+        bool changed)
+    {
+        if (changed)
+        {
+            _issued++;
+        }
+        else
+        {
+            _skipped++;
+        }
+
+        return changed;
+    }
+};
+
+#endif // GLSTATE_H
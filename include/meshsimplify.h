@@ -0,0 +1,339 @@
+#ifndef MESHSIMPLIFY_H
+#define MESHSIMPLIFY_H
+
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <glm/glm.hpp>
+#include <map>
+#include <queue>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Simplification of indexed triangle lists by quadric edge collapse, after Garland and Heckbert's
+// "Surface Simplification Using Quadric Error Metrics". Every position keeps the sum of the squared
+// distances to the planes of its triangles, and the edge whose collapse adds the least to that sum
+// goes first. Edges collapse onto one of their ends, so no new positions are made.
+namespace MeshSimplify
+{
+    // Open edges count this many times more than faces, so outlines keep their shape
+    const double BOUNDARY_WEIGHT = 10.0;
+
+    // Collapses that turn a triangle further than this, as cosine of the angle, are not done
+    const float MAX_FLIP = 0.25f;
+
+    // Symmetric 4x4 matrix, only the upper half is kept
+    struct Quadric
+    {
+        double xx, xy, xz, xw, yy, yz, yw, zz, zw, ww;
+
+        Quadric()
+            : xx(0), xy(0), xz(0), xw(0), yy(0), yz(0), yw(0), zz(0), zw(0), ww(0)
+        {}
+
+        // The plane through point with the given unit normal
+        static Quadric plane(
+            glm::vec3 const &normal,
+            glm::vec3 const &point,
+            double weight)
+        {
+            double a = normal.x, b = normal.y, c = normal.z;
+            double d = -(a * point.x + b * point.y + c * point.z);
+
+            Quadric q;
+            q.xx = weight * a * a;
+            q.xy = weight * a * b;
+            q.xz = weight * a * c;
+            q.xw = weight * a * d;
+            q.yy = weight * b * b;
+            q.yz = weight * b * c;
+            q.yw = weight * b * d;
+            q.zz = weight * c * c;
+            q.zw = weight * c * d;
+            q.ww = weight * d * d;
+
+            return q;
+        }
+
+        Quadric &operator+=(
+            Quadric const &other)
+        {
+            xx += other.xx;
+            xy += other.xy;
+            xz += other.xz;
+            xw += other.xw;
+            yy += other.yy;
+            yz += other.yz;
+            yw += other.yw;
+            zz += other.zz;
+            zw += other.zw;
+            ww += other.ww;
+
+            return *this;
+        }
+
+        double error(
+            glm::vec3 const &p) const
+        {
+            double x = p.x, y = p.y, z = p.z;
+
+            return xx * x * x + 2 * xy * x * y + 2 * xz * x * z + 2 * xw * x +
+                   yy * y * y + 2 * yz * y * z + 2 * yw * y +
+                   zz * z * z + 2 * zw * z +
+                   ww;
+        }
+    };
+
+    struct Collapse
+    {
+        double cost;
+        uint32_t from;
+        uint32_t to;
+        uint32_t fromVersion;
+        uint32_t toVersion;
+
+        bool operator>(
+            Collapse const &other) const
+        {
+            return cost > other.cost;
+        }
+    };
+
+    // Writes the indices of a simpler version of the triangle list to result, with no more than
+    // targetIndexCount indices unless every collapse left would fold the surface. Corners keep the
+    // attributes of their vertex; a corner that moved to another position gets a copy of its vertex
+    // at that position, added to the end of vertices. T needs a glm::vec3 pos.
+    template <class T>
+    void simplify(
+        std::vector<T> &vertices,
+        std::vector<uint32_t> const &indices,
+        size_t targetIndexCount,
+        std::vector<uint32_t> &result)
+    {
+        result.clear();
+
+        // Vertices that only differ in normal or color are one position here
+        std::map<std::tuple<float, float, float>, uint32_t> welded;
+        std::vector<uint32_t> positionOf(vertices.size());
+        std::vector<glm::vec3> positions;
+        for (size_t v = 0; v < vertices.size(); v++)
+        {
+            auto &pos = vertices[v].pos;
+            auto key = std::make_tuple(pos.x, pos.y, pos.z);
+            auto found = welded.find(key);
+            if (found == welded.end())
+            {
+                found = welded.insert(std::make_pair(key, uint32_t(positions.size()))).first;
+                positions.push_back(pos);
+            }
+            positionOf[v] = found->second;
+        }
+
+        auto triangleCount = indices.size() / 3;
+        std::vector<uint32_t> corners(triangleCount * 3);
+        std::vector<bool> alive(triangleCount, true);
+        std::vector<std::vector<uint32_t>> trianglesOf(positions.size());
+        std::vector<Quadric> quadrics(positions.size());
+        std::map<std::pair<uint32_t, uint32_t>, int> edgeUse;
+        size_t liveTriangles = 0;
+
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            auto a = corners[t * 3] = positionOf[indices[t * 3]];
+            auto b = corners[(t * 3) + 1] = positionOf[indices[(t * 3) + 1]];
+            auto c = corners[(t * 3) + 2] = positionOf[indices[(t * 3) + 2]];
+
+            auto n = glm::cross(positions[b] - positions[a], positions[c] - positions[a]);
+            auto area = glm::length(n);
+            if (a == b || b == c || c == a || area <= 0.0f)
+            {
+                alive[t] = false;
+                continue;
+            }
+
+            // Larger triangles weigh more, the length of the cross product is twice the area
+            auto q = Quadric::plane(n / area, positions[a], double(area) * 0.5);
+            for (size_t k = 0; k < 3; k++)
+            {
+                auto p = corners[(t * 3) + k];
+                quadrics[p] += q;
+                trianglesOf[p].push_back(uint32_t(t));
+
+                auto next = corners[(t * 3) + ((k + 1) % 3)];
+                edgeUse[std::make_pair(std::min(p, next), std::max(p, next))]++;
+            }
+            liveTriangles++;
+        }
+
+        // Edges of only one triangle get a plane through the edge, standing up on the triangle
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            if (!alive[t])
+            {
+                continue;
+            }
+
+            auto &a = positions[corners[t * 3]];
+            auto n = glm::normalize(glm::cross(positions[corners[(t * 3) + 1]] - a, positions[corners[(t * 3) + 2]] - a));
+            for (size_t k = 0; k < 3; k++)
+            {
+                auto p = corners[(t * 3) + k];
+                auto next = corners[(t * 3) + ((k + 1) % 3)];
+                if (edgeUse[std::make_pair(std::min(p, next), std::max(p, next))] != 1)
+                {
+                    continue;
+                }
+
+                auto edge = positions[next] - positions[p];
+                auto length = glm::length(edge);
+                auto q = Quadric::plane(glm::normalize(glm::cross(edge, n)), positions[p], BOUNDARY_WEIGHT * double(length * length));
+                quadrics[p] += q;
+                quadrics[next] += q;
+            }
+        }
+
+        // Candidates go stale when one of their ends changes, the versions tell
+        std::vector<uint32_t> version(positions.size(), 0);
+        std::vector<bool> removed(positions.size(), false);
+        std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> candidates;
+
+        auto push = [&](uint32_t from, uint32_t to) {
+            auto q = quadrics[from];
+            q += quadrics[to];
+            candidates.push(Collapse({q.error(positions[to]), from, to, version[from], version[to]}));
+        };
+
+        for (auto &edge : edgeUse)
+        {
+            push(edge.first.first, edge.first.second);
+            push(edge.first.second, edge.first.first);
+        }
+
+        while (liveTriangles * 3 > targetIndexCount && !candidates.empty())
+        {
+            auto collapse = candidates.top();
+            candidates.pop();
+
+            auto from = collapse.from;
+            auto to = collapse.to;
+            if (removed[from] || removed[to] || version[from] != collapse.fromVersion || version[to] != collapse.toVersion)
+            {
+                continue;
+            }
+
+            // The triangles that stay must not turn over
+            auto folds = false;
+            for (auto t : trianglesOf[from])
+            {
+                auto c = &corners[t * 3];
+                if (!alive[t] || c[0] == to || c[1] == to || c[2] == to)
+                {
+                    continue;
+                }
+
+                glm::vec3 before[3], after[3];
+                for (size_t k = 0; k < 3; k++)
+                {
+                    before[k] = positions[c[k]];
+                    after[k] = positions[c[k] == from ? to : c[k]];
+                }
+                auto n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+                auto n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+                auto l0 = glm::length(n0);
+                auto l1 = glm::length(n1);
+                if (l1 <= 0.0f || glm::dot(n0, n1) < MAX_FLIP * l0 * l1)
+                {
+                    folds = true;
+                    break;
+                }
+            }
+            if (folds)
+            {
+                continue;
+            }
+
+            for (auto t : trianglesOf[from])
+            {
+                auto c = &corners[t * 3];
+                if (!alive[t])
+                {
+                    continue;
+                }
+
+                if (c[0] == to || c[1] == to || c[2] == to)
+                {
+                    alive[t] = false;
+                    liveTriangles--;
+                    continue;
+                }
+
+                for (size_t k = 0; k < 3; k++)
+                {
+                    if (c[k] == from)
+                    {
+                        c[k] = to;
+                    }
+                }
+                trianglesOf[to].push_back(t);
+            }
+            trianglesOf[from].clear();
+            quadrics[to] += quadrics[from];
+            removed[from] = true;
+            version[to]++;
+
+            for (auto t : trianglesOf[to])
+            {
+                if (!alive[t])
+                {
+                    continue;
+                }
+
+                for (size_t k = 0; k < 3; k++)
+                {
+                    auto other = corners[(t * 3) + k];
+                    if (other != to)
+                    {
+                        push(to, other);
+                        push(other, to);
+                    }
+                }
+            }
+        }
+
+        // Corners that moved need a vertex at their new position
+        std::map<std::pair<uint32_t, uint32_t>, uint32_t> moved;
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            if (!alive[t])
+            {
+                continue;
+            }
+
+            for (size_t k = 0; k < 3; k++)
+            {
+                auto v = indices[(t * 3) + k];
+                auto p = corners[(t * 3) + k];
+                if (positionOf[v] == p)
+                {
+                    result.push_back(v);
+                    continue;
+                }
+
+                auto key = std::make_pair(v, p);
+                auto found = moved.find(key);
+                if (found == moved.end())
+                {
+                    auto copy = vertices[v];
+                    copy.pos = positions[p];
+                    found = moved.insert(std::make_pair(key, uint32_t(vertices.size()))).first;
+                    vertices.push_back(copy);
+                }
+                result.push_back(found->second);
+            }
+        }
+    }
+
+} // namespace MeshSimplify
+
+#endif // MESHSIMPLIFY_H
@@ -0,0 +1,222 @@
+#ifndef VERTEXCACHE_H
+#define VERTEXCACHE_H
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Index and vertex order for indexed triangle lists. The triangle order follows Tom Forsyth's
+// "Linear-Speed Vertex Cache Optimisation": triangles are emitted greedily by the score of their
+// vertices, where vertices that were just used and vertices with few triangles left score highest.
+namespace VertexCache
+{
+    // Larger than any real post-transform cache, the scores fall off toward the end anyway
+    const int CACHE_SIZE = 32;
+
+    inline float vertexScore(
+        int cachePosition,
+        int remainingTriangles)
+    {
+        if (remainingTriangles == 0)
+        {
+            return -1.0f;
+        }
+
+        auto score = 0.0f;
+        if (cachePosition >= 0)
+        {
+            // The last triangle's vertices get a fixed score, so the next triangle does not
+            // just reuse the most recent edge and leave long thin strips behind
+            if (cachePosition < 3)
+            {
+                score = 0.75f;
+            }
+            else
+            {
+                auto scale = 1.0f / float(CACHE_SIZE - 3);
+                score = std::pow(1.0f - (float(cachePosition - 3) * scale), 1.5f);
+            }
+        }
+
+        // Vertices with few triangles left are finished first, so they do not stay behind
+        score += 2.0f / std::sqrt(float(remainingTriangles));
+
+        return score;
+    }
+
+    // Reorders the triangles of an indexed triangle list in place
+    inline void optimizeTriangles(
+        std::vector<uint32_t> &indices,
+        size_t vertexCount)
+    {
+        auto triangleCount = indices.size() / 3;
+        if (triangleCount == 0)
+        {
+            return;
+        }
+
+        // The triangles of every vertex, as one list with an offset per vertex
+        std::vector<int> remaining(vertexCount, 0);
+        for (auto index : indices)
+        {
+            remaining[index]++;
+        }
+
+        std::vector<size_t> offsets(vertexCount + 1, 0);
+        for (size_t v = 0; v < vertexCount; v++)
+        {
+            offsets[v + 1] = offsets[v] + size_t(remaining[v]);
+        }
+
+        std::vector<uint32_t> vertexTriangles(indices.size());
+        std::vector<int> filled(vertexCount, 0);
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            for (size_t c = 0; c < 3; c++)
+            {
+                auto v = indices[(t * 3) + c];
+                vertexTriangles[offsets[v] + size_t(filled[v]++)] = uint32_t(t);
+            }
+        }
+
+        std::vector<int> cachePosition(vertexCount, -1);
+        std::vector<float> score(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++)
+        {
+            score[v] = vertexScore(-1, remaining[v]);
+        }
+
+        std::vector<bool> emitted(triangleCount, false);
+        std::vector<float> triangleScore(triangleCount);
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            triangleScore[t] = score[indices[t * 3]] + score[indices[(t * 3) + 1]] + score[indices[(t * 3) + 2]];
+        }
+
+        std::vector<uint32_t> result;
+        result.reserve(indices.size());
+
+        std::vector<uint32_t> cache;
+        std::vector<uint32_t> nextCache;
+        cache.reserve(CACHE_SIZE + 3);
+        nextCache.reserve(CACHE_SIZE + 3);
+
+        // When nothing in the cache has triangles left, the search starts over at the
+        // first triangle that was not emitted yet
+        size_t cursor = 0;
+        auto best = -1;
+
+        for (size_t done = 0; done < triangleCount; done++)
+        {
+            if (best < 0)
+            {
+                while (emitted[cursor])
+                {
+                    cursor++;
+                }
+                best = int(cursor);
+            }
+
+            auto t = size_t(best);
+            emitted[t] = true;
+
+            nextCache.clear();
+            for (size_t c = 0; c < 3; c++)
+            {
+                auto v = indices[(t * 3) + c];
+                result.push_back(v);
+                nextCache.push_back(v);
+
+                // Take the triangle out of the list of the vertex
+                auto first = offsets[v];
+                auto last = first + size_t(remaining[v]) - 1;
+                for (auto i = first; i <= last; i++)
+                {
+                    if (vertexTriangles[i] == t)
+                    {
+                        vertexTriangles[i] = vertexTriangles[last];
+                        break;
+                    }
+                }
+                remaining[v]--;
+            }
+
+            for (auto v : cache)
+            {
+                if (v != nextCache[0] && v != nextCache[1] && v != nextCache[2])
+                {
+                    nextCache.push_back(v);
+                }
+            }
+
+            // Vertices that fall out of the cache lose their cache score
+            for (size_t i = CACHE_SIZE; i < nextCache.size(); i++)
+            {
+                auto v = nextCache[i];
+                cachePosition[v] = -1;
+                score[v] = vertexScore(-1, remaining[v]);
+            }
+            if (nextCache.size() > size_t(CACHE_SIZE))
+            {
+                nextCache.resize(CACHE_SIZE);
+            }
+
+            for (size_t i = 0; i < nextCache.size(); i++)
+            {
+                auto v = nextCache[i];
+                cachePosition[v] = int(i);
+                score[v] = vertexScore(int(i), remaining[v]);
+            }
+
+            // Only the triangles around the cached vertices changed score, the best of them is next
+            best = -1;
+            auto bestScore = -1.0f;
+            for (auto v : nextCache)
+            {
+                for (auto i = offsets[v]; i < offsets[v] + size_t(remaining[v]); i++)
+                {
+                    auto n = vertexTriangles[i];
+                    triangleScore[n] = score[indices[n * 3]] + score[indices[(n * 3) + 1]] + score[indices[(n * 3) + 2]];
+                    if (triangleScore[n] > bestScore)
+                    {
+                        bestScore = triangleScore[n];
+                        best = int(n);
+                    }
+                }
+            }
+
+            cache.swap(nextCache);
+        }
+
+        indices.swap(result);
+    }
+
+    // Moves the vertices into the order the indices first use them, so the vertex fetches
+    // walk through memory. Vertices that no index uses are dropped.
+    template <class T>
+    void optimizeVertices(
+        std::vector<T> &vertices,
+        std::vector<uint32_t> &indices)
+    {
+        const uint32_t unused = 0xffffffff;
+
+        std::vector<uint32_t> remap(vertices.size(), unused);
+        std::vector<T> result;
+        result.reserve(vertices.size());
+
+        for (auto &index : indices)
+        {
+            if (remap[index] == unused)
+            {
+                remap[index] = uint32_t(result.size());
+                result.push_back(vertices[index]);
+            }
+            index = remap[index];
+        }
+
+        vertices.swap(result);
+    }
+
+} // namespace VertexCache
+
+#endif // VERTEXCACHE_H
@@ -0,0 +1,51 @@
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "level.h"
+#include <cstdlib>
+#include <iostream>
+
+// Cooks the authoring image of a level into the binary level file the game maps at startup
+int main(
+    int argc,
+    char *argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "usage: " << argv[0] << " <level.png> <level.sjl> [plane width] [plane height]" << std::endl;
+
+        return 1;
+    }
+
+    glm::vec2 planeSize(50.0f);
+    if (argc > 3)
+    {
+        planeSize = glm::vec2(float(std::atof(argv[3])));
+    }
+    if (argc > 4)
+    {
+        planeSize.y = float(std::atof(argv[4]));
+    }
+
+    Level level;
+    if (!level.cookImage(argv[1], planeSize))
+    {
+        std::cerr << "could not cook " << argv[1] << std::endl;
+
+        return 1;
+    }
+
+    if (!level.write(argv[2]))
+    {
+        std::cerr << "could not write " << argv[2] << std::endl;
+
+        return 1;
+    }
+
+    std::cout << argv[2] << ": "
+              << level.size().x << "x" << level.size().y << " pixels, "
+              << level.treeCount() << " trees, "
+              << level.colliderCount() << " colliders" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,247 @@
+#include "gpumaskpainter.h"
+#include "levelformat.h"
+#include <capabilityguard.h>
+#include <glad/glad.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <iostream>
+
+GpuMaskPainter::GpuMaskPainter()
+    : _framebufferId(0),
+      _readbackBufferId(0),
+      _readbackFence(nullptr),
+      _readbackCapacity(0),
+      _readbackBytes(0),
+      _buffer(_shader)
+{
+    _buffer.setDrawMode(GL_TRIANGLE_FAN);
+}
+
+GpuMaskPainter::~GpuMaskPainter() = default;
+
+bool GpuMaskPainter::setup(
+    uint32_t textureId)
+{
+    auto firstSetup = _framebufferId == 0;
+
+    if (firstSetup)
+    {
+        glGenFramebuffers(1, &_framebufferId);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, _framebufferId);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textureId, 0);
+
+    auto status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::cerr << "mask texture is not renderable (" << status << ")" << std::endl;
+
+        cleanup();
+
+        return false;
+    }
+
+    if (firstSetup)
+    {
+        _shader.compileDefaultShader();
+        _buffer.setup();
+
+        // The region projection goes in as the model matrix, so the camera itself stays identity
+        _camera.setup();
+        _camera.update(glm::mat4(1.0f), glm::mat4(1.0f));
+    }
+
+    return true;
+}
+
+bool GpuMaskPainter::isSetup() const
+{
+    return _framebufferId != 0;
+}
+
+void GpuMaskPainter::paint(
+    glm::vec2 const *corners,
+    int count,
+    Region const *regions,
+    int regionCount,
+    int regionSize)
+{
+    if (_framebufferId == 0 || count < 3 || regionCount <= 0)
+    {
+        return;
+    }
+
+    // Only the color is used, or-ed into the mask it sets the cleared bits
+    auto cleared = ColorPosition::packColor(glm::vec4(float(MASK_CLEARED) / 255.0f, 0.0f, 0.0f, 1.0f));
+
+    _buffer.clear();
+    for (int i = 0; i < count; i++)
+    {
+        _buffer.vertex(glm::vec3(corners[i], 0.0f), cleared);
+    }
+    _buffer.upload();
+
+    CapabilityGuard cullFace(GL_CULL_FACE, false);
+    CapabilityGuard depthTest(GL_DEPTH_TEST, false);
+    CapabilityGuard blend(GL_BLEND, false);
+
+    // The road bits in the same byte are left untouched
+    CapabilityGuard logicOp(GL_COLOR_LOGIC_OP, true);
+    glLogicOp(GL_OR);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, _framebufferId);
+
+    // Takes the binding point from the frame camera, Render() binds that again before drawing
+    _camera.bind();
+    _shader.use();
+
+    for (int i = 0; i < regionCount; i++)
+    {
+        auto &region = regions[i];
+
+        // Render() sets the viewport for the window again before drawing the frame, the polygon is
+        // clipped to the viewport so it does not spill into the neighbouring atlas slots
+        glViewport(region.target.x, region.target.y, regionSize, regionSize);
+
+        auto projection = glm::ortho(
+            float(region.source.x),
+            float(region.source.x + regionSize),
+            float(region.source.y),
+            float(region.source.y + regionSize),
+            -1.0f,
+            1.0f);
+
+        _shader.setupModel(projection);
+        _buffer.render();
+    }
+
+    glLogicOp(GL_COPY);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void GpuMaskPainter::requestReadback(
+    glm::ivec2 const *origins,
+    int count,
+    int regionSize)
+{
+    if (_framebufferId == 0 || _readbackFence != nullptr || count <= 0)
+    {
+        return;
+    }
+
+    auto regionBytes = size_t(regionSize) * size_t(regionSize);
+    auto size = regionBytes * size_t(count);
+
+    if (_readbackBufferId == 0)
+    {
+        glGenBuffers(1, &_readbackBufferId);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _readbackBufferId);
+
+    // Only grows, so a busy second does not reallocate the buffer the next time
+    if (size > _readbackCapacity)
+    {
+        _readbackCapacity = size;
+        glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(size), nullptr, GL_STREAM_READ);
+    }
+
+    _readbackBytes = size;
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, _framebufferId);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    // With a pack buffer bound this only queues the copies and returns right away
+    for (int i = 0; i < count; i++)
+    {
+        glReadPixels(
+            origins[i].x,
+            origins[i].y,
+            regionSize,
+            regionSize,
+            GL_RED,
+            GL_UNSIGNED_BYTE,
+            reinterpret_cast<GLvoid *>(i * regionBytes));
+    }
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    _readbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+bool GpuMaskPainter::isReadbackPending() const
+{
+    return _readbackFence != nullptr;
+}
+
+unsigned char const *GpuMaskPainter::mapReadback(
+    bool wait)
+{
+    if (_readbackFence == nullptr)
+    {
+        return nullptr;
+    }
+
+    auto result = glClientWaitSync(_readbackFence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GL_TIMEOUT_IGNORED : 0);
+    if (result == GL_TIMEOUT_EXPIRED)
+    {
+        return nullptr;
+    }
+
+    glDeleteSync(_readbackFence);
+    _readbackFence = nullptr;
+
+    if (result == GL_WAIT_FAILED)
+    {
+        return nullptr;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _readbackBufferId);
+    auto data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, GLsizeiptr(_readbackBytes), GL_MAP_READ_BIT);
+    if (data == nullptr)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    return static_cast<unsigned char const *>(data);
+}
+
+void GpuMaskPainter::unmapReadback()
+{
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void GpuMaskPainter::cancelReadback()
+{
+    if (_readbackFence != nullptr)
+    {
+        glDeleteSync(_readbackFence);
+        _readbackFence = nullptr;
+    }
+}
+
+void GpuMaskPainter::cleanup()
+{
+    cancelReadback();
+
+    if (_readbackBufferId != 0)
+    {
+        glDeleteBuffers(1, &_readbackBufferId);
+        _readbackBufferId = 0;
+        _readbackCapacity = 0;
+    }
+    if (_framebufferId != 0)
+    {
+        glDeleteFramebuffers(1, &_framebufferId);
+        _framebufferId = 0;
+    }
+    _buffer.cleanup();
+    _camera.cleanup();
+}
@@ -0,0 +1,69 @@
+#ifndef GPUMASKPAINTER_H
+#define GPUMASKPAINTER_H
+
+#include <gl-color-position-vertex.h>
+#include <glm/glm.hpp>
+
+// Paints into the mask atlas by rendering into it through a framebuffer object,
+// so nothing has to be painted or uploaded on the CPU.
+class GpuMaskPainter
+{
+public:
+    // A square of the mask and the place in the atlas where its pixels are kept
+    struct Region
+    {
+        glm::ivec2 source;
+        glm::ivec2 target;
+    };
+
+    GpuMaskPainter();
+
+    virtual ~GpuMaskPainter();
+
+    // Can be called again to paint into a new texture, after the atlas was resized
+    bool setup(
+        uint32_t textureId);
+
+    bool isSetup() const;
+
+    // Fills the convex polygon given in mask space (pixels) with a cleared mask value,
+    // once for every region the polygon overlaps
+    void paint(
+        glm::vec2 const *corners,
+        int count,
+        Region const *regions,
+        int regionCount,
+        int regionSize);
+
+    // Starts copying the squares at the given texture origins into a pixel pack buffer, one after
+    // the other, this does not wait for the GPU
+    void requestReadback(
+        glm::ivec2 const *origins,
+        int count,
+        int regionSize);
+
+    bool isReadbackPending() const;
+
+    // Maps the read back squares once the GPU is done with them, returns nullptr while the
+    // copy is still in flight unless wait is set. Call unmapReadback() when done with the data.
+    unsigned char const *mapReadback(
+        bool wait = false);
+
+    void unmapReadback();
+
+    void cancelReadback();
+
+    void cleanup();
+
+private:
+    uint32_t _framebufferId;
+    uint32_t _readbackBufferId;
+    GLsync _readbackFence;
+    size_t _readbackCapacity;
+    size_t _readbackBytes;
+    CameraUniformBuffer _camera;
+    ColorPosition::ShaderType _shader;
+    ColorPosition::StreamingBufferType _buffer;
+};
+
+#endif // GPUMASKPAINTER_H
@@ -0,0 +1,440 @@
+#include "level.h"
+#include "stb_image.h"
+#include "tiledmask.h"
+#include <cstring>
+#include <fstream>
+#include <glm/gtc/quaternion.hpp>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+Level::Level()
+    : _data(nullptr),
+      _size(0),
+      _mapping(nullptr),
+      _file(nullptr)
+{}
+
+Level::~Level()
+{
+    close();
+}
+
+bool Level::open(
+    std::string const &filename)
+{
+    close();
+
+#ifdef _WIN32
+    auto file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    auto mapping = GetFileSizeEx(file, &fileSize) ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+    auto view = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+    _file = file;
+    _mapping = mapping;
+
+    if (view == nullptr)
+    {
+        close();
+
+        return false;
+    }
+
+    _data = static_cast<unsigned char const *>(view);
+    _size = size_t(fileSize.QuadPart);
+#else
+    auto file = ::open(filename.c_str(), O_RDONLY);
+    if (file < 0)
+    {
+        return false;
+    }
+
+    struct stat info;
+    void *view = MAP_FAILED;
+    if (fstat(file, &info) == 0 && info.st_size > 0)
+    {
+        view = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    ::close(file);
+
+    if (view == MAP_FAILED)
+    {
+        return false;
+    }
+
+    _mapping = view;
+    _data = static_cast<unsigned char const *>(view);
+    _size = size_t(info.st_size);
+#endif
+
+    if (!validate())
+    {
+        std::cerr << filename << " is not a cooked level of version " << LEVEL_VERSION << std::endl;
+
+        close();
+
+        return false;
+    }
+
+    return true;
+}
+
+bool Level::cookImage(
+    std::string const &filename,
+    glm::vec2 const &planeSize)
+{
+    int x, y, comp;
+    auto pixels = stbi_load(filename.c_str(), &x, &y, &comp, 3);
+    if (pixels == nullptr)
+    {
+        return false;
+    }
+
+    // stbi_load converted the image to the 3 components that were asked for
+    auto result = cookPixels(pixels, glm::ivec2(x, y), 3, planeSize);
+
+    stbi_image_free(pixels);
+
+    return result;
+}
+
+bool Level::cookPixels(
+    unsigned char const *pixels,
+    glm::ivec2 const &size,
+    int comp,
+    glm::vec2 const &planeSize)
+{
+    close();
+
+    if (comp < 3 || comp > TiledMask::MAX_COMP)
+    {
+        return false;
+    }
+
+    // Red (road) and green (cleared) are packed into one byte, blue only places the trees
+    auto pixelCount = size_t(size.x) * size_t(size.y);
+    std::vector<unsigned char> packed(pixelCount);
+    for (size_t i = 0; i < pixelCount; i++)
+    {
+        packed[i] = packMaskPixel(pixels[i * size_t(comp)], pixels[(i * size_t(comp)) + 1]);
+    }
+
+    // The tiles are found the same way the game splits the mask, uniform tiles get no pixels
+    TiledMask mask;
+    mask.load(packed.data(), size, 1);
+
+    auto tileCount = size_t(mask.tileCount().x) * size_t(mask.tileCount().y);
+
+    std::vector<LevelTile> tiles(tileCount);
+    std::vector<unsigned char> tilePixels;
+    tilePixels.reserve(mask.allocatedBytes());
+
+    for (size_t i = 0; i < tileCount; i++)
+    {
+        auto &tile = mask.tile(int(i));
+
+        memcpy(tiles[i].uniform, tile.uniform, sizeof(tiles[i].uniform));
+        tiles[i].pixelOffset = LevelTile::UNIFORM;
+
+        if (!tile.isUniform())
+        {
+            tiles[i].pixelOffset = uint32_t(tilePixels.size());
+            tilePixels.insert(tilePixels.end(), tile.pixels.get(), tile.pixels.get() + mask.tileBytes());
+        }
+    }
+
+    // A tree stands on every pixel with blue in it
+    std::vector<LevelTree> trees;
+    for (int py = 0; py < size.y; ++py)
+    {
+        for (int px = 0; px < size.x; ++px)
+        {
+            auto pixelOffset = ((size_t(py) * size_t(size.x)) + size_t(px)) * size_t(comp);
+            if (pixels[pixelOffset + 2] > 1)
+            {
+                LevelTree tree;
+                tree.position[0] = (-planeSize.x / 2.0f) + (float(px) / float(size.x)) * planeSize.x;
+                tree.position[1] = (-planeSize.y / 2.0f) + (float(py) / float(size.y)) * planeSize.y;
+                trees.push_back(tree);
+            }
+        }
+    }
+
+    std::vector<LevelSpawnPoint> spawnPoints(1);
+    spawnPoints[0] = LevelSpawnPoint({{0.0f, 0.0f, 2.0f}, 0.0f});
+
+    std::vector<LevelCollider> colliders;
+    colliders.push_back(LevelCollider({
+        LevelColliderKind::Ground,
+        LevelColliderShape::Box,
+        {0.0f, 0.0f, 0.0f},
+        {0.0f, 0.0f, 0.0f, 1.0f},
+        {planeSize.x, planeSize.y, 0.1f},
+    }));
+
+    // Tree cones are modelled along y, so they are turned upright
+    auto treeRotation = glm::quat(glm::vec3(glm::radians(90.0f), 0.0f, 0.0f));
+    for (auto &tree : trees)
+    {
+        colliders.push_back(LevelCollider({
+            LevelColliderKind::Tree,
+            LevelColliderShape::Cone,
+            {tree.position[0], 2.2f, tree.position[1]},
+            {treeRotation.x, treeRotation.y, treeRotation.z, treeRotation.w},
+            {1.0f, 4.0f, 0.0f},
+        }));
+    }
+
+    LevelHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = LEVEL_MAGIC;
+    header.version = LEVEL_VERSION;
+    header.width = size.x;
+    header.height = size.y;
+    header.comp = 1;
+    header.tileSize = TiledMask::TILE_SIZE;
+    header.planeWidth = planeSize.x;
+    header.planeHeight = planeSize.y;
+
+    _cooked.assign(sizeof(LevelHeader), 0);
+
+    auto append = [&](LevelSection section, void const *data, size_t bytes) {
+        auto offset = (_cooked.size() + LEVEL_ALIGNMENT - 1) / LEVEL_ALIGNMENT * LEVEL_ALIGNMENT;
+
+        header.sections[uint32_t(section)].offset = offset;
+        header.sections[uint32_t(section)].size = bytes;
+
+        _cooked.resize(offset + bytes);
+        if (bytes > 0)
+        {
+            memcpy(_cooked.data() + offset, data, bytes);
+        }
+    };
+
+    append(LevelSection::Tiles, tiles.data(), tiles.size() * sizeof(LevelTile));
+    append(LevelSection::TilePixels, tilePixels.data(), tilePixels.size());
+    append(LevelSection::Trees, trees.data(), trees.size() * sizeof(LevelTree));
+    append(LevelSection::SpawnPoints, spawnPoints.data(), spawnPoints.size() * sizeof(LevelSpawnPoint));
+    append(LevelSection::Colliders, colliders.data(), colliders.size() * sizeof(LevelCollider));
+
+    // FNV-1a, computed once here so loading a level does not have to read all of its pixels
+    uint32_t hash = 2166136261u;
+    auto hashBytes = [&hash](unsigned char const *bytes, size_t count) {
+        for (size_t i = 0; i < count; i++)
+        {
+            hash = (hash ^ bytes[i]) * 16777619u;
+        }
+    };
+    hashBytes(reinterpret_cast<unsigned char const *>(tiles.data()), tiles.size() * sizeof(LevelTile));
+    hashBytes(tilePixels.data(), tilePixels.size());
+    header.maskHash = hash;
+
+    memcpy(_cooked.data(), &header, sizeof(header));
+
+    _data = _cooked.data();
+    _size = _cooked.size();
+
+    return true;
+}
+
+bool Level::write(
+    std::string const &filename) const
+{
+    if (!isOpen())
+    {
+        return false;
+    }
+
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<char const *>(_data), std::streamsize(_size));
+
+    return file.good();
+}
+
+void Level::close()
+{
+#ifdef _WIN32
+    if (_mapping != nullptr)
+    {
+        if (_data != nullptr)
+        {
+            UnmapViewOfFile(_data);
+        }
+        CloseHandle(_mapping);
+    }
+    if (_file != nullptr)
+    {
+        CloseHandle(_file);
+    }
+#else
+    if (_mapping != nullptr)
+    {
+        munmap(_mapping, _size);
+    }
+#endif
+
+    _mapping = nullptr;
+    _file = nullptr;
+    _data = nullptr;
+    _size = 0;
+    _cooked.clear();
+}
+
+bool Level::isOpen() const
+{
+    return _data != nullptr;
+}
+
+glm::ivec2 Level::size() const
+{
+    return glm::ivec2(header().width, header().height);
+}
+
+int Level::comp() const
+{
+    return header().comp;
+}
+
+int Level::tileSize() const
+{
+    return header().tileSize;
+}
+
+glm::vec2 Level::planeSize() const
+{
+    return glm::vec2(header().planeWidth, header().planeHeight);
+}
+
+uint32_t Level::maskHash() const
+{
+    return header().maskHash;
+}
+
+LevelTile const *Level::tiles() const
+{
+    return reinterpret_cast<LevelTile const *>(section(LevelSection::Tiles));
+}
+
+unsigned char const *Level::tilePixels(
+    LevelTile const &tile) const
+{
+    return section(LevelSection::TilePixels) + tile.pixelOffset;
+}
+
+LevelTree const *Level::trees() const
+{
+    return reinterpret_cast<LevelTree const *>(section(LevelSection::Trees));
+}
+
+size_t Level::treeCount() const
+{
+    return sectionCount(LevelSection::Trees, sizeof(LevelTree));
+}
+
+LevelSpawnPoint const *Level::spawnPoints() const
+{
+    return reinterpret_cast<LevelSpawnPoint const *>(section(LevelSection::SpawnPoints));
+}
+
+size_t Level::spawnPointCount() const
+{
+    return sectionCount(LevelSection::SpawnPoints, sizeof(LevelSpawnPoint));
+}
+
+LevelCollider const *Level::colliders() const
+{
+    return reinterpret_cast<LevelCollider const *>(section(LevelSection::Colliders));
+}
+
+size_t Level::colliderCount() const
+{
+    return sectionCount(LevelSection::Colliders, sizeof(LevelCollider));
+}
+
+LevelHeader const &Level::header() const
+{
+    return *reinterpret_cast<LevelHeader const *>(_data);
+}
+
+unsigned char const *Level::section(
+    LevelSection section) const
+{
+    return _data + header().sections[uint32_t(section)].offset;
+}
+
+size_t Level::sectionCount(
+    LevelSection section,
+    size_t elementSize) const
+{
+    return size_t(header().sections[uint32_t(section)].size) / elementSize;
+}
+
+bool Level::validate() const
+{
+    if (_size < sizeof(LevelHeader))
+    {
+        return false;
+    }
+
+    auto &h = header();
+
+    if (h.magic != LEVEL_MAGIC || h.version != LEVEL_VERSION)
+    {
+        return false;
+    }
+
+    if (h.width <= 0 || h.height <= 0 || h.comp != 1 || h.tileSize <= 0)
+    {
+        return false;
+    }
+
+    for (auto &entry : h.sections)
+    {
+        if (entry.offset % LEVEL_ALIGNMENT != 0 || entry.offset > _size || entry.size > _size - entry.offset)
+        {
+            return false;
+        }
+    }
+
+    auto tilesX = (size_t(h.width) + size_t(h.tileSize) - 1) / size_t(h.tileSize);
+    auto tilesY = (size_t(h.height) + size_t(h.tileSize) - 1) / size_t(h.tileSize);
+    auto tileCount = tilesX * tilesY;
+
+    if (sectionCount(LevelSection::Tiles, sizeof(LevelTile)) != tileCount)
+    {
+        return false;
+    }
+
+    // Only the tile table is checked, the pixels themselves are not touched
+    auto tileBytes = size_t(h.tileSize) * size_t(h.tileSize) * size_t(h.comp);
+    auto pixelBytes = size_t(h.sections[uint32_t(LevelSection::TilePixels)].size);
+    auto tileTable = tiles();
+
+    for (size_t i = 0; i < tileCount; i++)
+    {
+        auto offset = tileTable[i].pixelOffset;
+        if (offset != LevelTile::UNIFORM && (size_t(offset) > pixelBytes || tileBytes > pixelBytes - size_t(offset)))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
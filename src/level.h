@@ -0,0 +1,99 @@
+#ifndef LEVEL_H
+#define LEVEL_H
+
+#include "levelformat.h"
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+// A cooked level. Either memory mapped from a file written by the cook tool, or
+// cooked in memory from the authoring image with the same code.
+class Level
+{
+public:
+    Level();
+
+    virtual ~Level();
+
+    Level(
+        Level const &) = delete;
+
+    Level &operator=(
+        Level const &) = delete;
+
+    // Maps a cooked level file, nothing is decoded or copied
+    bool open(
+        std::string const &filename);
+
+    // Cooks the level image (red road, green cleared snow, blue trees) without writing a file
+    bool cookImage(
+        std::string const &filename,
+        glm::vec2 const &planeSize);
+
+    bool cookPixels(
+        unsigned char const *pixels,
+        glm::ivec2 const &size,
+        int comp,
+        glm::vec2 const &planeSize);
+
+    bool write(
+        std::string const &filename) const;
+
+    void close();
+
+    bool isOpen() const;
+
+    glm::ivec2 size() const;
+
+    int comp() const;
+
+    int tileSize() const;
+
+    glm::vec2 planeSize() const;
+
+    // Hash of the mask tiles and their pixels, it changes whenever the mask is cooked differently
+    uint32_t maskHash() const;
+
+    LevelTile const *tiles() const;
+
+    // Packed mask pixels of a tile that is not uniform, tileSize * tileSize * comp bytes
+    unsigned char const *tilePixels(
+        LevelTile const &tile) const;
+
+    LevelTree const *trees() const;
+
+    size_t treeCount() const;
+
+    LevelSpawnPoint const *spawnPoints() const;
+
+    size_t spawnPointCount() const;
+
+    LevelCollider const *colliders() const;
+
+    size_t colliderCount() const;
+
+private:
+    unsigned char const *_data;
+    size_t _size;
+
+    // Storage of a level cooked in memory
+    std::vector<unsigned char> _cooked;
+
+    // Mapping of an opened file
+    void *_mapping;
+    void *_file;
+
+    LevelHeader const &header() const;
+
+    unsigned char const *section(
+        LevelSection section) const;
+
+    size_t sectionCount(
+        LevelSection section,
+        size_t elementSize) const;
+
+    bool validate() const;
+};
+
+#endif // LEVEL_H
@@ -0,0 +1,111 @@
+#ifndef LEVELFORMAT_H
+#define LEVELFORMAT_H
+
+#include <cstdint>
+
+// Layout of a cooked level file. Everything is little endian and every section
+// starts at a multiple of LEVEL_ALIGNMENT, so the file can be used straight from
+// a memory mapping. Bump LEVEL_VERSION whenever one of these structs changes.
+
+const uint32_t LEVEL_MAGIC = 0x564c4a53; // "SJLV"
+const uint32_t LEVEL_VERSION = 3;
+const uint32_t LEVEL_ALIGNMENT = 16;
+
+// Mask pixels are a single byte. The top bits hold how much road there is, the bottom
+// bits how far the snow is cleared, from 0 (all snow) to MASK_CLEARED (plowed clean).
+const uint8_t MASK_ROAD_SHIFT = 5;
+const uint8_t MASK_ROAD = 0xe0;
+const uint8_t MASK_CLEARED = 0x1f;
+
+inline uint8_t packMaskPixel(
+    uint8_t road,
+    uint8_t cleared)
+{
+    return uint8_t((road & MASK_ROAD) | (((int(cleared) * MASK_CLEARED) + 127) / 255));
+}
+
+enum class LevelSection : uint32_t
+{
+    Tiles,
+    TilePixels,
+    Trees,
+    SpawnPoints,
+    Colliders,
+    Count,
+};
+
+struct LevelSectionEntry
+{
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct LevelHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    int32_t comp;
+    int32_t tileSize;
+    float planeWidth;
+    float planeHeight;
+
+    // FNV-1a over the Tiles and TilePixels sections, a save only fits the mask it was made on
+    uint32_t maskHash;
+    uint32_t reserved;
+
+    LevelSectionEntry sections[uint32_t(LevelSection::Count)];
+};
+
+// One per mask tile, row by row. Uniform tiles have no pixels in the TilePixels section,
+// only uniform[0] is used now that the mask has one byte per pixel.
+struct LevelTile
+{
+    static const uint32_t UNIFORM = 0xffffffff;
+
+    uint8_t uniform[4];
+    uint32_t pixelOffset;
+};
+
+// Tree position on the ground plane in meters
+struct LevelTree
+{
+    float position[2];
+};
+
+struct LevelSpawnPoint
+{
+    float position[3];
+    float heading;
+};
+
+enum class LevelColliderKind : uint32_t
+{
+    Ground,
+    Tree,
+};
+
+enum class LevelColliderShape : uint32_t
+{
+    Box,
+    Cone,
+};
+
+// Static collision objects, size holds the box size or the cone radius and height
+struct LevelCollider
+{
+    LevelColliderKind kind;
+    LevelColliderShape shape;
+    float position[3];
+    float rotation[4];
+    float size[3];
+};
+
+static_assert(sizeof(LevelHeader) == 40 + (16 * uint32_t(LevelSection::Count)), "LevelHeader layout changed");
+static_assert(sizeof(LevelTile) == 8, "LevelTile layout changed");
+static_assert(sizeof(LevelTree) == 8, "LevelTree layout changed");
+static_assert(sizeof(LevelSpawnPoint) == 16, "LevelSpawnPoint layout changed");
+static_assert(sizeof(LevelCollider) == 48, "LevelCollider layout changed");
+
+#endif // LEVELFORMAT_H
@@ -0,0 +1,521 @@
+#include "masksave.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+// Layout of a save file, little endian like the cooked level. The header is followed
+// by one record per tile that differs from the level.
+
+static const uint32_t SAVE_MAGIC = 0x4d534a53; // "SJSM"
+static const uint32_t SAVE_VERSION = 2;
+
+struct SaveHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t levelHash;
+    int32_t width;
+    int32_t height;
+    int32_t comp;
+    int32_t tileSize;
+    uint32_t recordCount;
+};
+
+// A size of zero means the tile is uniform with the given value, otherwise size bytes of
+// (run length - 1, xor value) pairs follow, one channel plane after the other
+struct SaveRecord
+{
+    uint32_t index;
+    uint32_t size;
+    uint8_t uniform[4];
+};
+
+static_assert(sizeof(SaveHeader) == 32, "SaveHeader layout changed");
+static_assert(sizeof(SaveRecord) == 12, "SaveRecord layout changed");
+
+MaskSave::MaskSave()
+    : _level(nullptr),
+      _levelHash(0),
+      _comp(0),
+      _tileBytes(0),
+      _busy(false),
+      _quit(false),
+      _savedTiles(0),
+      _lastSaveBytes(0),
+      _lastSaveMilliseconds(0.0f)
+{}
+
+MaskSave::~MaskSave()
+{
+    // A save that was handed to the thread is still written
+    wait();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+
+    _wake.notify_all();
+
+    if (_thread.joinable())
+    {
+        _thread.join();
+    }
+}
+
+void MaskSave::begin(
+    Level const &level)
+{
+    wait();
+
+    _level = &level;
+    _levelHash = level.maskHash();
+    _comp = level.comp();
+    _tileBytes = size_t(level.tileSize()) * size_t(level.tileSize()) * size_t(_comp);
+
+    auto tileCount = size_t((level.size().x + level.tileSize() - 1) / level.tileSize()) *
+                     size_t((level.size().y + level.tileSize() - 1) / level.tileSize());
+
+    _changed.assign(tileCount, 0);
+    _changedTiles.clear();
+    _records.assign(tileCount, std::vector<unsigned char>());
+    _savedTiles = 0;
+}
+
+void MaskSave::markTile(
+    int index)
+{
+    if (size_t(index) >= _changed.size() || _changed[size_t(index)])
+    {
+        return;
+    }
+
+    _changed[size_t(index)] = 1;
+    _changedTiles.push_back(index);
+}
+
+void MaskSave::markAllTiles()
+{
+    for (int i = 0; i < int(_changed.size()); i++)
+    {
+        markTile(i);
+    }
+}
+
+bool MaskSave::load(
+    std::string const &filename,
+    TiledMask &mask)
+{
+    if (_level == nullptr)
+    {
+        return false;
+    }
+
+    std::ifstream file(filename, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+
+    std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    SaveHeader header;
+    if (data.size() < sizeof(header))
+    {
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+
+    // A save of another level, or of this level before it was cooked again, is ignored
+    if (header.magic != SAVE_MAGIC || header.version != SAVE_VERSION || header.levelHash != _levelHash ||
+        header.width != mask.size().x || header.height != mask.size().y ||
+        header.comp != mask.comp() || header.tileSize != TiledMask::TILE_SIZE)
+    {
+        std::cerr << filename << " does not belong to this level" << std::endl;
+
+        return false;
+    }
+
+    // Every record is checked before the first one is applied, a broken file leaves the mask alone
+    std::vector<size_t> offsets;
+    size_t offset = sizeof(header);
+    for (uint32_t i = 0; i < header.recordCount; i++)
+    {
+        SaveRecord record;
+        if (data.size() - offset < sizeof(record))
+        {
+            return false;
+        }
+        memcpy(&record, data.data() + offset, sizeof(record));
+
+        auto recordBytes = sizeof(record) + size_t(record.size);
+        if (record.index >= _records.size() || data.size() - offset < recordBytes ||
+            !checkRuns(data.data() + offset + sizeof(record), size_t(record.size)))
+        {
+            return false;
+        }
+
+        offsets.push_back(offset);
+        offset += recordBytes;
+    }
+
+    wait();
+
+    for (auto recordOffset : offsets)
+    {
+        SaveRecord record;
+        memcpy(&record, data.data() + recordOffset, sizeof(record));
+
+        auto recordData = data.data() + recordOffset;
+        decodeTile(recordData, mask);
+
+        // The record stays valid until the tile changes again
+        _records[record.index].assign(recordData, recordData + sizeof(record) + size_t(record.size));
+    }
+
+    _savedTiles = header.recordCount;
+
+    return true;
+}
+
+bool MaskSave::save(
+    std::string const &filename,
+    TiledMask const &mask)
+{
+    if (_level == nullptr || busy())
+    {
+        return false;
+    }
+
+    // Only the tiles that changed are copied, the rest of the file comes from earlier records
+    _pending.clear();
+    _pendingPixels.clear();
+
+    for (auto index : _changedTiles)
+    {
+        auto &tile = mask.tile(index);
+
+        PendingTile pending;
+        pending.index = index;
+        memcpy(pending.uniform, tile.uniform, sizeof(pending.uniform));
+        pending.pixelOffset = _pendingPixels.size();
+        pending.isUniform = tile.isUniform();
+
+        if (!tile.isUniform())
+        {
+            _pendingPixels.insert(_pendingPixels.end(), tile.pixels.get(), tile.pixels.get() + _tileBytes);
+        }
+
+        _pending.push_back(pending);
+        _changed[size_t(index)] = 0;
+    }
+    _changedTiles.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _filename = filename;
+        _busy = true;
+
+        if (!_thread.joinable())
+        {
+            _thread = std::thread(&MaskSave::threadLoop, this);
+        }
+    }
+
+    _wake.notify_one();
+
+    return true;
+}
+
+void MaskSave::wait()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this]() { return !_busy; });
+}
+
+bool MaskSave::busy() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    return _busy;
+}
+
+size_t MaskSave::savedTiles() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    return _savedTiles;
+}
+
+size_t MaskSave::lastSaveBytes() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    return _lastSaveBytes;
+}
+
+float MaskSave::lastSaveMilliseconds() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    return _lastSaveMilliseconds;
+}
+
+void MaskSave::threadLoop()
+{
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [this]() { return _quit || _busy; });
+
+            if (_quit)
+            {
+                return;
+            }
+        }
+
+        writeSave();
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _busy = false;
+        }
+
+        _done.notify_all();
+    }
+}
+
+void MaskSave::writeSave()
+{
+    auto start = std::chrono::steady_clock::now();
+
+    for (auto &tile : _pending)
+    {
+        encodeTile(tile, _records[size_t(tile.index)]);
+    }
+
+    SaveHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SAVE_MAGIC;
+    header.version = SAVE_VERSION;
+    header.levelHash = _levelHash;
+    header.width = _level->size().x;
+    header.height = _level->size().y;
+    header.comp = _comp;
+    header.tileSize = _level->tileSize();
+
+    size_t bytes = sizeof(header);
+    for (auto &record : _records)
+    {
+        header.recordCount += record.empty() ? 0 : 1;
+        bytes += record.size();
+    }
+
+    // Written next to the old save and renamed, so a crash while writing keeps the previous one
+    auto temporary = _filename + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+
+        for (auto &record : _records)
+        {
+            if (!record.empty())
+            {
+                file.write(reinterpret_cast<char const *>(record.data()), std::streamsize(record.size()));
+            }
+        }
+
+        if (!file.good())
+        {
+            std::cerr << "could not write " << temporary << std::endl;
+
+            return;
+        }
+    }
+
+    // Windows does not rename over an existing file
+    std::remove(_filename.c_str());
+    if (std::rename(temporary.c_str(), _filename.c_str()) != 0)
+    {
+        std::cerr << "could not replace " << _filename << std::endl;
+
+        return;
+    }
+
+    auto elapsed = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _savedTiles = header.recordCount;
+    _lastSaveBytes = bytes;
+    _lastSaveMilliseconds = elapsed.count();
+}
+
+void MaskSave::encodeTile(
+    PendingTile const &tile,
+    std::vector<unsigned char> &record) const
+{
+    record.clear();
+
+    auto &levelTile = _level->tiles()[tile.index];
+    auto levelIsUniform = levelTile.pixelOffset == LevelTile::UNIFORM;
+
+    SaveRecord header;
+    header.index = uint32_t(tile.index);
+    header.size = 0;
+    memcpy(header.uniform, tile.uniform, sizeof(header.uniform));
+
+    if (tile.isUniform)
+    {
+        if (levelIsUniform && memcmp(levelTile.uniform, tile.uniform, size_t(_comp)) == 0)
+        {
+            return;
+        }
+
+        record.resize(sizeof(header));
+        memcpy(record.data(), &header, sizeof(header));
+
+        return;
+    }
+
+    std::vector<unsigned char> scratch;
+    auto original = levelPixels(tile.index, scratch);
+    auto pixels = _pendingPixels.data() + tile.pixelOffset;
+    auto pixelCount = _tileBytes / size_t(_comp);
+
+    record.resize(sizeof(header));
+
+    // Plowing and snowfall only touch the cleared bits, the xor is long runs of the same value
+    bool differs = false;
+    for (size_t c = 0; c < size_t(_comp); c++)
+    {
+        size_t p = 0;
+        while (p < pixelCount)
+        {
+            auto value = static_cast<unsigned char>(pixels[(p * size_t(_comp)) + c] ^ original[(p * size_t(_comp)) + c]);
+
+            size_t run = 1;
+            while (run < 256 && p + run < pixelCount &&
+                   static_cast<unsigned char>(pixels[((p + run) * size_t(_comp)) + c] ^ original[((p + run) * size_t(_comp)) + c]) == value)
+            {
+                run++;
+            }
+
+            record.push_back(static_cast<unsigned char>(run - 1));
+            record.push_back(value);
+
+            differs |= value != 0;
+            p += run;
+        }
+    }
+
+    if (!differs)
+    {
+        record.clear();
+
+        return;
+    }
+
+    header.size = uint32_t(record.size() - sizeof(header));
+    memcpy(record.data(), &header, sizeof(header));
+}
+
+bool MaskSave::checkRuns(
+    unsigned char const *runs,
+    size_t size) const
+{
+    // A uniform record has no runs
+    if (size == 0)
+    {
+        return true;
+    }
+
+    auto pixelCount = _tileBytes / size_t(_comp);
+    auto end = runs + size;
+
+    for (size_t c = 0; c < size_t(_comp); c++)
+    {
+        size_t p = 0;
+        while (p < pixelCount)
+        {
+            if (end - runs < 2)
+            {
+                return false;
+            }
+
+            p += size_t(runs[0]) + 1;
+            runs += 2;
+        }
+
+        if (p != pixelCount)
+        {
+            return false;
+        }
+    }
+
+    return runs == end;
+}
+
+void MaskSave::decodeTile(
+    unsigned char const *record,
+    TiledMask &mask) const
+{
+    SaveRecord header;
+    memcpy(&header, record, sizeof(header));
+
+    auto index = int(header.index);
+
+    // The mask still holds the level here, so the xor is applied in place
+    auto pixels = mask.materialize(index);
+
+    if (header.size == 0)
+    {
+        for (size_t i = 0; i < _tileBytes; i += size_t(_comp))
+        {
+            memcpy(pixels + i, header.uniform, size_t(_comp));
+        }
+        mask.tryCollapse(index);
+
+        return;
+    }
+
+    auto pixelCount = _tileBytes / size_t(_comp);
+    auto runs = record + sizeof(header);
+
+    for (size_t c = 0; c < size_t(_comp); c++)
+    {
+        for (size_t p = 0; p < pixelCount; runs += 2)
+        {
+            auto end = p + size_t(runs[0]) + 1;
+            for (; p < end; p++)
+            {
+                pixels[(p * size_t(_comp)) + c] ^= runs[1];
+            }
+        }
+    }
+
+    mask.tryCollapse(index);
+}
+
+unsigned char const *MaskSave::levelPixels(
+    int index,
+    std::vector<unsigned char> &scratch) const
+{
+    auto &levelTile = _level->tiles()[index];
+    if (levelTile.pixelOffset != LevelTile::UNIFORM)
+    {
+        return _level->tilePixels(levelTile);
+    }
+
+    scratch.resize(_tileBytes);
+    for (size_t i = 0; i < _tileBytes; i += size_t(_comp))
+    {
+        memcpy(scratch.data() + i, levelTile.uniform, size_t(_comp));
+    }
+
+    return scratch.data();
+}
@@ -0,0 +1,122 @@
+#ifndef MASKSAVE_H
+#define MASKSAVE_H
+
+#include "level.h"
+#include "tiledmask.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Keeps the plowed mask on disk as the difference with the pristine level. Only tiles
+// that differ from the level end up in the file, each as a uniform value or as run length
+// encoded channel planes of the xor with the level pixels. Tiles are encoded again only
+// when they changed since the previous save, the encoding and writing run on a thread.
+class MaskSave
+{
+public:
+    MaskSave();
+
+    virtual ~MaskSave();
+
+    MaskSave(
+        MaskSave const &) = delete;
+
+    MaskSave &operator=(
+        MaskSave const &) = delete;
+
+    // The level is the pristine state the tiles are compared to, it has to stay open
+    void begin(
+        Level const &level);
+
+    // Call for every tile that changed, it is encoded again with the next save
+    void markTile(
+        int index);
+
+    void markAllTiles();
+
+    // Applies a save file written for the same level to a mask loaded from that level
+    bool load(
+        std::string const &filename,
+        TiledMask &mask);
+
+    // Copies the changed tiles and writes the file on the save thread, returns false
+    // without doing anything while the previous save is still being written
+    bool save(
+        std::string const &filename,
+        TiledMask const &mask);
+
+    // Blocks until the save that is being written is done
+    void wait();
+
+    bool busy() const;
+
+    // Tiles that differ from the level in the last written file
+    size_t savedTiles() const;
+
+    size_t lastSaveBytes() const;
+
+    float lastSaveMilliseconds() const;
+
+private:
+    struct PendingTile
+    {
+        int index;
+        unsigned char uniform[TiledMask::MAX_COMP];
+        size_t pixelOffset;
+        bool isUniform;
+    };
+
+    Level const *_level;
+    uint32_t _levelHash;
+    int _comp;
+    size_t _tileBytes;
+
+    // Tiles changed since they were last handed to the save thread
+    std::vector<unsigned char> _changed;
+    std::vector<int> _changedTiles;
+
+    // Owned by the save thread while a save is in progress
+    std::vector<PendingTile> _pending;
+    std::vector<unsigned char> _pendingPixels;
+    std::vector<std::vector<unsigned char>> _records;
+    std::string _filename;
+
+    std::thread _thread;
+    mutable std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    bool _busy;
+    bool _quit;
+
+    size_t _savedTiles;
+    size_t _lastSaveBytes;
+    float _lastSaveMilliseconds;
+
+    void threadLoop();
+
+    void writeSave();
+
+    // Fills record with the difference between the tile and the level, leaves it empty when there is none
+    void encodeTile(
+        PendingTile const &tile,
+        std::vector<unsigned char> &record) const;
+
+    // Checks that the runs of a record cover every channel plane exactly
+    bool checkRuns(
+        unsigned char const *runs,
+        size_t size) const;
+
+    void decodeTile(
+        unsigned char const *record,
+        TiledMask &mask) const;
+
+    // Pixels of the tile in the level, uniform level tiles are expanded into scratch
+    unsigned char const *levelPixels(
+        int index,
+        std::vector<unsigned char> &scratch) const;
+};
+
+#endif // MASKSAVE_H
@@ -0,0 +1,146 @@
+#include "maskstatistics.h"
+
+MaskStatistics::MaskStatistics()
+    : _roadPixels(0),
+      _grassPixels(0),
+      _roadCleared(0),
+      _grassCleared(0)
+{}
+
+void MaskStatistics::reset(
+    TiledMask const &mask)
+{
+    auto tileCount = size_t(mask.tileCount().x) * size_t(mask.tileCount().y);
+
+    _tiles.assign(tileCount, TileCounts());
+    _roadPixels = 0;
+    _roadCleared = 0;
+    _grassCleared = 0;
+
+    for (size_t i = 0; i < tileCount; i++)
+    {
+        auto &counts = _tiles[i];
+
+        count(mask, int(i), counts);
+
+        _roadPixels += size_t(counts.roadPixels);
+        _roadCleared += counts.roadCleared;
+        _grassCleared += counts.grassCleared;
+    }
+
+    _grassPixels = (size_t(mask.size().x) * size_t(mask.size().y)) - _roadPixels;
+}
+
+void MaskStatistics::recountTile(
+    TiledMask const &mask,
+    int index)
+{
+    auto &counts = _tiles[size_t(index)];
+
+    _roadCleared -= counts.roadCleared;
+    _grassCleared -= counts.grassCleared;
+
+    count(mask, index, counts);
+
+    _roadCleared += counts.roadCleared;
+    _grassCleared += counts.grassCleared;
+}
+
+void MaskStatistics::add(
+    int index,
+    int road,
+    int grass)
+{
+    auto &counts = _tiles[size_t(index)];
+
+    counts.roadCleared += road;
+    counts.grassCleared += grass;
+
+    _roadCleared += road;
+    _grassCleared += grass;
+}
+
+size_t MaskStatistics::roadPixels() const
+{
+    return _roadPixels;
+}
+
+size_t MaskStatistics::roadCleared() const
+{
+    return size_t(_roadCleared);
+}
+
+size_t MaskStatistics::grassPixels() const
+{
+    return _grassPixels;
+}
+
+size_t MaskStatistics::grassCleared() const
+{
+    return size_t(_grassCleared);
+}
+
+float MaskStatistics::roadClearedPercentage() const
+{
+    if (_roadPixels == 0)
+    {
+        return 0.0f;
+    }
+
+    return 100.0f * float(_roadCleared) / float(_roadPixels);
+}
+
+float MaskStatistics::clearedPercentage() const
+{
+    auto total = _roadPixels + _grassPixels;
+
+    if (total == 0)
+    {
+        return 0.0f;
+    }
+
+    return 100.0f * float(_roadCleared + _grassCleared) / float(total);
+}
+
+void MaskStatistics::count(
+    TiledMask const &mask,
+    int index,
+    TileCounts &counts) const
+{
+    auto &tile = mask.tile(index);
+    auto extent = mask.tileExtent(index);
+
+    counts = TileCounts();
+
+    if (tile.isUniform())
+    {
+        auto pixels = extent.x * extent.y;
+
+        if (isRoad(tile.uniform))
+        {
+            counts.roadPixels = pixels;
+            counts.roadCleared = isCleared(tile.uniform) ? pixels : 0;
+        }
+        else
+        {
+            counts.grassCleared = isCleared(tile.uniform) ? pixels : 0;
+        }
+
+        return;
+    }
+
+    for (int y = 0; y < extent.y; y++)
+    {
+        auto pixel = tile.pixels.get() + (size_t(y) * size_t(TiledMask::TILE_SIZE));
+
+        for (int x = 0; x < extent.x; x++, pixel++)
+        {
+            auto road = isRoad(pixel);
+            auto cleared = isCleared(pixel);
+
+            counts.roadPixels += road ? 1 : 0;
+            counts.roadCleared += (road && cleared) ? 1 : 0;
+            counts.grassCleared += (!road && cleared) ? 1 : 0;
+        }
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef MASKSTATISTICS_H
+#define MASKSTATISTICS_H
+
+#include "levelformat.h"
+#include "tiledmask.h"
+
+#include <vector>
+
+// Counts cleared pixels per tile, split by what is under the snow. The counters are
+// kept up to date with the changes the plow and the snowfall report, so the totals
+// never need a scan of the mask.
+class MaskStatistics
+{
+public:
+    // A pixel with a road level above this is road, the level is 0 to 7
+    static const unsigned char ROAD_THRESHOLD = 3;
+
+    // A pixel cleared more than this counts as cleared, up to MASK_CLEARED
+    static const unsigned char CLEARED_THRESHOLD = 15;
+
+    MaskStatistics();
+
+    // Counts road pixels and cleared pixels of every tile, after the whole mask was replaced
+    void reset(
+        TiledMask const &mask);
+
+    // Counts the cleared pixels of one tile again, when it changed without reporting what changed
+    void recountTile(
+        TiledMask const &mask,
+        int index);
+
+    // Pixels that changed from snow to cleared (positive) or back (negative)
+    void add(
+        int index,
+        int road,
+        int grass);
+
+    size_t roadPixels() const;
+
+    size_t roadCleared() const;
+
+    size_t grassPixels() const;
+
+    size_t grassCleared() const;
+
+    float roadClearedPercentage() const;
+
+    float clearedPercentage() const;
+
+    static bool isRoad(
+        unsigned char const *pixel)
+    {
+        return (pixel[0] >> MASK_ROAD_SHIFT) > ROAD_THRESHOLD;
+    }
+
+    static bool isCleared(
+        unsigned char const *pixel)
+    {
+        return (pixel[0] & MASK_CLEARED) > CLEARED_THRESHOLD;
+    }
+
+private:
+    struct TileCounts
+    {
+        int roadPixels = 0;
+        int roadCleared = 0;
+        int grassCleared = 0;
+    };
+
+    std::vector<TileCounts> _tiles;
+    size_t _roadPixels;
+    size_t _grassPixels;
+    long long _roadCleared;
+    long long _grassCleared;
+
+    void count(
+        TiledMask const &mask,
+        int index,
+        TileCounts &counts) const;
+};
+
+#endif // MASKSTATISTICS_H
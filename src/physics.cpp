@@ -1,4 +1,5 @@
 #include "physics.h"
+#include <algorithm>
 #include <glm/gtc/type_ptr.hpp>
 #include <iostream>
 #include <vector>
@@ -92,6 +93,7 @@ void PhysicsManager::AddObject(
     }
 
     _dynamicsWorld->addRigidBody(obj->getRigidBody(), group, mask);
+    _objects.push_back(obj);
 }
 
 void PhysicsManager::RemoveObject(
@@ -103,4 +105,45 @@ void PhysicsManager::RemoveObject(
     }
 
     _dynamicsWorld->removeCollisionObject(obj->getRigidBody());
+
+    auto found = std::find(_objects.begin(), _objects.end(), obj);
+    if (found != _objects.end())
+    {
+        _objects.erase(found);
+    }
+}
+
+void PhysicsManager::TakeSnapshot(
+    PhysicsSnapshot &snapshot) const
+{
+    snapshot.objects.resize(_objects.size());
+
+    for (size_t i = 0; i < _objects.size(); i++)
+    {
+        _objects[i]->saveState(snapshot.objects[i]);
+    }
+}
+
+void PhysicsManager::RestoreSnapshot(
+    PhysicsSnapshot const &snapshot)
+{
+    // Objects added after the snapshot was taken are left alone
+    auto count = std::min(_objects.size(), snapshot.objects.size());
+
+    for (size_t i = 0; i < count; i++)
+    {
+        _objects[i]->restoreState(snapshot.objects[i]);
+
+        auto body = _objects[i]->getRigidBody();
+        if (body->isStaticObject())
+        {
+            continue;
+        }
+
+        // Drop cached contacts so no impulses from before the reset are applied
+        _dynamicsWorld->getBroadphase()->getOverlappingPairCache()->cleanProxyFromPairs(body->getBroadphaseHandle(), _dispatcher);
+        body->activate(true);
+    }
+
+    _dynamicsWorld->updateAabbs();
 }
@@ -15,6 +15,13 @@
 
 #include "physicsobject.h"
 
+#include <vector>
+
+struct PhysicsSnapshot
+{
+    std::vector<PhysicsObjectState> objects;
+};
+
 class PhysicsManager
 {
 public:
@@ -28,6 +35,13 @@ public:
         glm::mat4 const &proj,
         glm::mat4 const &view);
 
+    void SetDebugDrawCulling(
+        bool enabled);
+
+    size_t DebugDrawLineCount() const;
+
+    size_t DebugDrawCulledLineCount() const;
+
     void Step(
         float gameTime);
 
@@ -39,6 +53,14 @@ public:
     void RemoveObject(
         PhysicsObject *obj);
 
+    // Captures the state of all added objects, the snapshot can be reused to avoid allocations
+    void TakeSnapshot(
+        PhysicsSnapshot &snapshot) const;
+
+    // Puts all objects back in the state of the snapshot without re-creating bodies or shapes
+    void RestoreSnapshot(
+        PhysicsSnapshot const &snapshot);
+
 private:
     friend class PhysicsObjectBuilder;
     btBroadphaseInterface *_broadphase = nullptr;
@@ -46,6 +68,7 @@ private:
     btCollisionDispatcher *_dispatcher = nullptr;
     btSequentialImpulseConstraintSolver *_solver = nullptr;
     btDiscreteDynamicsWorld *_dynamicsWorld = nullptr;
+    std::vector<PhysicsObject *> _objects;
 
     static struct Config
     {
@@ -1,5 +1,6 @@
 #include "physics.h"
 #include <LinearMath/btIDebugDraw.h>
+#include <frustum.h>
 #include <gl-color-position-vertex.h>
 #include <iostream>
 
@@ -11,10 +12,20 @@ public:
 
     void init();
 
-    void render(
+    void setFrustum(
         glm::mat4 const &proj,
         glm::mat4 const &view);
 
+    void setFrustumCulling(
+        bool enabled);
+
+    // Draws with the camera that is bound for the frame
+    void render();
+
+    size_t lineCount() const;
+
+    size_t culledLineCount() const;
+
     virtual void clearLines();
 
     virtual void drawLine(
@@ -56,12 +67,17 @@ public:
 
 private:
     int _debugMode;
+    bool _frustumCulling;
+    size_t _culledLines;
+    Frustum _frustum;
     ColorPosition::ShaderType _shader;
-    ColorPosition::BufferType _buffer;
+    ColorPosition::StreamingBufferType _buffer;
 };
 
 DebugDrawer::DebugDrawer()
     : _debugMode(btIDebugDraw::DBG_DrawWireframe + btIDebugDraw::DBG_DrawConstraints + btIDebugDraw::DBG_DrawNormals),
+      _frustumCulling(true),
+      _culledLines(0),
       _buffer(_shader)
 {
     _buffer.setDrawMode(GL_LINES);
@@ -69,33 +85,63 @@ DebugDrawer::DebugDrawer()
 
 void DebugDrawer::clearLines()
 {
-    _buffer.cleanup();
+    _buffer.clear();
+    _culledLines = 0;
 }
 
 void DebugDrawer::init()
 {
     _shader.compileDefaultShader();
+    _buffer.setup();
 }
 
-void DebugDrawer::render(
+void DebugDrawer::setFrustum(
     glm::mat4 const &proj,
     glm::mat4 const &view)
 {
-    _buffer.setup();
+    _frustum.update(proj * view);
+}
+
+void DebugDrawer::setFrustumCulling(
+    bool enabled)
+{
+    _frustumCulling = enabled;
+}
+
+void DebugDrawer::render()
+{
+    _buffer.upload();
 
     _shader.use();
-    _shader.setupMatrices(proj, view, glm::mat4(1.0f));
+    _shader.setupModel(glm::mat4(1.0f));
     _buffer.render();
 }
 
+size_t DebugDrawer::lineCount() const
+{
+    return _buffer.vertexCount() / 2;
+}
+
+size_t DebugDrawer::culledLineCount() const
+{
+    return _culledLines;
+}
+
 void DebugDrawer::drawLine(
     const btVector3 &from,
     const btVector3 &to,
     const btVector3 &color)
 {
-    _buffer.color(glm::vec4(color.x(), color.y(), color.z(), 1.0f));
-    _buffer.vertex(glm::vec3(from.x(), from.y(), from.z()));
-    _buffer.vertex(glm::vec3(to.x(), to.y(), to.z()));
+    glm::vec3 a(from.x(), from.y(), from.z());
+    glm::vec3 b(to.x(), to.y(), to.z());
+
+    if (_frustumCulling && _frustum.isSegmentOutside(a, b))
+    {
+        _culledLines++;
+        return;
+    }
+
+    _buffer.line(a, b, ColorPosition::packColor(glm::vec4(color.x(), color.y(), color.z(), 1.0f)));
 }
 
 void DebugDrawer::drawContactPoint(
@@ -127,7 +173,27 @@ void PhysicsManager::DebugDraw(
     glm::mat4 const &view)
 {
     _drawer->clearLines();
+    _drawer->setFrustum(proj, view);
     _dynamicsWorld->debugDrawWorld();
 
-    _drawer->render(proj, view);
+    _drawer->render();
+}
+
+void PhysicsManager::SetDebugDrawCulling(
+    bool enabled)
+{
+    if (_drawer != nullptr)
+    {
+        _drawer->setFrustumCulling(enabled);
+    }
+}
+
+size_t PhysicsManager::DebugDrawLineCount() const
+{
+    return _drawer != nullptr ? _drawer->lineCount() : 0;
+}
+
+size_t PhysicsManager::DebugDrawCulledLineCount() const
+{
+    return _drawer != nullptr ? _drawer->culledLineCount() : 0;
 }
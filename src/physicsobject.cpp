@@ -26,6 +26,12 @@ public:
     virtual glm::mat4 const &getMatrix() const override;
 
     virtual class btRigidBody *getRigidBody() override;
+
+    virtual void saveState(
+        PhysicsObjectState &state) const override;
+
+    virtual void restoreState(
+        PhysicsObjectState const &state) override;
 };
 
 void ImplPhysicsObject::getWorldTransform(
@@ -50,6 +56,39 @@ btRigidBody *ImplPhysicsObject::getRigidBody()
     return _rigidBody;
 }
 
+void ImplPhysicsObject::saveState(
+    PhysicsObjectState &state) const
+{
+    _rigidBody->getWorldTransform().getOpenGLMatrix(glm::value_ptr(state.matrix));
+
+    auto &linearVelocity = _rigidBody->getLinearVelocity();
+    state.linearVelocity = glm::vec3(linearVelocity.x(), linearVelocity.y(), linearVelocity.z());
+
+    auto &angularVelocity = _rigidBody->getAngularVelocity();
+    state.angularVelocity = glm::vec3(angularVelocity.x(), angularVelocity.y(), angularVelocity.z());
+}
+
+void ImplPhysicsObject::restoreState(
+    PhysicsObjectState const &state)
+{
+    btTransform transform;
+    transform.setFromOpenGLMatrix(glm::value_ptr(state.matrix));
+
+    btVector3 linearVelocity(state.linearVelocity.x, state.linearVelocity.y, state.linearVelocity.z);
+    btVector3 angularVelocity(state.angularVelocity.x, state.angularVelocity.y, state.angularVelocity.z);
+
+    // Overwrite the body in place, the shape and broadphase proxy are kept as they are
+    _rigidBody->setWorldTransform(transform);
+    _rigidBody->setInterpolationWorldTransform(transform);
+    _rigidBody->setLinearVelocity(linearVelocity);
+    _rigidBody->setInterpolationLinearVelocity(linearVelocity);
+    _rigidBody->setAngularVelocity(angularVelocity);
+    _rigidBody->setInterpolationAngularVelocity(angularVelocity);
+    _rigidBody->clearForces();
+
+    _matrix = state.matrix;
+}
+
 class CarPhysicsObject :
     public CarObject,
     public ImplPhysicsObject
@@ -77,6 +116,9 @@ public:
 
     virtual void StopEngine() override;
 
+    virtual void SetSnowResistance(
+        float amount) override;
+
     virtual float Speed() const override;
 
     virtual float Steering() const override;
@@ -91,6 +133,12 @@ public:
     virtual glm::mat4 const &getWheelMatrix(
         int wheel) const override;
 
+    virtual void saveState(
+        PhysicsObjectState &state) const override;
+
+    virtual void restoreState(
+        PhysicsObjectState const &state) override;
+
 private:
     const float MIN_SPEED = -50.0f;
     const float MAX_SPEED = 100.0f;
@@ -100,6 +148,7 @@ private:
     bool _engineStarted;
     float _speed;
     float _steering;
+    float _snowResistance;
     bool _brakeNextUpdate;
     glm::mat4 _wheelMatrix[4];
     btRaycastVehicle *_vehicle;
@@ -110,6 +159,7 @@ CarPhysicsObject::CarPhysicsObject()
     : _engineStarted(false),
       _speed(0.0f),
       _steering(0.0f),
+      _snowResistance(0.0f),
       _brakeNextUpdate(false),
       _vehicle(nullptr),
       _vehicleRayCaster(nullptr)
@@ -156,8 +206,9 @@ void CarPhysicsObject::Update()
         _brakeNextUpdate = false;
     }
 
-    _vehicle->applyEngineForce(_speed, 2);
-    _vehicle->applyEngineForce(_speed, 3);
+    auto engineForce = _speed * (1.0f - _snowResistance);
+    _vehicle->applyEngineForce(engineForce, 2);
+    _vehicle->applyEngineForce(engineForce, 3);
 
     _vehicle->setSteeringValue(_steering, 1);
     _vehicle->setSteeringValue(_steering, 0);
@@ -241,6 +292,12 @@ void CarPhysicsObject::StopEngine()
     _speed = MIN_SPEED;
 }
 
+void CarPhysicsObject::SetSnowResistance(
+    float amount)
+{
+    _snowResistance = glm::clamp(amount, 0.0f, 1.0f);
+}
+
 float CarPhysicsObject::Speed() const
 {
     return _speed;
@@ -267,6 +324,49 @@ btRigidBody *CarPhysicsObject::getRigidBody()
     return ImplPhysicsObject::getRigidBody();
 }
 
+void CarPhysicsObject::saveState(
+    PhysicsObjectState &state) const
+{
+    ImplPhysicsObject::saveState(state);
+
+    state.engineStarted = _engineStarted;
+    state.speed = _speed;
+    state.steering = _steering;
+
+    for (int i = 0; i < 4; i++)
+    {
+        state.wheelRotation[i] = _vehicle->getWheelInfo(i).m_rotation;
+    }
+}
+
+void CarPhysicsObject::restoreState(
+    PhysicsObjectState const &state)
+{
+    ImplPhysicsObject::restoreState(state);
+
+    _engineStarted = state.engineStarted;
+    _speed = state.speed;
+    _steering = state.steering;
+    _brakeNextUpdate = false;
+
+    _vehicle->resetSuspension();
+
+    for (int i = 0; i < 4; i++)
+    {
+        auto &info = _vehicle->getWheelInfo(i);
+
+        info.m_rotation = state.wheelRotation[i];
+        info.m_deltaRotation = 0.0f;
+
+        _vehicle->applyEngineForce(0.0f, i);
+        _vehicle->setBrake(0.0f, i);
+        _vehicle->setSteeringValue(i < 2 ? _steering : 0.0f, i);
+        _vehicle->updateWheelTransform(i, true);
+
+        info.m_worldTransform.getOpenGLMatrix(glm::value_ptr(_wheelMatrix[i]));
+    }
+}
+
 PhysicsObjectBuilder::PhysicsObjectBuilder(
     PhysicsManager &manager)
     : _manager(manager),
@@ -360,8 +460,9 @@ CarObject *PhysicsObjectBuilder::BuildCar()
         _shape->calculateLocalInertia(_mass, localInertia);
     }
 
+    // The car is turned to its heading where it stands, the motion state hands this to the rigid body
     auto obj = new CarPhysicsObject();
-    obj->_matrix = glm::translate(glm::mat4(1.0f), _initialPos);
+    obj->_matrix = glm::translate(glm::mat4(1.0f), _initialPos) * glm::toMat4(_initialRot);
 
     auto rbInfo = btRigidBody::btRigidBodyConstructionInfo(_mass, obj, _shape, localInertia);
     obj->_rigidBody = new btRigidBody(rbInfo);
@@ -4,6 +4,19 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 
+struct PhysicsObjectState
+{
+    glm::mat4 matrix;
+    glm::vec3 linearVelocity;
+    glm::vec3 angularVelocity;
+
+    // Only used by car objects
+    bool engineStarted;
+    float speed;
+    float steering;
+    float wheelRotation[4];
+};
+
 class PhysicsObject
 {
 public:
@@ -11,6 +24,9 @@ public:
 
     virtual glm::mat4 const &getMatrix() const = 0;
     virtual class btRigidBody *getRigidBody() = 0;
+
+    virtual void saveState(PhysicsObjectState &state) const = 0;
+    virtual void restoreState(PhysicsObjectState const &state) = 0;
 };
 
 class CarObject : public PhysicsObject
@@ -24,6 +40,9 @@ public:
     virtual void Brake() = 0;
     virtual void StopEngine() = 0;
 
+    // Part of the engine force lost to pushing snow, from 0 to 1
+    virtual void SetSnowResistance(float amount) = 0;
+
     virtual float Speed() const = 0;
     virtual float Steering() const = 0;
 
@@ -0,0 +1,65 @@
+#ifndef POLYGONRASTER_H
+#define POLYGONRASTER_H
+
+#include <cmath>
+#include <glm/glm.hpp>
+
+// Calls span(y, x0, x1) for every row of a convex polygon given in pixels, x1 is one past
+// the last pixel. Pixel centers are at +0.5, only pixels with their center inside are visited.
+template <class SpanFunction>
+void rasterizePolygon(
+    glm::vec2 const *polygon,
+    int count,
+    glm::ivec2 const &size,
+    SpanFunction const &span)
+{
+    if (count < 3)
+    {
+        return;
+    }
+
+    auto minY = polygon[0].y;
+    auto maxY = polygon[0].y;
+    for (int i = 1; i < count; i++)
+    {
+        minY = glm::min(minY, polygon[i].y);
+        maxY = glm::max(maxY, polygon[i].y);
+    }
+
+    auto firstRow = glm::max(int(std::ceil(minY - 0.5f)), 0);
+    auto lastRow = glm::min(int(std::floor(maxY - 0.5f)), size.y - 1);
+
+    for (int y = firstRow; y <= lastRow; y++)
+    {
+        auto sampleY = float(y) + 0.5f;
+        auto left = float(size.x);
+        auto right = 0.0f;
+
+        for (int i = 0, j = count - 1; i < count; j = i++)
+        {
+            auto &a = polygon[j];
+            auto &b = polygon[i];
+
+            if ((a.y <= sampleY) == (b.y <= sampleY))
+            {
+                continue;
+            }
+
+            auto x = a.x + (sampleY - a.y) * (b.x - a.x) / (b.y - a.y);
+            left = glm::min(left, x);
+            right = glm::max(right, x);
+        }
+
+        auto x0 = glm::max(int(std::ceil(left - 0.5f)), 0);
+        auto x1 = glm::min(int(std::floor(right - 0.5f)), size.x - 1);
+
+        if (x0 > x1)
+        {
+            continue;
+        }
+
+        span(y, x0, x1 + 1);
+    }
+}
+
+#endif // POLYGONRASTER_H
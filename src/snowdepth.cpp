@@ -0,0 +1,404 @@
+#include "snowdepth.h"
+#include "levelformat.h"
+#include "polygonraster.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+SnowDepth::SnowDepth()
+    : _budget(1.0f),
+      _clock(0.0),
+      _cursor(0),
+      _lastTickMilliseconds(0.0f)
+{}
+
+void SnowDepth::setBudget(
+    float milliseconds)
+{
+    _budget = milliseconds;
+}
+
+float SnowDepth::budget() const
+{
+    return _budget;
+}
+
+void SnowDepth::reset(
+    TiledMask const &mask)
+{
+    auto tileCount = size_t(mask.tileCount().x) * size_t(mask.tileCount().y);
+
+    uint16_t base = BASE_DEPTH;
+    _depth.create(mask.size(), sizeof(uint16_t), reinterpret_cast<unsigned char const *>(&base));
+
+    _tileTime.assign(tileCount, _clock);
+    _isActive.assign(tileCount, 0);
+    _active.clear();
+    _cursor = 0;
+
+    _isChanged.assign(tileCount, 0);
+    _changed.clear();
+
+    auto depthForCleared = [](unsigned char pixel) {
+        return uint16_t((BASE_DEPTH * (MASK_CLEARED - (pixel & MASK_CLEARED))) / MASK_CLEARED);
+    };
+
+    for (size_t i = 0; i < tileCount; i++)
+    {
+        auto &tile = mask.tile(int(i));
+
+        if (tile.isUniform())
+        {
+            auto value = depthForCleared(tile.uniform[0]);
+            memcpy(_depth.tile(int(i)).uniform, &value, sizeof(value));
+        }
+        else
+        {
+            auto depths = materialize(int(i));
+            for (int p = 0; p < TiledMask::TILE_SIZE * TiledMask::TILE_SIZE; p++)
+            {
+                depths[p] = depthForCleared(tile.pixels[size_t(p)]);
+            }
+            _depth.tryCollapse(int(i));
+        }
+
+        // Tiles at the base depth need no upload and nothing to grow back, only the rest is changed
+        uint16_t uniform;
+        memcpy(&uniform, _depth.tile(int(i)).uniform, sizeof(uniform));
+        if (!_depth.tile(int(i)).isUniform() || uniform < BASE_DEPTH)
+        {
+            markChanged(int(i));
+            wake(int(i));
+        }
+    }
+}
+
+long long SnowDepth::removeSpan(
+    int y,
+    int x0,
+    int x1,
+    int &pixels)
+{
+    auto tileY = y / TiledMask::TILE_SIZE;
+    auto rowInTile = size_t(y % TiledMask::TILE_SIZE);
+
+    long long volume = 0;
+
+    while (x0 < x1)
+    {
+        auto tileX = x0 / TiledMask::TILE_SIZE;
+        auto end = std::min(x1, (tileX + 1) * TiledMask::TILE_SIZE);
+        auto index = _depth.tileIndex(tileX, tileY);
+        auto &tile = _depth.tile(index);
+
+        uint16_t uniform;
+        memcpy(&uniform, tile.uniform, sizeof(uniform));
+
+        // Plowed open areas have nothing left to take and stay uniform
+        if (!tile.isUniform() || uniform != 0)
+        {
+            auto depths = materialize(index) + (rowInTile * TiledMask::TILE_SIZE) + size_t(x0 % TiledMask::TILE_SIZE);
+            auto count = end - x0;
+
+            // Two plain loops over the run, the compiler turns both into vector instructions
+            int sum = 0;
+            int covered = 0;
+            for (int i = 0; i < count; i++)
+            {
+                sum += depths[i];
+                covered += depths[i] != 0 ? 1 : 0;
+            }
+            for (int i = 0; i < count; i++)
+            {
+                depths[i] = 0;
+            }
+
+            if (sum > 0)
+            {
+                volume += sum;
+                pixels += covered;
+                markChanged(index);
+                wake(index);
+            }
+        }
+
+        x0 = end;
+    }
+
+    return volume;
+}
+
+void SnowDepth::deposit(
+    glm::vec2 const *polygon,
+    int count,
+    long long volume)
+{
+    if (volume <= 0 || _depth.empty())
+    {
+        return;
+    }
+
+    long long pixels = 0;
+    rasterizePolygon(polygon, count, _depth.size(), [&pixels](int, int x0, int x1) {
+        pixels += x1 - x0;
+    });
+
+    // What does not divide evenly, or does not fit under the maximum, is lost
+    auto amount = pixels > 0 ? int(std::min(volume / pixels, (long long)MAX_DEPTH)) : 0;
+    if (amount <= 0)
+    {
+        return;
+    }
+
+    rasterizePolygon(polygon, count, _depth.size(), [this, amount](int y, int x0, int x1) {
+        auto tileY = y / TiledMask::TILE_SIZE;
+        auto rowInTile = size_t(y % TiledMask::TILE_SIZE);
+
+        while (x0 < x1)
+        {
+            auto tileX = x0 / TiledMask::TILE_SIZE;
+            auto end = std::min(x1, (tileX + 1) * TiledMask::TILE_SIZE);
+            auto index = _depth.tileIndex(tileX, tileY);
+            auto depths = materialize(index) + (rowInTile * TiledMask::TILE_SIZE) + size_t(x0 % TiledMask::TILE_SIZE);
+
+            for (int i = 0; i < end - x0; i++)
+            {
+                depths[i] = uint16_t(std::min(int(depths[i]) + amount, int(MAX_DEPTH)));
+            }
+
+            markChanged(index);
+            wake(index);
+
+            x0 = end;
+        }
+    });
+}
+
+void SnowDepth::update(
+    float seconds,
+    float regrowTime)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    _clock += double(seconds);
+
+    auto depthPerSecond = double(BASE_DEPTH) / double(std::max(regrowTime, 1.0f));
+    auto count = _active.size();
+
+    for (size_t visited = 0; visited < count; visited++)
+    {
+        if (_cursor >= _active.size())
+        {
+            _cursor = 0;
+        }
+
+        auto index = _active[_cursor++];
+
+        // Only whole millimetres grow, the rest is kept in the tile time until the next tick
+        auto &time = _tileTime[size_t(index)];
+        auto amount = int((_clock - time) * depthPerSecond);
+        if (amount > 0)
+        {
+            time += double(amount) / depthPerSecond;
+        }
+
+        auto &tile = _depth.tile(index);
+        bool moved = false;
+
+        if (tile.isUniform())
+        {
+            // A flat tile does not slide, it only grows
+            uint16_t value;
+            memcpy(&value, tile.uniform, sizeof(value));
+
+            auto grown = uint16_t(value < BASE_DEPTH ? std::min(int(value) + amount, int(BASE_DEPTH)) : int(value));
+            moved = grown != value;
+            memcpy(tile.uniform, &grown, sizeof(grown));
+        }
+        else
+        {
+            moved = settleTile(materialize(index), amount);
+        }
+
+        if (moved)
+        {
+            markChanged(index);
+        }
+        else if (amount > 0)
+        {
+            // Stable and nothing left to grow, the tile sleeps until the plow comes by
+            _isActive[size_t(index)] = 0;
+            _depth.tryCollapse(index);
+        }
+
+        auto elapsed = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start);
+        if (elapsed.count() >= _budget)
+        {
+            break;
+        }
+    }
+
+    _active.erase(
+        std::remove_if(_active.begin(), _active.end(), [this](int index) { return !_isActive[size_t(index)]; }),
+        _active.end());
+
+    _lastTickMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool SnowDepth::settleTile(
+    uint16_t *depths,
+    int amount)
+{
+    const int size = TiledMask::TILE_SIZE;
+
+    int d[size * size];
+    for (int i = 0; i < size * size; i++)
+    {
+        d[i] = depths[i];
+    }
+
+    // Snow above the talus slides a quarter of the excess to the lower neighbour. The flows
+    // of a row are found first and applied after, so both loops turn into vector instructions.
+    // Tiles settle on their own, a berm across a tile edge stays a bit steeper there.
+    for (int y = 0; y < size; y++)
+    {
+        auto row = d + (y * size);
+
+        int flowIn[size + 1];
+        flowIn[0] = 0;
+        flowIn[size] = 0;
+        for (int x = 0; x < size - 1; x++)
+        {
+            auto diff = row[x] - row[x + 1];
+            flowIn[x + 1] = diff > TALUS ? (diff - TALUS) / 4 : (diff < -TALUS ? (diff + TALUS) / 4 : 0);
+        }
+
+        for (int x = 0; x < size; x++)
+        {
+            row[x] += flowIn[x] - flowIn[x + 1];
+        }
+    }
+
+    for (int y = 0; y < size - 1; y++)
+    {
+        auto row = d + (y * size);
+        auto next = row + size;
+
+        for (int x = 0; x < size; x++)
+        {
+            auto diff = row[x] - next[x];
+            auto flow = diff > TALUS ? (diff - TALUS) / 4 : (diff < -TALUS ? (diff + TALUS) / 4 : 0);
+            row[x] -= flow;
+            next[x] += flow;
+        }
+    }
+
+    int changed = 0;
+    for (int i = 0; i < size * size; i++)
+    {
+        auto grown = d[i] < BASE_DEPTH ? std::min(d[i] + amount, int(BASE_DEPTH)) : d[i];
+        changed |= grown ^ int(depths[i]);
+        depths[i] = uint16_t(grown);
+    }
+
+    return changed != 0;
+}
+
+int SnowDepth::depth(
+    int x,
+    int y) const
+{
+    uint16_t value;
+    memcpy(&value, _depth.pixel(x, y), sizeof(value));
+
+    return value;
+}
+
+float SnowDepth::sample(
+    glm::vec2 const &position) const
+{
+    if (_depth.empty())
+    {
+        return 0.0f;
+    }
+
+    auto p = position - 0.5f;
+    auto i = glm::ivec2(glm::floor(p));
+    auto f = p - glm::floor(p);
+    auto last = _depth.size() - 1;
+
+    auto at = [this, &last](glm::ivec2 const &texel) {
+        auto clamped = glm::clamp(texel, glm::ivec2(0), last);
+        return float(depth(clamped.x, clamped.y));
+    };
+
+    auto bottom = glm::mix(at(i), at(i + glm::ivec2(1, 0)), f.x);
+    auto top = glm::mix(at(i + glm::ivec2(0, 1)), at(i + glm::ivec2(1, 1)), f.x);
+
+    return glm::mix(bottom, top, f.y);
+}
+
+int SnowDepth::clearedForDepth(
+    int depth)
+{
+    return MASK_CLEARED - std::min((depth * MASK_CLEARED) / BASE_DEPTH, int(MASK_CLEARED));
+}
+
+TiledMask const &SnowDepth::tiles() const
+{
+    return _depth;
+}
+
+void SnowDepth::takeChangedTiles(
+    std::vector<int> &tiles)
+{
+    for (auto index : _changed)
+    {
+        _isChanged[size_t(index)] = 0;
+    }
+
+    tiles.insert(tiles.end(), _changed.begin(), _changed.end());
+    _changed.clear();
+}
+
+size_t SnowDepth::activeTiles() const
+{
+    return _active.size();
+}
+
+float SnowDepth::lastTickMilliseconds() const
+{
+    return _lastTickMilliseconds;
+}
+
+uint16_t *SnowDepth::materialize(
+    int index)
+{
+    // Tile pixels come from new[], which is aligned for any type
+    return reinterpret_cast<uint16_t *>(_depth.materialize(index));
+}
+
+void SnowDepth::wake(
+    int index)
+{
+    if (_isActive[size_t(index)])
+    {
+        return;
+    }
+
+    _isActive[size_t(index)] = 1;
+    _tileTime[size_t(index)] = _clock;
+    _active.push_back(index);
+}
+
+void SnowDepth::markChanged(
+    int index)
+{
+    if (_isChanged[size_t(index)])
+    {
+        return;
+    }
+
+    _isChanged[size_t(index)] = 1;
+    _changed.push_back(index);
+}
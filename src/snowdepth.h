@@ -0,0 +1,108 @@
+#ifndef SNOWDEPTH_H
+#define SNOWDEPTH_H
+
+#include "tiledmask.h"
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+// How deep the snow is on every mask pixel, in millimetres. Kept in tiles like the mask,
+// so untouched snow costs nothing. The plow takes the snow out of what it sweeps and
+// piles it up in berms along the ends of the blade, where it slides down until the
+// slope is stable again. Only tiles that are still settling or growing back are
+// simulated, and every tick stops when its time budget is used up.
+class SnowDepth
+{
+public:
+    // Depth of fresh snow, and the most a berm can pile up
+    static const int BASE_DEPTH = 200;
+    static const int MAX_DEPTH = 1200;
+
+    // Steepest difference between neighbouring pixels before snow slides down
+    static const int TALUS = 40;
+
+    SnowDepth();
+
+    void setBudget(
+        float milliseconds);
+
+    float budget() const;
+
+    // Depth from the cleared bits of the mask, berms from before are gone. Only the tiles
+    // that are not at the base depth are reported as changed.
+    void reset(
+        TiledMask const &mask);
+
+    // Removes the snow from a run of pixels in one row, returns the volume taken (millimetres * pixels)
+    // and adds the number of pixels that had snow on them to pixels
+    long long removeSpan(
+        int y,
+        int x0,
+        int x1,
+        int &pixels);
+
+    // Spreads a volume taken by removeSpan() evenly over a convex polygon in pixels
+    void deposit(
+        glm::vec2 const *polygon,
+        int count,
+        long long volume);
+
+    // Lets berms settle and cleared snow grow back to the base depth in regrowTime seconds
+    void update(
+        float seconds,
+        float regrowTime);
+
+    int depth(
+        int x,
+        int y) const;
+
+    // Bilinear depth in millimetres at a position in pixels
+    float sample(
+        glm::vec2 const &position) const;
+
+    // What the cleared bits of the mask should be at most for the given depth
+    static int clearedForDepth(
+        int depth);
+
+    TiledMask const &tiles() const;
+
+    // Tiles changed since the last call, cleared by the call
+    void takeChangedTiles(
+        std::vector<int> &tiles);
+
+    size_t activeTiles() const;
+
+    float lastTickMilliseconds() const;
+
+private:
+    TiledMask _depth;
+    float _budget;
+
+    double _clock;
+    std::vector<double> _tileTime;
+    std::vector<int> _active;
+    std::vector<char> _isActive;
+    size_t _cursor;
+
+    std::vector<char> _isChanged;
+    std::vector<int> _changed;
+
+    float _lastTickMilliseconds;
+
+    uint16_t *materialize(
+        int index);
+
+    void wake(
+        int index);
+
+    void markChanged(
+        int index);
+
+    // One settling step and growth by amount on a tile, returns false when nothing moved
+    static bool settleTile(
+        uint16_t *depths,
+        int amount);
+};
+
+#endif // SNOWDEPTH_H
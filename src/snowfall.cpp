@@ -0,0 +1,288 @@
+#include "snowfall.h"
+#include "maskstatistics.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+Snowfall::Snowfall()
+    : _regrowTime(120.0f),
+      _wind(0.0f),
+      _budget(2.0f),
+      _clock(0.0),
+      _cursor(0),
+      _tilesUpdated(0),
+      _lastTickMilliseconds(0.0f)
+{
+    // Leave a core for the main thread and the driver
+    auto cores = int(std::thread::hardware_concurrency());
+    _pool.setThreadCount(std::min(std::max(cores - 2, 0), 3));
+}
+
+void Snowfall::setRegrowTime(
+    float seconds)
+{
+    _regrowTime = std::max(seconds, 1.0f);
+}
+
+float Snowfall::regrowTime() const
+{
+    return _regrowTime;
+}
+
+void Snowfall::setWind(
+    glm::vec2 const &wind)
+{
+    _wind = wind;
+}
+
+glm::vec2 const &Snowfall::wind() const
+{
+    return _wind;
+}
+
+void Snowfall::setBudget(
+    float milliseconds)
+{
+    _budget = milliseconds;
+}
+
+float Snowfall::budget() const
+{
+    return _budget;
+}
+
+void Snowfall::setThreadCount(
+    int count)
+{
+    _pool.setThreadCount(count);
+}
+
+int Snowfall::threadCount() const
+{
+    return _pool.threadCount();
+}
+
+void Snowfall::reset(
+    TiledMask const &mask)
+{
+    auto tileCount = size_t(mask.tileCount().x) * size_t(mask.tileCount().y);
+
+    _tileTime.assign(tileCount, _clock);
+    _isActive.assign(tileCount, 0);
+    _active.clear();
+    _cursor = 0;
+
+    for (size_t i = 0; i < tileCount; i++)
+    {
+        auto &tile = mask.tile(int(i));
+
+        bool cleared = (tile.uniform[0] & MASK_CLEARED) != 0;
+        if (!tile.isUniform())
+        {
+            cleared = false;
+            for (size_t p = 0; p < mask.tileBytes() && !cleared; p++)
+            {
+                cleared = (tile.pixels[p] & MASK_CLEARED) != 0;
+            }
+        }
+
+        if (cleared)
+        {
+            wake(int(i));
+        }
+    }
+}
+
+void Snowfall::wake(
+    int index)
+{
+    if (size_t(index) >= _isActive.size() || _isActive[size_t(index)])
+    {
+        return;
+    }
+
+    _isActive[size_t(index)] = 1;
+    _tileTime[size_t(index)] = _clock;
+    _active.push_back(index);
+}
+
+void Snowfall::update(
+    TiledMask &mask,
+    float seconds,
+    std::vector<Change> &changes)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    _clock += double(seconds);
+    _tilesUpdated = 0;
+
+    auto levelsPerSecond = double(MASK_CLEARED) / double(_regrowTime);
+
+    // Snow drifts in from the upwind neighbour, the wind is rounded to one of the eight directions
+    auto windStrength = glm::length(_wind);
+    auto step = glm::ivec2(0);
+    if (windStrength > 0.01f)
+    {
+        step = glm::ivec2(glm::round(_wind / windStrength));
+    }
+
+    // Enough tiles per batch to keep every thread busy, small enough to check the budget often
+    auto batchSize = size_t(_pool.threadCount() + 1) * 4;
+    auto count = _active.size();
+    size_t visited = 0;
+
+    while (visited < count)
+    {
+        _jobs.clear();
+
+        while (_jobs.size() < batchSize && visited < count)
+        {
+            if (_cursor >= _active.size())
+            {
+                _cursor = 0;
+            }
+
+            auto index = _active[_cursor++];
+            visited++;
+
+            // Only whole levels fall, the rest is kept in the tile time until the next tick
+            auto &time = _tileTime[size_t(index)];
+            auto amount = int((_clock - time) * levelsPerSecond);
+            if (amount <= 0)
+            {
+                continue;
+            }
+
+            time += double(amount) / levelsPerSecond;
+
+            // Pixels are allocated here, the workers only touch pixels that already exist
+            mask.materialize(index);
+
+            _jobs.push_back(Job({index, std::min(amount, int(MASK_CLEARED)), mask.tileExtent(index), false, false, 0, 0}));
+        }
+
+        _pool.run(int(_jobs.size()), [&](int i) {
+            auto &job = _jobs[size_t(i)];
+            auto drift = std::min(int(float(job.amount) * windStrength), int(MASK_CLEARED));
+
+            snowOnTile(mask.tile(job.index).pixels.get(), job.amount, drift, step, job);
+        });
+
+        for (auto &job : _jobs)
+        {
+            if (job.changed)
+            {
+                changes.push_back(Change({job.index, job.roadCovered, job.grassCovered}));
+            }
+
+            if (job.covered)
+            {
+                _isActive[size_t(job.index)] = 0;
+            }
+        }
+
+        _tilesUpdated += _jobs.size();
+
+        auto elapsed = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start);
+        if (elapsed.count() >= _budget)
+        {
+            // The rest of the tiles catch up on a later tick, their time is still where it was
+            break;
+        }
+    }
+
+    // Covered tiles are not simulated until the plow clears them again
+    _active.erase(
+        std::remove_if(_active.begin(), _active.end(), [this](int index) { return !_isActive[size_t(index)]; }),
+        _active.end());
+
+    _lastTickMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Snowfall::snowOnTile(
+    unsigned char *pixels,
+    int amount,
+    int drift,
+    glm::ivec2 const &step,
+    Job &job)
+{
+    const int size = TiledMask::TILE_SIZE;
+
+    // The cleared bits before this tick, so every pixel drifts from what its neighbour had
+    unsigned char cleared[size * size];
+    for (int i = 0; i < size * size; i++)
+    {
+        cleared[i] = pixels[i] & MASK_CLEARED;
+    }
+
+    unsigned char changed = 0;
+    unsigned char remaining = 0;
+
+    job.roadCovered = 0;
+    job.grassCovered = 0;
+
+    for (int y = 0; y < size; y++)
+    {
+        auto row = cleared + (y * size);
+        auto upwindRow = cleared + (glm::clamp(y - step.y, 0, size - 1) * size);
+
+        unsigned char upwind[size];
+        for (int x = 0; x < size; x++)
+        {
+            upwind[x] = upwindRow[glm::clamp(x - step.x, 0, size - 1)];
+        }
+
+        // Fixed length loops over bytes, the compiler turns these into vector instructions
+        unsigned char result[size];
+        for (int x = 0; x < size; x++)
+        {
+            auto fall = amount + (upwind[x] < row[x] ? drift : 0);
+            auto value = int(row[x]) - fall;
+            result[x] = static_cast<unsigned char>(value > 0 ? value : 0);
+        }
+
+        // The road bits stay as they are
+        auto target = pixels + (size_t(y) * size_t(size));
+        for (int x = 0; x < size; x++)
+        {
+            changed |= static_cast<unsigned char>(result[x] ^ row[x]);
+            remaining |= result[x];
+            target[x] = static_cast<unsigned char>((target[x] & MASK_ROAD) | result[x]);
+        }
+
+        if (y >= job.extent.y)
+        {
+            continue;
+        }
+
+        // Pixels that went from cleared to covered this tick, the padding of edge tiles is not counted
+        for (int x = 0; x < job.extent.x; x++)
+        {
+            auto covered = row[x] > MaskStatistics::CLEARED_THRESHOLD && result[x] <= MaskStatistics::CLEARED_THRESHOLD;
+            if (covered)
+            {
+                auto road = MaskStatistics::isRoad(target + x);
+                job.roadCovered += road ? 1 : 0;
+                job.grassCovered += road ? 0 : 1;
+            }
+        }
+    }
+
+    job.changed = changed != 0;
+    job.covered = remaining == 0;
+}
+
+size_t Snowfall::activeTiles() const
+{
+    return _active.size();
+}
+
+size_t Snowfall::tilesUpdatedLastTick() const
+{
+    return _tilesUpdated;
+}
+
+float Snowfall::lastTickMilliseconds() const
+{
+    return _lastTickMilliseconds;
+}
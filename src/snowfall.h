@@ -0,0 +1,106 @@
+#ifndef SNOWFALL_H
+#define SNOWFALL_H
+
+#include "tiledmask.h"
+#include "workerpool.h"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// Lets snow fall back on the cleared parts of the mask. Only tiles with cleared
+// pixels are simulated, and every tick stops when its time budget is used up.
+class Snowfall
+{
+public:
+    // A tile whose pixels changed, with the number of road and grass pixels that are no longer cleared
+    struct Change
+    {
+        int index;
+        int roadCovered;
+        int grassCovered;
+    };
+
+    Snowfall();
+
+    // Seconds it takes a fully cleared pixel to be covered again
+    void setRegrowTime(
+        float seconds);
+
+    float regrowTime() const;
+
+    // Direction the wind blows in mask pixels, the length is how much faster snow drifts
+    // into a cleared pixel from an upwind neighbour with more snow
+    void setWind(
+        glm::vec2 const &wind);
+
+    glm::vec2 const &wind() const;
+
+    void setBudget(
+        float milliseconds);
+
+    float budget() const;
+
+    void setThreadCount(
+        int count);
+
+    int threadCount() const;
+
+    // Finds the tiles with cleared pixels, call after the whole mask was replaced
+    void reset(
+        TiledMask const &mask);
+
+    // Snow is simulated on the tile from now on, call when pixels were cleared in it
+    void wake(
+        int index);
+
+    // Lets snow fall for the given time, tiles whose pixels changed are appended to changes
+    void update(
+        TiledMask &mask,
+        float seconds,
+        std::vector<Change> &changes);
+
+    size_t activeTiles() const;
+
+    size_t tilesUpdatedLastTick() const;
+
+    float lastTickMilliseconds() const;
+
+private:
+    float _regrowTime;
+    glm::vec2 _wind;
+    float _budget;
+    WorkerPool _pool;
+
+    // Simulation time, and for every tile the time up to which snow already fell on it
+    double _clock;
+    std::vector<double> _tileTime;
+
+    std::vector<int> _active;
+    std::vector<char> _isActive;
+    size_t _cursor;
+
+    struct Job
+    {
+        int index;
+        int amount;
+        glm::ivec2 extent;
+        bool changed;
+        bool covered;
+        int roadCovered;
+        int grassCovered;
+    };
+
+    std::vector<Job> _jobs;
+
+    size_t _tilesUpdated;
+    float _lastTickMilliseconds;
+
+    static void snowOnTile(
+        unsigned char *pixels,
+        int amount,
+        int drift,
+        glm::ivec2 const &step,
+        Job &job);
+};
+
+#endif // SNOWFALL_H
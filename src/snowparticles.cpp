@@ -0,0 +1,136 @@
+#include "snowparticles.h"
+#include "xorshift.h"
+#include <chrono>
+#include <cmath>
+
+SnowParticles::SnowParticles()
+    : _extent(30.0f, 30.0f, 8.0f),
+      _seed(0x9e3779b9),
+      _lastUpdateMilliseconds(0.0f)
+{}
+
+void SnowParticles::setCount(
+    size_t count)
+{
+    auto first = _x.size();
+
+    _x.resize(count);
+    _y.resize(count);
+    _z.resize(count);
+    _fallSpeed.resize(count);
+    _swayPhase.resize(count);
+    _swaySpeed.resize(count);
+
+    // New flakes are spread over the box around the origin, the next update wraps them around the camera
+    for (size_t i = first; i < count; i++)
+    {
+        _x[i] = (random() * 2.0f - 1.0f) * _extent.x;
+        _y[i] = (random() * 2.0f - 1.0f) * _extent.y;
+        _z[i] = (random() * 2.0f - 1.0f) * _extent.z;
+        _fallSpeed[i] = 0.6f + random() * 0.8f;
+        _swayPhase[i] = random();
+        _swaySpeed[i] = 0.2f + random() * 0.5f;
+    }
+}
+
+size_t SnowParticles::count() const
+{
+    return _x.size();
+}
+
+void SnowParticles::setExtent(
+    glm::vec3 const &extent)
+{
+    _extent = extent;
+}
+
+glm::vec3 const &SnowParticles::extent() const
+{
+    return _extent;
+}
+
+void SnowParticles::update(
+    float seconds,
+    glm::vec3 const &center,
+    glm::vec2 const &wind)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    auto count = _x.size();
+    auto x = _x.data();
+    auto y = _y.data();
+    auto z = _z.data();
+    auto fallSpeed = _fallSpeed.data();
+    auto swayPhase = _swayPhase.data();
+    auto swaySpeed = _swaySpeed.data();
+
+    // The sway is a triangle wave on the phase, no sin() or branches so the loop stays vectorized
+    const float swayAmount = 0.4f;
+    for (size_t i = 0; i < count; i++)
+    {
+        auto phase = swayPhase[i] + swaySpeed[i] * seconds;
+        phase -= float(int(phase));
+        swayPhase[i] = phase;
+
+        auto sway = (1.0f - (std::fabs(phase - 0.5f) * 4.0f)) * swayAmount;
+
+        x[i] += (wind.x + sway) * seconds;
+        y[i] += (wind.y - sway) * seconds;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        z[i] -= fallSpeed[i] * seconds;
+    }
+
+    wrap(x, count, center.x, _extent.x);
+    wrap(y, count, center.y, _extent.y);
+    wrap(z, count, center.z, _extent.z);
+
+    _lastUpdateMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+float const *SnowParticles::x() const
+{
+    return _x.data();
+}
+
+float const *SnowParticles::y() const
+{
+    return _y.data();
+}
+
+float const *SnowParticles::z() const
+{
+    return _z.data();
+}
+
+float SnowParticles::lastUpdateMilliseconds() const
+{
+    return _lastUpdateMilliseconds;
+}
+
+float SnowParticles::random()
+{
+    return xorshiftFloat(_seed);
+}
+
+void SnowParticles::wrap(
+    float *values,
+    size_t count,
+    float center,
+    float extent)
+{
+    auto size = extent * 2.0f;
+    auto inverseSize = 1.0f / size;
+
+    // floor() as truncation corrected for negative values, all in integers without a branch.
+    // Truncation has a vector instruction everywhere, a branch would keep the compiler from it.
+    for (size_t i = 0; i < count; i++)
+    {
+        auto boxes = (values[i] - center) * inverseSize + 0.5f;
+        auto floored = int(boxes);
+        floored -= int(float(floored) > boxes);
+        values[i] -= float(floored) * size;
+    }
+}
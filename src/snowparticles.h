@@ -0,0 +1,67 @@
+#ifndef SNOWPARTICLES_H
+#define SNOWPARTICLES_H
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Falling snowflakes in a box that moves along with the camera. Every attribute has its
+// own array, so the update is a few plain loops the compiler turns into vector
+// instructions, and the positions go to the GPU as they are. A flake that leaves the
+// box comes back in on the other side, so there is never a gap to fill.
+class SnowParticles
+{
+public:
+    static const size_t DEFAULT_COUNT = 131072;
+
+    SnowParticles();
+
+    void setCount(
+        size_t count);
+
+    size_t count() const;
+
+    // Half the size of the box around the center that is filled with flakes
+    void setExtent(
+        glm::vec3 const &extent);
+
+    glm::vec3 const &extent() const;
+
+    // Moves the flakes by their fall speed, sway and the wind in meters per second
+    void update(
+        float seconds,
+        glm::vec3 const &center,
+        glm::vec2 const &wind);
+
+    float const *x() const;
+
+    float const *y() const;
+
+    float const *z() const;
+
+    float lastUpdateMilliseconds() const;
+
+private:
+    glm::vec3 _extent;
+    uint32_t _seed;
+
+    std::vector<float> _x;
+    std::vector<float> _y;
+    std::vector<float> _z;
+    std::vector<float> _fallSpeed;
+    std::vector<float> _swayPhase;
+    std::vector<float> _swaySpeed;
+
+    float _lastUpdateMilliseconds;
+
+    float random();
+
+    // Brings the values back in [center - extent, center + extent)
+    static void wrap(
+        float *values,
+        size_t count,
+        float center,
+        float extent);
+};
+
+#endif // SNOWPARTICLES_H
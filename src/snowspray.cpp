@@ -0,0 +1,175 @@
+#include "snowspray.h"
+#include "xorshift.h"
+#include <algorithm>
+#include <chrono>
+
+SnowSpray::SnowSpray()
+    : _seed(0x2545f491),
+      _x(CAPACITY),
+      _y(CAPACITY),
+      _z(CAPACITY),
+      _vx(CAPACITY),
+      _vy(CAPACITY),
+      _vz(CAPACITY),
+      _age(CAPACITY),
+      _first(0),
+      _count(0),
+      _spawnRemainder(0.0f),
+      _spawnedLastEmit(0),
+      _lastUpdateMilliseconds(0.0f)
+{}
+
+void SnowSpray::emit(
+    glm::vec3 const &blade,
+    glm::vec3 const &forward,
+    glm::vec3 const &side,
+    size_t clearedPixels)
+{
+    auto wanted = (float(clearedPixels) * PARTICLES_PER_PIXEL) + _spawnRemainder;
+    auto spawn = size_t(wanted);
+    _spawnRemainder = wanted - float(spawn);
+
+    // More than a full ring in one go would only overwrite itself
+    spawn = std::min(spawn, size_t(CAPACITY));
+    _spawnedLastEmit = spawn;
+
+    for (size_t n = 0; n < spawn; n++)
+    {
+        auto i = (_first + _count) % CAPACITY;
+        if (_count == CAPACITY)
+        {
+            _first = (_first + 1) % CAPACITY;
+        }
+        else
+        {
+            _count++;
+        }
+
+        // Snow leaves the blade toward the end it is closest to, thrown forward and up
+        auto along = (random() * 2.0f) - 1.0f;
+        auto outward = (along < 0.0f ? -1.0f : 1.0f) * (0.5f + (random() * 2.0f));
+        auto position = blade + (side * along);
+        auto velocity = (side * outward) + (forward * (0.5f + random())) + glm::vec3(0.0f, 0.0f, 1.0f + (random() * 2.0f));
+
+        _x[i] = position.x;
+        _y[i] = position.y;
+        _z[i] = position.z + (random() * 0.2f);
+        _vx[i] = velocity.x;
+        _vy[i] = velocity.y;
+        _vz[i] = velocity.z;
+        _age[i] = 0.0f;
+    }
+}
+
+void SnowSpray::update(
+    float seconds)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // The living run wraps around the end of the ring at most once
+    auto end = _first + _count;
+    integrate(_first, std::min(end, size_t(CAPACITY)), seconds);
+    if (end > CAPACITY)
+    {
+        integrate(0, end - CAPACITY, seconds);
+    }
+
+    while (_count > 0 && _age[_first] >= LIFETIME)
+    {
+        _first = (_first + 1) % CAPACITY;
+        _count--;
+    }
+
+    _lastUpdateMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void SnowSpray::integrate(
+    size_t begin,
+    size_t end,
+    float seconds)
+{
+    auto x = _x.data();
+    auto y = _y.data();
+    auto z = _z.data();
+    auto vx = _vx.data();
+    auto vy = _vy.data();
+    auto vz = _vz.data();
+    auto age = _age.data();
+
+    const float gravity = 9.81f;
+
+    // A few short loops without branches instead of one long one. With seven arrays in one
+    // loop there are too many ways for them to overlap, and the compiler gives up on
+    // vector instructions. A particle that lands loses its velocity and stays on the ground.
+    for (size_t i = begin; i < end; i++)
+    {
+        vz[i] -= gravity * seconds;
+        z[i] = std::max(z[i] + (vz[i] * seconds), 0.0f);
+        vz[i] = z[i] > 0.0f ? vz[i] : 0.0f;
+    }
+
+    for (size_t i = begin; i < end; i++)
+    {
+        x[i] += vx[i] * seconds;
+        vx[i] = z[i] > 0.0f ? vx[i] : 0.0f;
+    }
+
+    for (size_t i = begin; i < end; i++)
+    {
+        y[i] += vy[i] * seconds;
+        vy[i] = z[i] > 0.0f ? vy[i] : 0.0f;
+    }
+
+    for (size_t i = begin; i < end; i++)
+    {
+        age[i] += seconds;
+    }
+}
+
+void SnowSpray::clear()
+{
+    _first = 0;
+    _count = 0;
+    _spawnRemainder = 0.0f;
+    _spawnedLastEmit = 0;
+}
+
+float const *SnowSpray::x() const
+{
+    return _x.data();
+}
+
+float const *SnowSpray::y() const
+{
+    return _y.data();
+}
+
+float const *SnowSpray::z() const
+{
+    return _z.data();
+}
+
+size_t SnowSpray::first() const
+{
+    return _first;
+}
+
+size_t SnowSpray::count() const
+{
+    return _count;
+}
+
+size_t SnowSpray::spawnedLastEmit() const
+{
+    return _spawnedLastEmit;
+}
+
+float SnowSpray::lastUpdateMilliseconds() const
+{
+    return _lastUpdateMilliseconds;
+}
+
+float SnowSpray::random()
+{
+    return xorshiftFloat(_seed);
+}
@@ -0,0 +1,79 @@
+#ifndef SNOWSPRAY_H
+#define SNOWSPRAY_H
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Snow thrown up by the plow blade. The particles live in a ring of fixed capacity that
+// is allocated once, new particles overwrite the oldest ones. All particles live equally
+// long, so the living ones are always one run of the ring from the oldest to the newest.
+class SnowSpray
+{
+public:
+    static const size_t CAPACITY = 16384;
+
+    // Particles spawned for every pixel the blade cleared, and how long they live in seconds
+    static constexpr float PARTICLES_PER_PIXEL = 4.0f;
+    static constexpr float LIFETIME = 1.2f;
+
+    SnowSpray();
+
+    // Spawns spray along the blade from its center, direction and half width in meters.
+    // The amount follows the number of pixels that were cleared.
+    void emit(
+        glm::vec3 const &blade,
+        glm::vec3 const &forward,
+        glm::vec3 const &side,
+        size_t clearedPixels);
+
+    // Moves the particles by their velocity and gravity, expired ones leave the ring
+    void update(
+        float seconds);
+
+    void clear();
+
+    float const *x() const;
+
+    float const *y() const;
+
+    float const *z() const;
+
+    // Index in the ring of the oldest living particle
+    size_t first() const;
+
+    size_t count() const;
+
+    size_t spawnedLastEmit() const;
+
+    float lastUpdateMilliseconds() const;
+
+private:
+    uint32_t _seed;
+
+    std::vector<float> _x;
+    std::vector<float> _y;
+    std::vector<float> _z;
+    std::vector<float> _vx;
+    std::vector<float> _vy;
+    std::vector<float> _vz;
+    std::vector<float> _age;
+
+    size_t _first;
+    size_t _count;
+
+    // The part of a particle that did not spawn yet, so slow plowing still sprays now and then
+    float _spawnRemainder;
+    size_t _spawnedLastEmit;
+
+    float _lastUpdateMilliseconds;
+
+    float random();
+
+    void integrate(
+        size_t begin,
+        size_t end,
+        float seconds);
+};
+
+#endif // SNOWSPRAY_H
@@ -1,8 +1,11 @@
 #include "snowyjanuary.h"
-#include <capabilityguard.h>
+#include <gl-program-cache.h>
+#include <gl-state.h>
 #include <glad/glad.h>
 #include <imgui.h>
 
+#include <chrono>
+#include <iostream>
 #include <map>
 
 #define SYSTEM_IO_FILEINFO_IMPLEMENTATION
@@ -13,6 +16,8 @@
 #include "stb_image.h"
 
 #define KEYMAP_FILE "snowyjanuary.keymap"
+#define SAVE_FILE "snowyjanuary.save"
+#define FAR_PLANE 4096.0f
 
 static std::map<UserInputMapping, UserInputActions> defaultInputMapping;
 
@@ -29,20 +34,32 @@ SnowyJanuary::SnowyJanuary(
     int argc,
     char *argv[])
     : _menuMode(MenuModes::NoMenu),
+      _showPhysicsDebug(false),
+      _cullPhysicsDebug(true),
       _floor(_floorShader),
       _car(_boxShader),
       _truck(_boxShader),
       _wheelLeft(_boxShader),
       _wheelRight(_boxShader),
       _tree(_boxShader),
+      _snowflakes(_snowflakeShader),
+      _spray(_snowflakeShader),
+      _snowflakeDrawMilliseconds(0.0f),
       _camOffset{0.0f, 0.0f, 0.0f},
       _snowTexture(0),
       _grassTexture(0),
       _asphaltTexture(0),
+      _maskReadbackTimer(0),
+      _maskSaveTimer(0),
       _toeter(nullptr),
       _engineStart(nullptr),
       _floorObject(nullptr),
-      _carObject(nullptr)
+      _carObject(nullptr),
+      _truckGridId(0),
+      _truckVisible(true),
+      _truckLod(0),
+      _trianglesDrawn(0),
+      _trianglesFullDetail(0)
 {
     (void)argc;
 
@@ -64,7 +81,7 @@ uint32_t SnowyJanuary::uploadTexture(
 
     glGenTextures(1, &texture);
 
-    glBindTexture(GL_TEXTURE_2D, texture);
+    GlState::current().bindTexture(texture);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
@@ -84,7 +101,7 @@ uint32_t SnowyJanuary::uploadTexture(
 
     free(pixels);
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+    GlState::current().bindTexture(0);
 
     return texture;
 }
@@ -108,17 +125,42 @@ bool SnowyJanuary::Setup()
     _userInput
         .ReadKeyMappings(System::IO::Path::Combine(_settingsDir, KEYMAP_FILE));
 
-    glm::vec2 groundSize(50.0f);
+    // Every program starts building now, the driver works on them while the level and textures load
+    ProgramCache::current().setup(_settingsDir);
+    MaskedTexturesBuffer::ShaderType::requestDefaultShader();
+    ShaderType::requestDefaultShader();
+    Particles::ShaderType::requestDefaultShader();
+    ColorPosition::ShaderType::requestDefaultShader();
 
-    glActiveTexture(GL_TEXTURE0);
+    // The cooked level is mapped when there is one, otherwise the authoring image is cooked in memory
+    if (!_level.open("../01-snowy-january/assets/level.sjl") &&
+        !_level.cookImage("../01-snowy-january/assets/level.png", glm::vec2(50.0f)))
+    {
+        std::cerr << "no level found" << std::endl;
+
+        return false;
+    }
+
+    auto groundSize = _level.planeSize();
+
+    GlState::current().activeTexture(GL_TEXTURE0);
     _asphaltTexture = uploadTexture("../01-snowy-january/assets/asphalt.bmp");
-    glActiveTexture(GL_TEXTURE1);
+    GlState::current().activeTexture(GL_TEXTURE1);
     _grassTexture = uploadTexture("../01-snowy-january/assets/grass.bmp");
-    glActiveTexture(GL_TEXTURE2);
+    GlState::current().activeTexture(GL_TEXTURE2);
     _snowTexture = uploadTexture("../01-snowy-january/assets/snow.bmp");
-    glActiveTexture(GL_TEXTURE3);
-    _maskTexture.loadTexture("../01-snowy-january/assets/level.png");
-    _maskTexture.setPlaneSize(groundSize);
+    GlState::current().activeTexture(GL_TEXTURE3);
+    if (!_maskTexture.loadLevel(_level))
+    {
+        std::cerr << "level mask has tile size " << _level.tileSize() << " and " << _level.comp()
+                  << " components, the game needs " << TiledMask::TILE_SIZE << " and 1" << std::endl;
+
+        return false;
+    }
+
+    // Reset goes back to the level itself, not to where the last session left off
+    _maskTexture.saveSnapshot(_initialMask);
+    _maskTexture.resumeSave(System::IO::Path::Combine(_settingsDir, SAVE_FILE));
 
     ImGuiIO &io = ImGui::GetIO();
     io.Fonts->AddFontFromFileTTF("c:\\Windows\\Fonts\\tahoma.ttf", 18.0f, NULL);
@@ -136,69 +178,175 @@ bool SnowyJanuary::Setup()
     // Setting up the shaders
     _floorShader.compileDefaultShader();
     _boxShader.compileDefaultShader();
+    _snowflakeShader.compileDefaultShader();
+    _camera.setup();
 
     // Setting up the vertex buffer
     _floor.planeTriangleFan(groundSize, glm::vec2(5.12f))
+        .packVertices()
         .setup();
 
-    _floorObject = PhysicsObjectBuilder(_physics)
-                       .Box(glm::vec3(groundSize.x, groundSize.y, 0.1f))
-                       .Mass(0.0f)
-                       .Build();
-    _physics.AddObject(_floorObject);
-
     _car.cubeTriangles()
         .scale(glm::vec3(1.0f, 2.0f, 1.0f))
         .fillColor(glm::vec4(0.0f, 0.3f, 0.5f, 1.0f))
+        .packVertices()
         .setup();
 
+    auto spawnPoint = glm::vec3(0.0f, 0.0f, 2.0f);
+    auto spawnHeading = 0.0f;
+    if (_level.spawnPointCount() > 0)
+    {
+        auto &spawn = _level.spawnPoints()[0];
+        spawnPoint = glm::vec3(spawn.position[0], spawn.position[1], spawn.position[2]);
+        spawnHeading = spawn.heading;
+    }
+
     _carObject = PhysicsObjectBuilder(_physics)
                      .Box(glm::vec3(1.0f, 2.0f, 1.0f))
                      .Mass(100.0f)
-                     .InitialPosition(glm::vec3(0.0f, 0.0f, 2.0f))
+                     .InitialPosition(spawnPoint)
+                     .InitialRotation(glm::angleAxis(spawnHeading, glm::vec3(0.0f, 0.0f, 1.0f)))
                      .BuildCar();
     _physics.AddObject(_carObject);
 
     _truck.loadObj("../01-snowy-january/assets/mini-dozer.obj", "../01-snowy-january/assets/", "Truck_Center")
         .scale(glm::vec3(0.2f))
+        .generateLods(3)
+        .packVertices()
         .setup(GL_TRIANGLES);
 
     _wheelLeft.loadObj("../01-snowy-january/assets/mini-dozer.obj", "../01-snowy-january/assets/", "Wheel.001_Left")
         .scale(glm::vec3(0.2f))
+        .generateLods(3)
+        .packVertices()
         .setup(GL_TRIANGLES);
 
     _wheelRight.loadObj("../01-snowy-january/assets/mini-dozer.obj", "../01-snowy-january/assets/", "Wheel.000_Right")
         .scale(glm::vec3(0.2f))
+        .generateLods(3)
+        .packVertices()
         .setup(GL_TRIANGLES);
 
     _tree.loadObj("../01-snowy-january/assets/tree.obj", "../01-snowy-january/assets/", "Cylinder")
         .scale(glm::vec3(0.2f))
+        .generateLods(3)
+        .packVertices()
         .setup(GL_TRIANGLES);
 
+    _snowflakes.setup();
+    _spray.setup();
+    _snowParticles.setCount(SnowParticles::DEFAULT_COUNT);
+
     _toeter = createAudio("assets/sounds/toeter.wav", 0, SDL_MIX_MAXVOLUME / 2);
     _engineStart = createAudio("assets/sounds/engine-start.wav", 0, SDL_MIX_MAXVOLUME / 2);
 
-    _treeLocations = _maskTexture.listBluePixels();
+    for (size_t i = 0; i < _level.treeCount(); i++)
+    {
+        auto &tree = _level.trees()[i];
+        _treeLocations.push_back(glm::vec2(tree.position[0], tree.position[1]));
+    }
 
-    auto builder = PhysicsObjectBuilder(_physics)
-                       .Cone(1.0f, 4.0f)
-                       .Mass(0.0f)
-                       .InitialRotation(glm::quat(glm::vec3(glm::radians(90.0f), 0.0f, 0.0f)));
+    // All trees share one collision shape, so their builder only gets a shape once
+    auto treeBuilder = PhysicsObjectBuilder(_physics)
+                           .Mass(0.0f);
+    bool treeShape = false;
 
-    for (auto pos : _treeLocations)
+    for (size_t i = 0; i < _level.colliderCount(); i++)
     {
-        auto obj = builder
-                       .InitialPosition(glm::vec3(pos.x, 2.2f, pos.y))
+        auto &collider = _level.colliders()[i];
+        auto position = glm::vec3(collider.position[0], collider.position[1], collider.position[2]);
+        auto rotation = glm::quat(collider.rotation[3], collider.rotation[0], collider.rotation[1], collider.rotation[2]);
+        auto size = glm::vec3(collider.size[0], collider.size[1], collider.size[2]);
+
+        if (collider.kind == LevelColliderKind::Ground)
+        {
+            auto builder = PhysicsObjectBuilder(_physics);
+            if (collider.shape == LevelColliderShape::Cone)
+            {
+                builder.Cone(size.x, size.y);
+            }
+            else
+            {
+                builder.Box(size);
+            }
+
+            _floorObject = builder
+                               .Mass(0.0f)
+                               .InitialPosition(position)
+                               .InitialRotation(rotation)
+                               .Build();
+            _physics.AddObject(_floorObject);
+
+            continue;
+        }
+
+        if (!treeShape)
+        {
+            if (collider.shape == LevelColliderShape::Cone)
+            {
+                treeBuilder.Cone(size.x, size.y);
+            }
+            else
+            {
+                treeBuilder.Box(size);
+            }
+            treeShape = true;
+        }
+
+        auto obj = treeBuilder
+                       .InitialPosition(position)
+                       .InitialRotation(rotation)
                        .Build();
         _physics.AddObject(obj);
         _treeObjects.push_back(obj);
     }
 
+    // Trees never move, they go into the scene grid once. Only the ones in view are drawn,
+    // with one call for all of them.
+    for (auto tree : _treeObjects)
+    {
+        glm::vec3 min, max;
+        SpatialGrid::transformBox(tree->getMatrix(), _tree.boundsMin(), _tree.boundsMax(), min, max);
+
+        _treeMatrices.push_back(tree->getMatrix());
+        _sceneGrid.add(min, max);
+    }
+    _truckGridId = _sceneGrid.add(glm::vec3(0.0f), glm::vec3(0.0f));
+    updateTruckBounds();
+
     _physics.InitDebugDraw();
 
+    // Keep the starting state around so a reset does not need to rebuild the world
+    _physics.TakeSnapshot(_initialPhysics);
+
     return true;
 }
 
+void SnowyJanuary::Reset()
+{
+    _physics.RestoreSnapshot(_initialPhysics);
+    _maskTexture.restoreSnapshot(_initialMask);
+    _snowSpray.clear();
+}
+
+void SnowyJanuary::updateTruckBounds()
+{
+    glm::vec3 min, max;
+    SpatialGrid::transformBox(_carObject->getMatrix(), _truck.boundsMin(), _truck.boundsMax(), min, max);
+
+    for (int wheel = 0; wheel < 4; wheel++)
+    {
+        auto &mesh = (wheel % 2 == 0) ? _wheelRight : _wheelLeft;
+
+        glm::vec3 wheelMin, wheelMax;
+        SpatialGrid::transformBox(_carObject->getWheelMatrix(wheel), mesh.boundsMin(), mesh.boundsMax(), wheelMin, wheelMax);
+        min = glm::min(min, wheelMin);
+        max = glm::max(max, wheelMax);
+    }
+
+    _sceneGrid.move(_truckGridId, min, max);
+}
+
 void SnowyJanuary::Resize(
     int width,
     int height)
@@ -207,7 +355,7 @@ void SnowyJanuary::Resize(
     _height = height;
 
     // Calculate the projection and view matrix
-    _proj = glm::perspective(glm::radians(90.0f), float(width) / float(height), 0.1f, 4096.0f);
+    _proj = glm::perspective(glm::radians(90.0f), float(width) / float(height), 0.1f, FAR_PLANE);
     _view = glm::lookAt(_pos + glm::vec3(5.0f, 5.0f, 0.0f), _pos, glm::vec3(0.0f, 0.0f, 1.0f));
 }
 
@@ -219,14 +367,55 @@ void SnowyJanuary::Update(
         return;
     }
 
+    // Deep snow in front of the blade takes engine force to push away
+    auto &carMatrix = _carObject->getMatrix();
+    auto blade = glm::vec2(carMatrix[3]) + (glm::vec2(carMatrix[1]) * 0.9f);
+    _carObject->SetSnowResistance(glm::min(_maskTexture.snowDepthAt(blade) / 0.5f, 0.6f));
+
     if (_carObject->Speed() > 0)
     {
         _maskTexture.paintOn(_carObject->getMatrix());
+
+        // The more snow the blade actually cleared, the more it throws up
+        _snowSpray.emit(
+            glm::vec3(blade, 0.1f),
+            glm::vec3(carMatrix[1]),
+            glm::vec3(carMatrix[0]),
+            _maskTexture.pixelsClearedLastPaint());
+    }
+    else
+    {
+        _maskTexture.liftPlow();
+    }
+
+    _snowSpray.update(float(dt) / 1000.0f);
+
+    _maskTexture.updateSnowfall(float(dt) / 1000.0f);
+
+    // What the GPU plowed only shows up in the statistics after a readback
+    _maskReadbackTimer += dt;
+    if (_maskReadbackTimer >= 1000)
+    {
+        _maskReadbackTimer = 0;
+        _maskTexture.requestReadback();
+    }
+
+    // Skipped when the previous save is still being written, it is tried again next update
+    _maskSaveTimer += dt;
+    if (_maskSaveTimer >= 10000 && _maskTexture.save(System::IO::Path::Combine(_settingsDir, SAVE_FILE)))
+    {
+        _maskSaveTimer = 0;
     }
 
     _pos = glm::vec3(_carObject->getMatrix()[3].x, _carObject->getMatrix()[3].y, 0.0f);
     _view = glm::lookAt(_pos + glm::vec3(_camOffset[0], _camOffset[1], _camOffset[2]), _pos, glm::vec3(0.0f, 0.0f, 1.0f));
 
+    // The flakes fill a box standing on the ground around the truck and drift with the snowfall wind
+    _snowParticles.update(
+        float(dt) / 1000.0f,
+        _pos + glm::vec3(0.0f, 0.0f, _snowParticles.extent().z),
+        _maskTexture.snowfall().wind());
+
     if (_userInput.ActionState(UserInputActions::StartEngine))
     {
         _carObject->StartEngine();
@@ -270,6 +459,8 @@ void SnowyJanuary::Update(
 
     _carObject->Update();
     _physics.Step(dt / 1000.0f);
+
+    updateTruckBounds();
 }
 
 static ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
@@ -281,49 +472,181 @@ void SnowyJanuary::Render()
     glClearColor(clear_color.x, clear_color.y, clear_color.z, clear_color.w);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // Clear Screen And Depth Buffer
 
-    // Select shader
-    _floorShader.use();
+    GlState::current().resetCounters();
 
-    {
-        CapabilityGuard texture2d(GL_TEXTURE_2D, true);
+    // Projection and view for every program in this frame, the mask painter binds a camera of its own during Update
+    _camera.update(_proj, _view);
 
-        _floorShader.setupMatrices(_proj, _view, _floorObject->getMatrix());
-        _floorShader.setupTextures(_asphaltTexture, _grassTexture, _snowTexture, _maskTexture.textureId());
-        _floor.render();
+    _maskTexture.uploadChanges();
+
+    _frustum.update(_proj * _view);
+    _sceneGrid.query(_frustum, _visibleObjects);
+
+    _truckVisible = false;
+    _visibleTreeIds.clear();
+    for (auto id : _visibleObjects)
+    {
+        if (id == _truckGridId)
+        {
+            _truckVisible = true;
+        }
+        else
+        {
+            _visibleTreeIds.push_back(id);
+        }
     }
 
+    // Trees are grouped by level of detail, so every level draws one range of the instances
+    _treeLodCounts.assign(_tree.lodCount(), 0);
+    _visibleTreeLods.clear();
+    for (auto id : _visibleTreeIds)
     {
-        CapabilityGuard cullFace(GL_CULL_FACE, false);
-        CapabilityGuard depthTest(GL_DEPTH_TEST, true);
+        auto lod = _tree.lodForDistance(viewDistance(glm::vec3(_treeMatrices[id][3])));
+        _visibleTreeLods.push_back(lod);
+        _treeLodCounts[lod]++;
+    }
 
-        // Select shader
-        _boxShader.use();
+    _treeLodFirsts.assign(_tree.lodCount(), 0);
+    for (size_t lod = 1; lod < _treeLodFirsts.size(); lod++)
+    {
+        _treeLodFirsts[lod] = _treeLodFirsts[lod - 1] + _treeLodCounts[lod - 1];
+    }
 
-        glFrontFace(GL_CW);
-        _boxShader.setupMatrices(_proj, _view, _carObject->getMatrix());
-        _truck.render();
+    auto next = _treeLodFirsts;
+    _visibleTreeOrder.resize(_visibleTreeIds.size());
+    for (size_t i = 0; i < _visibleTreeIds.size(); i++)
+    {
+        _visibleTreeOrder[next[_visibleTreeLods[i]]++] = _visibleTreeIds[i];
+    }
 
-        _boxShader.setupMatrices(_proj, _view, _carObject->getWheelMatrix(0));
-        _wheelRight.render();
+    // The tree instances only have to be uploaded again when other trees came into view or changed level
+    if (_visibleTreeOrder != _uploadedTreeIds)
+    {
+        _visibleTreeMatrices.clear();
+        for (auto id : _visibleTreeOrder)
+        {
+            _visibleTreeMatrices.push_back(_treeMatrices[id]);
+        }
+        _tree.setInstances(_visibleTreeMatrices.data(), _visibleTreeMatrices.size());
+        _uploadedTreeIds = _visibleTreeOrder;
+    }
 
-        _boxShader.setupMatrices(_proj, _view, _carObject->getWheelMatrix(1));
-        _wheelLeft.render();
+    _trianglesDrawn = 0;
+    _trianglesFullDetail = 0;
+
+    // Every draw goes in the queue, which orders them by layer, state, program and mesh
+    RenderState floorState;
+    _renderQueue.submit(RenderLayer::Background, floorState, _floorShader.id(), _floor.vertexArrayId(), 1.0f, [this]() {
+        _floorShader.setupModel(_floorObject->getMatrix());
+        _floorShader.setupTextures(
+            _asphaltTexture,
+            _grassTexture,
+            _snowTexture,
+            _maskTexture.textureId(),
+            _maskTexture.pageTableId(),
+            _maskTexture.depthTextureId(),
+            _maskTexture._textureSize);
+        _floor.render();
+    });
 
-        _boxShader.setupMatrices(_proj, _view, _carObject->getWheelMatrix(2));
-        _wheelRight.render();
+    RenderState meshState;
+    meshState.depthTest = true;
+    meshState.frontFace = GL_CW;
 
-        _boxShader.setupMatrices(_proj, _view, _carObject->getWheelMatrix(3));
-        _wheelLeft.render();
+    if (_truckVisible)
+    {
+        glm::mat4 rightWheels[] = {_carObject->getWheelMatrix(0), _carObject->getWheelMatrix(2)};
+        glm::mat4 leftWheels[] = {_carObject->getWheelMatrix(1), _carObject->getWheelMatrix(3)};
+        _wheelRight.setInstances(rightWheels, 2);
+        _wheelLeft.setInstances(leftWheels, 2);
+
+        auto distance = viewDistance(_pos);
+        auto truckLod = _truck.lodForDistance(distance);
+        auto wheelRightLod = _wheelRight.lodForDistance(distance);
+        auto wheelLeftLod = _wheelLeft.lodForDistance(distance);
+        _truckLod = truckLod;
+
+        _trianglesDrawn += _truck.lodTriangleCount(truckLod) + 2 * (_wheelRight.lodTriangleCount(wheelRightLod) + _wheelLeft.lodTriangleCount(wheelLeftLod));
+        _trianglesFullDetail += _truck.lodTriangleCount(0) + 2 * (_wheelRight.lodTriangleCount(0) + _wheelLeft.lodTriangleCount(0));
+
+        _renderQueue.submit(RenderLayer::Opaque, meshState, _boxShader.id(), _truck.vertexArrayId(), viewDepth(_pos), [this, truckLod]() {
+            _boxShader.setupModel(_carObject->getMatrix());
+            _truck.render(truckLod);
+        });
+        _renderQueue.submit(RenderLayer::Opaque, meshState, _boxShader.id(), _wheelRight.vertexArrayId(), viewDepth(_pos), [this, wheelRightLod]() {
+            _boxShader.setupInstancedModel();
+            _wheelRight.renderInstanced(wheelRightLod, 0, 2);
+        });
+        _renderQueue.submit(RenderLayer::Opaque, meshState, _boxShader.id(), _wheelLeft.vertexArrayId(), viewDepth(_pos), [this, wheelLeftLod]() {
+            _boxShader.setupInstancedModel();
+            _wheelLeft.renderInstanced(wheelLeftLod, 0, 2);
+        });
+    }
 
-        for (auto tree : _treeObjects)
+    // One draw per level for all trees at that level, they are spread around so they sort behind the truck
+    for (size_t lod = 0; lod < _treeLodCounts.size(); lod++)
+    {
+        if (_treeLodCounts[lod] == 0)
         {
-            _boxShader.setupMatrices(_proj, _view, tree->getMatrix());
-            _tree.render();
+            continue;
         }
-        glFrontFace(GL_CCW);
+
+        _trianglesDrawn += _treeLodCounts[lod] * _tree.lodTriangleCount(lod);
+        _trianglesFullDetail += _treeLodCounts[lod] * _tree.lodTriangleCount(0);
+
+        _renderQueue.submit(RenderLayer::Opaque, meshState, _boxShader.id(), _tree.vertexArrayId(), 1.0f, [this, lod]() {
+            _boxShader.setupInstancedModel();
+            _tree.renderInstanced(lod, _treeLodFirsts[lod], _treeLodCounts[lod]);
+        });
     }
-    CapabilityGuard depthTest(GL_DEPTH_TEST, false);
-    //_physics.DebugDraw(_proj, _view);
+
+    // Flakes are see-through, they are tested against the scene but do not hide each other
+    RenderState flakeState;
+    flakeState.depthTest = true;
+    flakeState.depthWrite = false;
+    flakeState.blend = true;
+
+    _snowflakeDrawMilliseconds = 0.0f;
+    _renderQueue.submit(RenderLayer::Transparent, flakeState, _snowflakeShader.id(), _snowflakes.vertexArrayId(), viewDepth(_pos + glm::vec3(0.0f, 0.0f, _snowParticles.extent().z)), [this]() {
+        auto start = std::chrono::steady_clock::now();
+
+        _snowflakes.upload(_snowParticles.x(), _snowParticles.y(), _snowParticles.z(), _snowParticles.count());
+        _snowflakeShader.setupParticles(0.03f, glm::vec4(1.0f, 1.0f, 1.0f, 0.8f));
+        _snowflakes.render();
+
+        _snowflakeDrawMilliseconds += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    });
+    _renderQueue.submit(RenderLayer::Transparent, flakeState, _snowflakeShader.id(), _spray.vertexArrayId(), viewDepth(_pos), [this]() {
+        auto start = std::chrono::steady_clock::now();
+
+        _spray.upload(_snowSpray.x(), _snowSpray.y(), _snowSpray.z(), SnowSpray::CAPACITY, _snowSpray.first(), _snowSpray.count());
+        _snowflakeShader.setupParticles(0.05f, glm::vec4(0.95f, 0.97f, 1.0f, 0.9f));
+        _spray.render();
+
+        _snowflakeDrawMilliseconds += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    });
+
+    if (_showPhysicsDebug)
+    {
+        // The debug drawer uses its own program
+        _renderQueue.submit(RenderLayer::Overlay, RenderState(), 0, 0, 0.0f, [this]() {
+            _physics.DebugDraw(_proj, _view);
+        });
+    }
+
+    _renderQueue.execute();
+}
+
+float SnowyJanuary::viewDistance(
+    glm::vec3 const &position) const
+{
+    return -(_view * glm::vec4(position, 1.0f)).z;
+}
+
+float SnowyJanuary::viewDepth(
+    glm::vec3 const &position) const
+{
+    return viewDistance(position) / FAR_PLANE;
 }
 
 void SnowyJanuary::RenderUi()
@@ -345,12 +668,93 @@ void SnowyJanuary::RenderUi()
             }
             if (ImGui::Button("Reset", ImVec2(120, 36)))
             {
+                Reset();
             }
             bool isStarted = _carObject->EngineIstarted();
             ImGui::Checkbox("Engine started", &isStarted);
 
             ImGui::Text("Speed %04f", _carObject->Speed());
 
+            ImGui::Text("Mask upload %d bytes", int(_maskTexture.bytesUploadedLastFrame()));
+            ImGui::Text("Mask tiles %d/%d (%d KB)",
+                        int(_maskTexture.allocatedTiles()),
+                        int(_maskTexture.tileCount()),
+                        int(_maskTexture.allocatedBytes() / 1024));
+            if (_maskTexture.atlasFull())
+            {
+                ImGui::Text("Mask atlas full, some plowed tiles are not shown");
+            }
+            ImGui::Text("Road cleared %.1f%%", double(_maskTexture.statistics().roadClearedPercentage()));
+            ImGui::Text("Snow cleared %.1f%%", double(_maskTexture.statistics().clearedPercentage()));
+
+            ImGui::Text("Snowfall %d tiles, %.2f ms",
+                        int(_maskTexture.snowfall().activeTiles()),
+                        double(_maskTexture.snowfall().lastTickMilliseconds()));
+
+            ImGui::Text("Snow depth %d tiles, %.2f ms",
+                        int(_maskTexture.snowDepth().activeTiles()),
+                        double(_maskTexture.snowDepth().lastTickMilliseconds()));
+
+            ImGui::Text("Snowflakes %d, update %.2f ms, draw %.2f ms",
+                        int(_snowParticles.count()),
+                        double(_snowParticles.lastUpdateMilliseconds()),
+                        double(_snowflakeDrawMilliseconds));
+
+            ImGui::Text("Spray %d, spawned %d, update %.2f ms",
+                        int(_snowSpray.count()),
+                        int(_snowSpray.spawnedLastEmit()),
+                        double(_snowSpray.lastUpdateMilliseconds()));
+
+            ImGui::Text("Objects %d visible, %d culled, cells %d/%d, %.2f ms",
+                        int(_visibleObjects.size()),
+                        int(_sceneGrid.objectCount() - _visibleObjects.size()),
+                        int(_sceneGrid.cellsVisibleLastQuery()),
+                        int(_sceneGrid.cellCount()),
+                        double(_sceneGrid.lastQueryMilliseconds()));
+
+            std::string treeLods;
+            for (size_t lod = 0; lod < _treeLodCounts.size(); lod++)
+            {
+                treeLods += (lod > 0 ? "/" : "") + std::to_string(_treeLodCounts[lod]);
+            }
+            ImGui::Text("Triangles %d, %d at full detail",
+                        int(_trianglesDrawn),
+                        int(_trianglesFullDetail));
+            ImGui::Text("Trees per LOD %s, truck LOD %d",
+                        treeLods.c_str(),
+                        int(_truckLod));
+
+            ImGui::Text("Render queue %d packets, sort %.3f ms",
+                        int(_renderQueue.lastPacketCount()),
+                        double(_renderQueue.lastSortMilliseconds()));
+
+            ImGui::Text("GL state changes %d, skipped %d",
+                        int(GlState::current().issuedChanges()),
+                        int(GlState::current().skippedChanges()));
+
+            ImGui::Text("Programs %d compiled, %d from disk, %d shared, %.1f ms",
+                        int(ProgramCache::current().compiledPrograms()),
+                        int(ProgramCache::current().loadedBinaries()),
+                        int(ProgramCache::current().sharedPrograms()),
+                        double(ProgramCache::current().buildMilliseconds()));
+
+            ImGui::Text("Save %d tiles, %d KB, %.1f ms",
+                        int(_maskTexture.maskSave().savedTiles()),
+                        int(_maskTexture.maskSave().lastSaveBytes() / 1024),
+                        double(_maskTexture.maskSave().lastSaveMilliseconds()));
+
+            bool asyncUploads = _maskTexture.asyncUploads();
+            if (ImGui::Checkbox("Async mask upload", &asyncUploads))
+            {
+                _maskTexture.setAsyncUploads(asyncUploads);
+            }
+
+            bool gpuPainting = _maskTexture.gpuPainting();
+            if (ImGui::Checkbox("GPU plowing", &gpuPainting))
+            {
+                _maskTexture.setGpuPainting(gpuPainting);
+            }
+
             float steering = _carObject->Steering();
             if (ImGui::SliderFloat("steering", &steering, -0.3f, 0.3f))
             {
@@ -384,6 +788,42 @@ void SnowyJanuary::RenderUi()
                 ImGui::SliderFloat("Cam X", &(_camOffset[0]), -5.0f, 5.0f);
                 ImGui::SliderFloat("Cam Y", &(_camOffset[1]), -5.0f, 5.0f);
                 ImGui::SliderFloat("Cam Z", &(_camOffset[2]), -5.0f, 5.0f);
+
+                auto &snowfall = _maskTexture.snowfall();
+
+                float regrowTime = snowfall.regrowTime();
+                if (ImGui::SliderFloat("Snow regrow s", &regrowTime, 10.0f, 600.0f))
+                {
+                    snowfall.setRegrowTime(regrowTime);
+                }
+
+                glm::vec2 wind = snowfall.wind();
+                if (ImGui::SliderFloat2("Wind", &(wind[0]), -2.0f, 2.0f))
+                {
+                    snowfall.setWind(wind);
+                }
+
+                int snowflakes = int(_snowParticles.count());
+                if (ImGui::SliderInt("Snowflakes", &snowflakes, 0, 262144))
+                {
+                    _snowParticles.setCount(size_t(snowflakes));
+                }
+
+                int snowThreads = snowfall.threadCount();
+                if (ImGui::SliderInt("Snow threads", &snowThreads, 0, 8))
+                {
+                    snowfall.setThreadCount(snowThreads);
+                }
+
+                ImGui::Checkbox("Physics debug", &_showPhysicsDebug);
+                if (ImGui::Checkbox("Cull debug lines", &_cullPhysicsDebug))
+                {
+                    _physics.SetDebugDrawCulling(_cullPhysicsDebug);
+                }
+                if (_showPhysicsDebug)
+                {
+                    ImGui::Text("Lines %d (culled %d)", int(_physics.DebugDrawLineCount()), int(_physics.DebugDrawCulledLineCount()));
+                }
             }
             if (_menuMode == MenuModes::KeyMappingMenu)
             {
@@ -438,4 +878,11 @@ void SnowyJanuary::RenderUi()
 
 void SnowyJanuary::Destroy()
 {
+    // Switching GPU plowing off reads back what was plowed since the last readback, so it gets saved
+    _maskTexture.setGpuPainting(false);
+
+    // The final save waits for one that may still be running, then for itself
+    _maskTexture.maskSave().wait();
+    _maskTexture.save(System::IO::Path::Combine(_settingsDir, SAVE_FILE));
+    _maskTexture.maskSave().wait();
 }
@@ -6,9 +6,16 @@
 
 #include "audio.h"
 #include "game.h"
+#include "gl-camera-uniforms.h"
 #include "gl-color-normal-position-vertex.h"
 #include "gl-masked-textures.h"
+#include "gl-particles.h"
+#include "gl-render-queue.h"
+#include "level.h"
 #include "physics.h"
+#include "snowparticles.h"
+#include "snowspray.h"
+#include "spatialgrid.h"
 #include "updatingtexture.h"
 
 #include <string>
@@ -38,7 +45,11 @@ private:
 
     std::string _settingsDir;
     MenuModes _menuMode;
+    bool _showPhysicsDebug;
+    bool _cullPhysicsDebug;
 
+    CameraUniformBuffer _camera;
+    RenderQueue _renderQueue;
     MaskedTexturesBuffer::ShaderType _floorShader;
     MaskedTexturesBuffer::BufferType _floor;
     ShaderType _boxShader;
@@ -47,12 +58,21 @@ private:
     BufferType _wheelLeft;
     BufferType _wheelRight;
     BufferType _tree;
+    Particles::ShaderType _snowflakeShader;
+    Particles::InstanceBufferType _snowflakes;
+    SnowParticles _snowParticles;
+    Particles::InstanceBufferType _spray;
+    SnowSpray _snowSpray;
+    float _snowflakeDrawMilliseconds;
     float _camOffset[3];
 
     uint32_t _snowTexture;
     uint32_t _grassTexture;
     uint32_t _asphaltTexture;
+    Level _level;
     UpdatingTexture _maskTexture;
+    int _maskReadbackTimer;
+    int _maskSaveTimer;
     Audio *_toeter;
     Audio *_engineStart;
 
@@ -61,9 +81,45 @@ private:
     CarObject *_carObject;
     std::vector<PhysicsObject *> _treeObjects;
     std::vector<glm::vec2> _treeLocations;
+    std::vector<glm::mat4> _treeMatrices;
+
+    // Trees have the grid ids of their index, the truck comes after them
+    Frustum _frustum;
+    SpatialGrid _sceneGrid;
+    size_t _truckGridId;
+    std::vector<uint32_t> _visibleObjects;
+    std::vector<uint32_t> _visibleTreeIds;
+    std::vector<uint32_t> _uploadedTreeIds;
+    std::vector<glm::mat4> _visibleTreeMatrices;
+    bool _truckVisible;
+
+    // Visible trees sorted by level of detail, with the instance range of every level
+    std::vector<size_t> _visibleTreeLods;
+    std::vector<uint32_t> _visibleTreeOrder;
+    std::vector<size_t> _treeLodFirsts;
+    std::vector<size_t> _treeLodCounts;
+    size_t _truckLod;
+    size_t _trianglesDrawn;
+    size_t _trianglesFullDetail;
+
+    PhysicsSnapshot _initialPhysics;
+    TiledMask _initialMask;
 
     uint32_t uploadTexture(std::string const &filename);
 
+    void Reset();
+
+    // Moves the truck and its wheels in the scene grid to where the physics put them
+    void updateTruckBounds();
+
+    // Distance in front of the camera in meters
+    float viewDistance(
+        glm::vec3 const &position) const;
+
+    // Distance in front of the camera, from 0 at the eye to 1 at the far plane
+    float viewDepth(
+        glm::vec3 const &position) const;
+
 };
 
 #endif // SNOWYJANUARY_H
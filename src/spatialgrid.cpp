@@ -0,0 +1,199 @@
+#include "spatialgrid.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+SpatialGrid::SpatialGrid(
+    float cellSize)
+    : _cellSize(cellSize),
+      _cellsVisibleLastQuery(0),
+      _lastQueryMilliseconds(0.0f)
+{}
+
+void SpatialGrid::clear()
+{
+    _cellIndex.clear();
+    _cellObjects.clear();
+    _cellDirty.clear();
+    _cellBounds.clear();
+    _objectBounds.clear();
+    _objectCell.clear();
+}
+
+size_t SpatialGrid::add(
+    glm::vec3 const &min,
+    glm::vec3 const &max)
+{
+    auto id = _objectCell.size();
+    auto cell = cellFor(min, max);
+
+    _objectBounds.push(min, max);
+    _objectCell.push_back(cell);
+    _cellObjects[cell].push_back(uint32_t(id));
+    _cellDirty[cell] = true;
+
+    return id;
+}
+
+void SpatialGrid::move(
+    size_t id,
+    glm::vec3 const &min,
+    glm::vec3 const &max)
+{
+    _objectBounds.set(id, min, max);
+
+    auto from = _objectCell[id];
+    auto to = cellFor(min, max);
+    if (to != from)
+    {
+        auto &objects = _cellObjects[from];
+        objects.erase(std::find(objects.begin(), objects.end(), uint32_t(id)));
+        _cellObjects[to].push_back(uint32_t(id));
+        _objectCell[id] = to;
+    }
+
+    _cellDirty[from] = true;
+    _cellDirty[to] = true;
+}
+
+void SpatialGrid::query(
+    Frustum const &frustum,
+    std::vector<uint32_t> &visible)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    visible.clear();
+
+    for (size_t cell = 0; cell < _cellObjects.size(); cell++)
+    {
+        if (_cellDirty[cell])
+        {
+            updateCellBounds(cell);
+        }
+    }
+
+    _cellVisible.resize(_cellBounds.size());
+    frustum.testBoxes(_cellBounds, _cellVisible.data());
+
+    // The objects of all visible cells are tested together in one more pass
+    _candidates.clear();
+    _candidateBounds.clear();
+    _cellsVisibleLastQuery = 0;
+    for (size_t cell = 0; cell < _cellObjects.size(); cell++)
+    {
+        if (_cellVisible[cell] == 0 || _cellObjects[cell].empty())
+        {
+            continue;
+        }
+
+        _cellsVisibleLastQuery++;
+        for (auto id : _cellObjects[cell])
+        {
+            _candidates.push_back(id);
+            _candidateBounds.push(
+                glm::vec3(_objectBounds.minX[id], _objectBounds.minY[id], _objectBounds.minZ[id]),
+                glm::vec3(_objectBounds.maxX[id], _objectBounds.maxY[id], _objectBounds.maxZ[id]));
+        }
+    }
+
+    _candidateVisible.resize(_candidates.size());
+    frustum.testBoxes(_candidateBounds, _candidateVisible.data());
+
+    for (size_t i = 0; i < _candidates.size(); i++)
+    {
+        if (_candidateVisible[i] != 0)
+        {
+            visible.push_back(_candidates[i]);
+        }
+    }
+    std::sort(visible.begin(), visible.end());
+
+    _lastQueryMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+size_t SpatialGrid::objectCount() const
+{
+    return _objectCell.size();
+}
+
+size_t SpatialGrid::cellCount() const
+{
+    return _cellObjects.size();
+}
+
+size_t SpatialGrid::cellsVisibleLastQuery() const
+{
+    return _cellsVisibleLastQuery;
+}
+
+float SpatialGrid::lastQueryMilliseconds() const
+{
+    return _lastQueryMilliseconds;
+}
+
+void SpatialGrid::transformBox(
+    glm::mat4 const &matrix,
+    glm::vec3 const &min,
+    glm::vec3 const &max,
+    glm::vec3 &transformedMin,
+    glm::vec3 &transformedMax)
+{
+    // Arvo's method, every matrix element moves the new bounds by the smaller or larger
+    // of its products with the old bounds
+    transformedMin = transformedMax = glm::vec3(matrix[3]);
+    for (int column = 0; column < 3; column++)
+    {
+        for (int row = 0; row < 3; row++)
+        {
+            auto a = matrix[column][row] * min[column];
+            auto b = matrix[column][row] * max[column];
+            transformedMin[row] += std::min(a, b);
+            transformedMax[row] += std::max(a, b);
+        }
+    }
+}
+
+size_t SpatialGrid::cellFor(
+    glm::vec3 const &min,
+    glm::vec3 const &max)
+{
+    auto center = (min + max) * 0.5f;
+    auto key = std::make_pair(int(std::floor(center.x / _cellSize)), int(std::floor(center.y / _cellSize)));
+
+    auto found = _cellIndex.find(key);
+    if (found != _cellIndex.end())
+    {
+        return found->second;
+    }
+
+    // Cells are only made for places that have objects, they stay when their objects leave
+    auto cell = _cellObjects.size();
+    _cellIndex.insert(std::make_pair(key, cell));
+    _cellObjects.push_back(std::vector<uint32_t>());
+    _cellDirty.push_back(true);
+    _cellBounds.push(min, max);
+
+    return cell;
+}
+
+void SpatialGrid::updateCellBounds(
+    size_t cell)
+{
+    _cellDirty[cell] = false;
+
+    auto &objects = _cellObjects[cell];
+    if (objects.empty())
+    {
+        // query() skips empty cells, whatever their box
+        return;
+    }
+
+    auto min = glm::vec3(_objectBounds.minX[objects[0]], _objectBounds.minY[objects[0]], _objectBounds.minZ[objects[0]]);
+    auto max = glm::vec3(_objectBounds.maxX[objects[0]], _objectBounds.maxY[objects[0]], _objectBounds.maxZ[objects[0]]);
+    for (auto id : objects)
+    {
+        min = glm::min(min, glm::vec3(_objectBounds.minX[id], _objectBounds.minY[id], _objectBounds.minZ[id]));
+        max = glm::max(max, glm::vec3(_objectBounds.maxX[id], _objectBounds.maxY[id], _objectBounds.maxZ[id]));
+    }
+    _cellBounds.set(cell, min, max);
+}
@@ -0,0 +1,79 @@
+#ifndef SPATIALGRID_H
+#define SPATIALGRID_H
+
+#include <frustum.h>
+#include <glm/glm.hpp>
+#include <map>
+#include <utility>
+#include <vector>
+
+// Uniform grid over the ground plane for finding the objects in view. Every object is kept
+// in the cell its center is in, and every cell keeps the box around all of its objects, so
+// cells outside the frustum are skipped with one test. Static objects are added once,
+// objects that move are moved again whenever their box changes.
+class SpatialGrid
+{
+public:
+    SpatialGrid(
+        float cellSize = 16.0f);
+
+    void clear();
+
+    // Returns the id of the new object, ids are handed out in order from zero
+    size_t add(
+        glm::vec3 const &min,
+        glm::vec3 const &max);
+
+    void move(
+        size_t id,
+        glm::vec3 const &min,
+        glm::vec3 const &max);
+
+    // Fills visible with the ids of the objects that are not outside the frustum, in id order
+    void query(
+        Frustum const &frustum,
+        std::vector<uint32_t> &visible);
+
+    size_t objectCount() const;
+
+    size_t cellCount() const;
+
+    size_t cellsVisibleLastQuery() const;
+
+    float lastQueryMilliseconds() const;
+
+    // Box around a box in model space after it was transformed by the matrix
+    static void transformBox(
+        glm::mat4 const &matrix,
+        glm::vec3 const &min,
+        glm::vec3 const &max,
+        glm::vec3 &transformedMin,
+        glm::vec3 &transformedMax);
+
+private:
+    float _cellSize;
+    std::map<std::pair<int, int>, size_t> _cellIndex;
+    std::vector<std::vector<uint32_t>> _cellObjects;
+    std::vector<bool> _cellDirty;
+    BoxArrays _cellBounds;
+
+    BoxArrays _objectBounds;
+    std::vector<size_t> _objectCell;
+
+    std::vector<uint8_t> _cellVisible;
+    BoxArrays _candidateBounds;
+    std::vector<uint32_t> _candidates;
+    std::vector<uint8_t> _candidateVisible;
+
+    size_t _cellsVisibleLastQuery;
+    float _lastQueryMilliseconds;
+
+    size_t cellFor(
+        glm::vec3 const &min,
+        glm::vec3 const &max);
+
+    void updateCellBounds(
+        size_t cell);
+};
+
+#endif // SPATIALGRID_H
@@ -0,0 +1,241 @@
+#include "tiledmask.h"
+#include <algorithm>
+#include <cstring>
+
+TiledMask::TiledMask()
+    : _size(0),
+      _tileCount(0),
+      _comp(3),
+      _allocatedTiles(0)
+{}
+
+void TiledMask::create(
+    glm::ivec2 const &size,
+    int comp,
+    unsigned char const *fill)
+{
+    _size = size;
+    _comp = std::min(comp, int(MAX_COMP));
+    _tileCount = (size + glm::ivec2(TILE_SIZE - 1)) / TILE_SIZE;
+    _allocatedTiles = 0;
+
+    _tiles.clear();
+    _tiles.resize(size_t(_tileCount.x) * size_t(_tileCount.y));
+
+    for (auto &tile : _tiles)
+    {
+        memcpy(tile.uniform, fill, size_t(_comp));
+    }
+}
+
+void TiledMask::load(
+    unsigned char const *pixels,
+    glm::ivec2 const &size,
+    int comp)
+{
+    unsigned char fill[MAX_COMP] = {0, 0, 0, 0};
+    create(size, comp, fill);
+
+    auto stride = size_t(_size.x) * size_t(_comp);
+    auto tileStride = size_t(TILE_SIZE) * size_t(_comp);
+
+    for (int index = 0; index < int(_tiles.size()); index++)
+    {
+        auto &tile = _tiles[size_t(index)];
+        auto origin = glm::ivec2(index % _tileCount.x, index / _tileCount.x) * TILE_SIZE;
+        auto extent = tileExtent(index);
+        auto first = pixels + (size_t(origin.y) * stride) + (size_t(origin.x) * size_t(_comp));
+
+        memcpy(tile.uniform, first, size_t(_comp));
+
+        bool uniform = true;
+        for (int y = 0; y < extent.y && uniform; y++)
+        {
+            auto row = first + (size_t(y) * stride);
+            for (int x = 0; x < extent.x * _comp; x++)
+            {
+                if (row[x] != tile.uniform[x % _comp])
+                {
+                    uniform = false;
+                    break;
+                }
+            }
+        }
+
+        if (uniform)
+        {
+            continue;
+        }
+
+        auto target = materialize(index);
+        for (int y = 0; y < extent.y; y++)
+        {
+            memcpy(target + (size_t(y) * tileStride), first + (size_t(y) * stride), size_t(extent.x) * size_t(_comp));
+        }
+    }
+}
+
+void TiledMask::copyFrom(
+    TiledMask const &other)
+{
+    if (_size != other._size || _comp != other._comp)
+    {
+        unsigned char fill[MAX_COMP] = {0, 0, 0, 0};
+        create(other._size, other._comp, fill);
+    }
+
+    for (size_t i = 0; i < _tiles.size(); i++)
+    {
+        auto &tile = _tiles[i];
+        auto &source = other._tiles[i];
+
+        memcpy(tile.uniform, source.uniform, MAX_COMP);
+
+        if (source.isUniform())
+        {
+            if (!tile.isUniform())
+            {
+                tile.pixels.reset();
+                _allocatedTiles--;
+            }
+
+            continue;
+        }
+
+        memcpy(materialize(int(i)), source.pixels.get(), tileBytes());
+    }
+}
+
+bool TiledMask::empty() const
+{
+    return _tiles.empty();
+}
+
+glm::ivec2 const &TiledMask::size() const
+{
+    return _size;
+}
+
+glm::ivec2 const &TiledMask::tileCount() const
+{
+    return _tileCount;
+}
+
+int TiledMask::comp() const
+{
+    return _comp;
+}
+
+size_t TiledMask::tileBytes() const
+{
+    return size_t(TILE_SIZE) * size_t(TILE_SIZE) * size_t(_comp);
+}
+
+TiledMask::Tile &TiledMask::tile(
+    int index)
+{
+    return _tiles[size_t(index)];
+}
+
+TiledMask::Tile const &TiledMask::tile(
+    int index) const
+{
+    return _tiles[size_t(index)];
+}
+
+int TiledMask::tileIndex(
+    int tileX,
+    int tileY) const
+{
+    return (tileY * _tileCount.x) + tileX;
+}
+
+unsigned char const *TiledMask::pixel(
+    int x,
+    int y) const
+{
+    auto &tile = _tiles[size_t(tileIndex(x / TILE_SIZE, y / TILE_SIZE))];
+
+    if (tile.isUniform())
+    {
+        return tile.uniform;
+    }
+
+    auto offset = (size_t(y % TILE_SIZE) * size_t(TILE_SIZE)) + size_t(x % TILE_SIZE);
+
+    return tile.pixels.get() + (offset * size_t(_comp));
+}
+
+unsigned char *TiledMask::materialize(
+    int index)
+{
+    auto &tile = _tiles[size_t(index)];
+
+    if (!tile.isUniform())
+    {
+        return tile.pixels.get();
+    }
+
+    auto size = tileBytes();
+    tile.pixels.reset(new unsigned char[size]);
+
+    for (size_t i = 0; i < size; i += size_t(_comp))
+    {
+        memcpy(tile.pixels.get() + i, tile.uniform, size_t(_comp));
+    }
+
+    _allocatedTiles++;
+
+    return tile.pixels.get();
+}
+
+bool TiledMask::tryCollapse(
+    int index)
+{
+    auto &tile = _tiles[size_t(index)];
+
+    if (tile.isUniform())
+    {
+        return true;
+    }
+
+    auto extent = tileExtent(index);
+    auto pixels = tile.pixels.get();
+    auto rowBytes = size_t(TILE_SIZE) * size_t(_comp);
+
+    for (int y = 0; y < extent.y; y++)
+    {
+        auto row = pixels + (size_t(y) * rowBytes);
+        for (int x = 0; x < extent.x * _comp; x++)
+        {
+            if (row[x] != pixels[x % _comp])
+            {
+                return false;
+            }
+        }
+    }
+
+    memcpy(tile.uniform, pixels, size_t(_comp));
+    tile.pixels.reset();
+    _allocatedTiles--;
+
+    return true;
+}
+
+size_t TiledMask::allocatedTiles() const
+{
+    return _allocatedTiles;
+}
+
+size_t TiledMask::allocatedBytes() const
+{
+    return _allocatedTiles * tileBytes();
+}
+
+glm::ivec2 TiledMask::tileExtent(
+    int index) const
+{
+    auto origin = glm::ivec2(index % _tileCount.x, index / _tileCount.x) * TILE_SIZE;
+
+    return glm::min(_size - origin, glm::ivec2(TILE_SIZE));
+}
@@ -0,0 +1,104 @@
+#ifndef TILEDMASK_H
+#define TILEDMASK_H
+
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+
+// The level mask cut into square tiles. A tile that has the same value in every pixel
+// only stores that value, pixels are allocated the first time something differs.
+class TiledMask
+{
+public:
+    static const int TILE_SIZE = 64;
+    static const int MAX_COMP = 4;
+
+    struct Tile
+    {
+        unsigned char uniform[MAX_COMP] = {0, 0, 0, 0};
+        std::unique_ptr<unsigned char[]> pixels;
+
+        // Atlas slot holding the pixels on the GPU, -1 when the tile is drawn from its uniform value
+        int slot = -1;
+        bool dirty = false;
+
+        bool isUniform() const
+        {
+            return pixels == nullptr;
+        }
+    };
+
+    TiledMask();
+
+    TiledMask(
+        TiledMask const &) = delete;
+
+    TiledMask &operator=(
+        TiledMask const &) = delete;
+
+    // Every tile starts out uniform with the fill value
+    void create(
+        glm::ivec2 const &size,
+        int comp,
+        unsigned char const *fill);
+
+    // Splits a dense image into tiles, only tiles with differing pixels get storage
+    void load(
+        unsigned char const *pixels,
+        glm::ivec2 const &size,
+        int comp);
+
+    // Makes this mask an exact copy of the other, storage of tiles that stay allocated is reused
+    void copyFrom(
+        TiledMask const &other);
+
+    bool empty() const;
+
+    glm::ivec2 const &size() const;
+
+    glm::ivec2 const &tileCount() const;
+
+    int comp() const;
+
+    size_t tileBytes() const;
+
+    Tile &tile(
+        int index);
+
+    Tile const &tile(
+        int index) const;
+
+    int tileIndex(
+        int tileX,
+        int tileY) const;
+
+    // Pixel value at x,y, returns a pointer into either the tile pixels or its uniform value
+    unsigned char const *pixel(
+        int x,
+        int y) const;
+
+    // Gives the tile its own pixels, filled with the uniform value
+    unsigned char *materialize(
+        int index);
+
+    // Frees the pixels again when they all ended up with the same value
+    bool tryCollapse(
+        int index);
+
+    size_t allocatedTiles() const;
+
+    size_t allocatedBytes() const;
+
+    // Pixels of the tile that are inside the mask, edge tiles are cut off at the mask size
+    glm::ivec2 tileExtent(
+        int index) const;
+
+private:
+    glm::ivec2 _size;
+    glm::ivec2 _tileCount;
+    int _comp;
+    std::vector<Tile> _tiles;
+    size_t _allocatedTiles;
+};
+
+#endif // TILEDMASK_H
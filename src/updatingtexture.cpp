@@ -1,181 +1,1212 @@
 #include "updatingtexture.h"
-#include "stb_image.h"
+#include "polygonraster.h"
+#include <gl-state.h>
+#include <algorithm>
+#include <cstring>
 #include <glad/glad.h>
+#include <iostream>
 
 UpdatingTexture::UpdatingTexture()
-{}
+{
+    _maskAtlas.name = "mask";
+
+    // Millimetres, filtered by hand in the shader like the mask
+    _depthAtlas.internalFormat = GL_R16;
+    _depthAtlas.type = GL_UNSIGNED_SHORT;
+    _depthAtlas.name = "snow depth";
+}
 
 uint32_t UpdatingTexture::textureId() const
 {
-    return _textureId;
+    return _maskAtlas.textureId;
 }
 
-void UpdatingTexture::loadTexture(
-    std::string const &filename)
+uint32_t UpdatingTexture::pageTableId() const
+{
+    return _pageTableId;
+}
+
+uint32_t UpdatingTexture::depthTextureId() const
+{
+    return _depthAtlas.textureId;
+}
+
+bool UpdatingTexture::loadLevel(
+    Level const &level)
 {
-    int x, y;
-    _pixels = stbi_load(filename.c_str(), &x, &y, &_comp, 3);
-    if (_pixels == nullptr)
+    if (!level.isOpen() || level.tileSize() != TiledMask::TILE_SIZE || level.comp() != 1)
     {
-        return;
+        return false;
+    }
+
+    unsigned char fill[TiledMask::MAX_COMP] = {0, 0, 0, 0};
+    _mask.create(level.size(), level.comp(), fill);
+
+    auto tiles = level.tiles();
+    for (int i = 0; i < int(_mask.tileCount().x * _mask.tileCount().y); i++)
+    {
+        auto &tile = tiles[i];
+
+        memcpy(_mask.tile(i).uniform, tile.uniform, sizeof(tile.uniform));
+
+        if (tile.pixelOffset != LevelTile::UNIFORM)
+        {
+            memcpy(_mask.materialize(i), level.tilePixels(tile), _mask.tileBytes());
+        }
     }
 
-    _textureSize = glm::vec2(x, y);
+    _textureSize = glm::vec2(level.size());
+    _planeSize = level.planeSize();
+
+    _snowfall.reset(_mask);
+    _statistics.reset(_mask);
+    resetDepth();
+    _save.begin(level);
+
+    _readbackTiles.clear();
+    _paintedTiles.clear();
+    _tilePainted.assign(size_t(_mask.tileCount().x * _mask.tileCount().y), false);
+
+    createTextures();
+    markAllDirty();
+
+    return true;
+}
+
+void UpdatingTexture::createTextures()
+{
+    GLint maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+
+    auto &tileCount = _mask.tileCount();
+
+    // As wide as the mask, so every tile has a slot once the atlas has grown to the height
+    // of the mask. Masks larger than the largest texture can only have part of their tiles
+    // in the atlas, the rest is drawn from its uniform value and reported.
+    auto maxSlots = int(maxTextureSize) / TiledMask::TILE_SIZE;
+    _slotsPerRow = std::min(tileCount.x, maxSlots);
+    _maxAtlasRows = std::min(tileCount.y, maxSlots);
+
+    // Room for the tiles allocated at load and some more for plowing before the first resize
+    auto initialRows = [this](size_t allocated) {
+        auto slots = int(allocated + (allocated / 4)) + 1;
+        return std::min((slots + _slotsPerRow - 1) / _slotsPerRow, _maxAtlasRows);
+    };
+
+    _maskAtlas.full = false;
+    resizeAtlas(_maskAtlas, initialRows(_mask.allocatedTiles()));
+
+    _depthAtlas.full = false;
+    resizeAtlas(_depthAtlas, initialRows(_depth.tiles().allocatedTiles()));
+
+    _pageTable.assign(size_t(tileCount.x) * size_t(tileCount.y) * 4, 0);
 
-    glGenTextures(1, &_textureId);
+    glGenTextures(1, &_pageTableId);
 
-    glBindTexture(GL_TEXTURE_2D, _textureId);
+    GlState::current().bindTexture(_pageTableId);
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
     glTexImage2D(
         GL_TEXTURE_2D,
         0,
-        _comp == 4 ? GL_RGBA : GL_RGB,
-        static_cast<GLsizei>(_textureSize.x),
-        static_cast<GLsizei>(_textureSize.y),
+        GL_RGBA16UI,
+        tileCount.x,
+        tileCount.y,
         0,
-        _comp == 4 ? GL_RGBA : GL_RGB,
-        GL_UNSIGNED_BYTE,
-        _pixels);
+        GL_RGBA_INTEGER,
+        GL_UNSIGNED_SHORT,
+        nullptr);
+
+    GlState::current().bindTexture(0);
+}
+
+bool UpdatingTexture::resizeAtlas(
+    Atlas &atlas,
+    int rows)
+{
+    if (rows <= atlas.rows || rows > _maxAtlasRows)
+    {
+        return false;
+    }
+
+    auto width = _slotsPerRow * TiledMask::TILE_SIZE;
+    auto height = rows * TiledMask::TILE_SIZE;
+
+    uint32_t textureId = 0;
+    glGenTextures(1, &textureId);
+
+    GlState::current().bindTexture(textureId);
+
+    // The shader fetches texels itself, filtering across slots would mix unrelated tiles
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    // A mask pixel is one byte with road and cleared snow packed together, a depth pixel 16 bits
+    glTexImage2D(
+        GL_TEXTURE_2D,
+        0,
+        GLint(atlas.internalFormat),
+        width,
+        height,
+        0,
+        GL_RED,
+        atlas.type,
+        nullptr);
+
+    if (atlas.textureId != 0)
+    {
+        // Copy on the GPU, when painting there the atlas is ahead of the tiles in memory
+        uint32_t framebufferId = 0;
+        glGenFramebuffers(1, &framebufferId);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebufferId);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, atlas.textureId, 0);
+
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, atlas.rows * TiledMask::TILE_SIZE);
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &framebufferId);
+
+        GlState::current().deleteTexture(atlas.textureId);
+    }
+
+    GlState::current().bindTexture(0);
+
+    atlas.textureId = textureId;
+    atlas.rows = rows;
+
+    if (&atlas == &_maskAtlas && _gpuPainting && !_gpuPainter.setup(atlas.textureId))
+    {
+        _gpuPainting = false;
+    }
+
+    return true;
+}
+
+glm::ivec2 UpdatingTexture::slotOrigin(
+    int slot) const
+{
+    return glm::ivec2(slot % _slotsPerRow, slot / _slotsPerRow) * TiledMask::TILE_SIZE;
+}
+
+int UpdatingTexture::allocateSlot(
+    Atlas &atlas)
+{
+    if (!atlas.freeSlots.empty())
+    {
+        auto slot = atlas.freeSlots.back();
+        atlas.freeSlots.pop_back();
+
+        return slot;
+    }
+
+    if (atlas.nextSlot >= atlas.rows * _slotsPerRow && !resizeAtlas(atlas, std::min(atlas.rows * 2, _maxAtlasRows)))
+    {
+        if (!atlas.full)
+        {
+            std::cerr << atlas.name << " atlas is full at " << atlas.nextSlot << " tiles, changed tiles show their uniform value" << std::endl;
+            atlas.full = true;
+        }
+
+        return -1;
+    }
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+    return atlas.nextSlot++;
 }
 
-void UpdatingTexture::setPlaneSize(
-    glm::vec2 const &planeSize)
+void UpdatingTexture::updatePageEntry(
+    int index)
 {
-    _planeSize = planeSize;
+    auto &tile = _mask.tile(index);
+    auto entry = &_pageTable[size_t(index) * 4];
+
+    // Tiles without a slot, including the ones the atlas had no room for, show their uniform value
+    if (tile.slot < 0)
+    {
+        entry[0] = PAGE_UNIFORM;
+        entry[1] = tile.uniform[0];
+    }
+    else
+    {
+        entry[0] = uint16_t(tile.slot % _slotsPerRow);
+        entry[1] = uint16_t(tile.slot / _slotsPerRow);
+    }
+
+    auto depthSlot = _depthSlots[size_t(index)];
+    if (depthSlot < 0)
+    {
+        entry[2] = PAGE_UNIFORM;
+        memcpy(&entry[3], _depth.tiles().tile(index).uniform, sizeof(uint16_t));
+    }
+    else
+    {
+        entry[2] = uint16_t(depthSlot % _slotsPerRow);
+        entry[3] = uint16_t(depthSlot / _slotsPerRow);
+    }
+
+    auto row = index / _mask.tileCount().x;
+
+    if (_pageRowsDirtyMin >= _pageRowsDirtyMax)
+    {
+        _pageRowsDirtyMin = row;
+        _pageRowsDirtyMax = row + 1;
+    }
+    else
+    {
+        _pageRowsDirtyMin = std::min(_pageRowsDirtyMin, row);
+        _pageRowsDirtyMax = std::max(_pageRowsDirtyMax, row + 1);
+    }
 }
 
-void UpdatingTexture::paintPixel(
-    glm::vec2 const &at,
-    std::vector<unsigned char> const &color)
+void UpdatingTexture::uploadPageTable()
 {
-    if (at.x < 0 || at.x > _textureSize.x)
+    if (_pageRowsDirtyMin >= _pageRowsDirtyMax)
     {
         return;
     }
-    if (at.y < 0 || at.y > _textureSize.y)
+
+    auto width = _mask.tileCount().x;
+    auto rows = _pageRowsDirtyMax - _pageRowsDirtyMin;
+
+    GlState::current().bindTexture(_pageTableId);
+
+    glTexSubImage2D(
+        GL_TEXTURE_2D,
+        0,
+        0,
+        _pageRowsDirtyMin,
+        width,
+        rows,
+        GL_RGBA_INTEGER,
+        GL_UNSIGNED_SHORT,
+        &_pageTable[size_t(_pageRowsDirtyMin) * size_t(width) * 4]);
+
+    GlState::current().bindTexture(0);
+
+    auto size = size_t(width) * size_t(rows) * 4 * sizeof(uint16_t);
+    _bytesUploadedLastFrame += size;
+    _bytesUploadedTotal += size;
+
+    _pageRowsDirtyMin = _pageRowsDirtyMax = 0;
+}
+
+void UpdatingTexture::markTileDirty(
+    int index)
+{
+    auto &tile = _mask.tile(index);
+
+    if (!tile.dirty)
+    {
+        tile.dirty = true;
+        _dirtyTiles.push_back(index);
+    }
+
+    _save.markTile(index);
+}
+
+void UpdatingTexture::markAllDirty()
+{
+    auto &tileCount = _mask.tileCount();
+
+    for (int i = 0; i < tileCount.x * tileCount.y; i++)
+    {
+        markTileDirty(i);
+    }
+}
+
+bool UpdatingTexture::makeResident(
+    int index)
+{
+    auto &tile = _mask.tile(index);
+
+    _mask.materialize(index);
+
+    if (tile.slot < 0)
+    {
+        tile.slot = allocateSlot(_maskAtlas);
+        if (tile.slot < 0)
+        {
+            return false;
+        }
+
+        updatePageEntry(index);
+        tile.dirty = true;
+    }
+
+    // The atlas has to be current before painting on top of it, a later upload would overwrite the paint
+    if (tile.dirty)
+    {
+        uploadTile(index);
+        tile.dirty = false;
+    }
+
+    return true;
+}
+
+void UpdatingTexture::paintOn(
+    glm::mat4 const &modelMatrix)
+{
+    if (_mask.empty())
     {
         return;
     }
 
-    auto pixelOffset = int((at.y * _textureSize.x) + at.x) * _comp;
+    glm::vec2 corners[4];
+    plowFootprint(modelMatrix, corners);
+
+    // Fill everything the blade passed over since the last call, not just where it is now
+    glm::vec2 polygon[8];
+    int count = 4;
+
+    auto pixelsPerMeter = _textureSize / _planeSize;
+    auto maxSweep = MAX_SWEEP_DISTANCE * glm::max(pixelsPerMeter.x, pixelsPerMeter.y);
+
+    if (_plowDown && glm::distance(corners[0], _lastFootprint[0]) < maxSweep)
+    {
+        glm::vec2 points[8] = {
+            _lastFootprint[0], _lastFootprint[1], _lastFootprint[2], _lastFootprint[3],
+            corners[0], corners[1], corners[2], corners[3]};
+
+        count = convexHull(points, 8, polygon);
+    }
+    else
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            polygon[i] = corners[i];
+        }
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        _lastFootprint[i] = corners[i];
+    }
+    _plowDown = true;
+
+    // The blade takes the snow out of everything it swept and pushes it off both ends
+    long long volume = 0;
+    int pixels = 0;
 
-    for (size_t i = 0; i < color.size(); i++)
+    if (_gpuPainting)
     {
-        _pixels[pixelOffset + i] = color[i];
+        paintOnGpu(polygon, count);
+
+        rasterizePolygon(polygon, count, _mask.size(), [this, &volume, &pixels](int y, int x0, int x1) {
+            volume += _depth.removeSpan(y, x0, x1, pixels);
+        });
+    }
+    else
+    {
+        rasterizePolygon(polygon, count, _mask.size(), [this, &volume, &pixels](int y, int x0, int x1) {
+            fillSpan(y, x0, x1);
+            volume += _depth.removeSpan(y, x0, x1, pixels);
+        });
     }
+
+    _pixelsClearedLastPaint = size_t(pixels);
+
+    pushBerms(corners, volume);
 }
 
-void UpdatingTexture::paintLine(
-    glm::vec2 const &from,
-    glm::vec2 const &to,
-    std::vector<unsigned char> const &color)
+void UpdatingTexture::pushBerms(
+    glm::vec2 const corners[4],
+    long long volume)
 {
-    float x1 = from.x;
-    float y1 = from.y;
-    float x2 = to.x;
-    float y2 = to.y;
+    if (volume <= 0)
+    {
+        return;
+    }
+
+    auto pixelsPerMeter = _textureSize / _planeSize;
+    auto side = glm::normalize(corners[1] - corners[0]) * BERM_WIDTH * pixelsPerMeter.x;
+
+    glm::vec2 left[4] = {corners[0] - side, corners[0], corners[3], corners[3] - side};
+    glm::vec2 right[4] = {corners[1], corners[1] + side, corners[2] + side, corners[2]};
+
+    _depth.deposit(left, 4, volume / 2);
+    _depth.deposit(right, 4, volume - (volume / 2));
+
+    // The berm is snow again, on the GPU the mask is left to the painter and only the depth shows it
+    if (!_gpuPainting)
     {
-        // Bresenham's line algorithm
-        const bool steep = (fabs(y2 - y1) > fabs(x2 - x1));
-        if (steep)
+        auto cover = [this](int y, int x0, int x1) {
+            coverSpan(y, x0, x1);
+        };
+
+        rasterizePolygon(left, 4, _mask.size(), cover);
+        rasterizePolygon(right, 4, _mask.size(), cover);
+    }
+}
+
+void UpdatingTexture::coverSpan(
+    int y,
+    int x0,
+    int x1)
+{
+    auto rowInTile = size_t(y % TiledMask::TILE_SIZE);
+
+    for (int x = x0; x < x1; x++)
+    {
+        auto limit = SnowDepth::clearedForDepth(_depth.depth(x, y));
+        auto value = *_mask.pixel(x, y);
+
+        if ((value & MASK_CLEARED) <= limit)
         {
-            std::swap(x1, y1);
-            std::swap(x2, y2);
+            continue;
         }
 
-        if (x1 > x2)
+        auto index = _mask.tileIndex(x / TiledMask::TILE_SIZE, y / TiledMask::TILE_SIZE);
+        auto pixel = _mask.materialize(index) + (rowInTile * TiledMask::TILE_SIZE) + size_t(x % TiledMask::TILE_SIZE);
+
+        if (MaskStatistics::isCleared(pixel) && limit <= MaskStatistics::CLEARED_THRESHOLD)
         {
-            std::swap(x1, x2);
-            std::swap(y1, y2);
+            auto isRoad = MaskStatistics::isRoad(pixel);
+            _statistics.add(index, isRoad ? -1 : 0, isRoad ? 0 : -1);
         }
 
-        const float dx = x2 - x1;
-        const float dy = fabs(y2 - y1);
+        *pixel = static_cast<unsigned char>((value & MASK_ROAD) | limit);
+        markTileDirty(index);
+    }
+}
+
+void UpdatingTexture::paintOnGpu(
+    glm::vec2 const *polygon,
+    int count)
+{
+    auto min = polygon[0];
+    auto max = polygon[0];
+    for (int i = 1; i < count; i++)
+    {
+        min = glm::min(min, polygon[i]);
+        max = glm::max(max, polygon[i]);
+    }
 
-        float error = dx / 2.0f;
-        const int ystep = (y1 < y2) ? 1 : -1;
-        int y = (int)y1;
+    auto tileMin = glm::max(glm::ivec2(glm::floor(min)) / TiledMask::TILE_SIZE, glm::ivec2(0));
+    auto tileMax = glm::min(glm::ivec2(glm::floor(max)) / TiledMask::TILE_SIZE, _mask.tileCount() - 1);
 
-        const int maxX = (int)x2;
+    _paintRegions.clear();
 
-        for (int x = (int)x1; x < maxX; x++)
+    for (int tileY = tileMin.y; tileY <= tileMax.y; tileY++)
+    {
+        for (int tileX = tileMin.x; tileX <= tileMax.x; tileX++)
         {
-            if (steep)
+            auto index = _mask.tileIndex(tileX, tileY);
+            auto &tile = _mask.tile(index);
+
+            // Cleared everywhere already, tiles the GPU painted on are never uniform
+            if (tile.isUniform() && (tile.uniform[0] & MASK_CLEARED) == MASK_CLEARED)
             {
-                paintPixel(glm::vec2(y, x), color);
+                continue;
             }
-            else
+
+            if (!makeResident(index))
             {
-                paintPixel(glm::vec2(x, y), color);
+                continue;
             }
 
-            error -= dy;
-            if (error < 0)
+            _snowfall.wake(index);
+            markPainted(index);
+
+            GpuMaskPainter::Region region;
+            region.source = glm::ivec2(tileX, tileY) * TiledMask::TILE_SIZE;
+            region.target = slotOrigin(tile.slot);
+
+            _paintRegions.push_back(region);
+        }
+    }
+
+    _gpuPainter.paint(polygon, count, _paintRegions.data(), int(_paintRegions.size()), TiledMask::TILE_SIZE);
+}
+
+void UpdatingTexture::liftPlow()
+{
+    _plowDown = false;
+    _pixelsClearedLastPaint = 0;
+}
+
+size_t UpdatingTexture::pixelsClearedLastPaint() const
+{
+    return _pixelsClearedLastPaint;
+}
+
+int UpdatingTexture::convexHull(
+    glm::vec2 *points,
+    int count,
+    glm::vec2 *hull)
+{
+    // Andrew's monotone chain, the hull is returned counter clockwise without repeating the first point
+    std::sort(points, points + count, [](glm::vec2 const &a, glm::vec2 const &b) {
+        return a.x < b.x || (a.x == b.x && a.y < b.y);
+    });
+
+    auto cross = [](glm::vec2 const &o, glm::vec2 const &a, glm::vec2 const &b) {
+        return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+    };
+
+    // Room for both chains before the duplicate end points are dropped
+    glm::vec2 chain[16];
+    int k = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        while (k >= 2 && cross(chain[k - 2], chain[k - 1], points[i]) <= 0.0f) k--;
+        chain[k++] = points[i];
+    }
+
+    for (int i = count - 2, lower = k + 1; i >= 0; i--)
+    {
+        while (k >= lower && cross(chain[k - 2], chain[k - 1], points[i]) <= 0.0f) k--;
+        chain[k++] = points[i];
+    }
+
+    auto result = k > 1 ? k - 1 : k;
+    for (int i = 0; i < result; i++)
+    {
+        hull[i] = chain[i];
+    }
+
+    return result;
+}
+
+void UpdatingTexture::fillSpan(
+    int y,
+    int x0,
+    int x1)
+{
+    auto tileY = y / TiledMask::TILE_SIZE;
+    auto rowInTile = size_t(y % TiledMask::TILE_SIZE);
+
+    while (x0 < x1)
+    {
+        auto tileX = x0 / TiledMask::TILE_SIZE;
+        auto end = std::min(x1, (tileX + 1) * TiledMask::TILE_SIZE);
+        auto index = _mask.tileIndex(tileX, tileY);
+        auto &tile = _mask.tile(index);
+
+        // Nothing to clear in a tile without snow, this keeps plowed open areas from allocating
+        if (!tile.isUniform() || (tile.uniform[0] & MASK_CLEARED) != MASK_CLEARED)
+        {
+            auto offset = (rowInTile * TiledMask::TILE_SIZE) + size_t(x0 % TiledMask::TILE_SIZE);
+
+            int road = 0;
+            int grass = 0;
+
+            // Runs over pixels that were cleared before change nothing and need no upload
+            if (clearPixels(_mask.materialize(index) + offset, end - x0, road, grass))
             {
-                y += ystep;
-                error += dx;
+                _statistics.add(index, road, grass);
+                markTileDirty(index);
+                _snowfall.wake(index);
             }
         }
+
+        x0 = end;
     }
 }
 
-void UpdatingTexture::paintOn(
-    glm::mat4 const &modelMatrix)
+bool UpdatingTexture::clearPixels(
+    unsigned char *pixels,
+    int count,
+    int &road,
+    int &grass)
 {
-    if (_pixels == nullptr)
+    bool changed = false;
+
+    for (int i = 0; i < count; i++)
     {
-        return;
+        auto pixel = pixels + i;
+
+        changed = changed || (pixel[0] & MASK_CLEARED) != MASK_CLEARED;
+
+        if (!MaskStatistics::isCleared(pixel))
+        {
+            auto isRoad = MaskStatistics::isRoad(pixel);
+            road += isRoad ? 1 : 0;
+            grass += isRoad ? 0 : 1;
+        }
+    }
+
+    if (!changed)
+    {
+        return false;
     }
 
+    // Setting the cleared bits leaves the road bits as they are, the compiler turns this into vector instructions
+    for (int i = 0; i < count; i++)
+    {
+        pixels[i] |= MASK_CLEARED;
+    }
+
+    return true;
+}
+
+void UpdatingTexture::plowFootprint(
+    glm::mat4 const &modelMatrix,
+    glm::vec2 corners[4]) const
+{
+    auto pixelsPerMeter = _textureSize / _planeSize;
+
     // Calculate the position in texture-space
-    glm::vec2 pos(
-        int((modelMatrix[3].x + (_planeSize.x / 2.0f)) * (_textureSize.x / _planeSize.x)),
-        int((modelMatrix[3].y + (_planeSize.y / 2.0f)) * (_textureSize.y / _planeSize.y)));
+    glm::vec2 pos = (glm::vec2(modelMatrix[3].x, modelMatrix[3].y) + (_planeSize / 2.0f)) * pixelsPerMeter;
 
-    glm::vec2 dir = glm::vec2(modelMatrix[1].x, modelMatrix[1].y);
-    glm::vec2 right = glm::vec2(modelMatrix[0].x, modelMatrix[0].y);
+    glm::vec2 dir = glm::vec2(modelMatrix[1].x, modelMatrix[1].y) * pixelsPerMeter;
+    glm::vec2 right = glm::vec2(modelMatrix[0].x, modelMatrix[0].y) * pixelsPerMeter;
 
-    // three lines to make sure the most pixels are painted over even when the car is moving fast or making  sharp turn
-    auto localPos = pos + (dir * 10.0f);
-    paintLine(localPos + (right * 10.0f), localPos + (right * -10.0f), std::vector<unsigned char>({0, 255, 0, 0}));
-    localPos = pos + (dir * 9.0f);
-    paintLine(localPos + (right * 10.0f), localPos + (right * -10.0f), std::vector<unsigned char>({0, 255, 0, 0}));
-    localPos = pos + (dir * 8.0f);
-    paintLine(localPos + (right * 10.0f), localPos + (right * -10.0f), std::vector<unsigned char>({0, 255, 0, 0}));
+    // Corners in order around the blade, so the footprint can be drawn as a fan
+    corners[0] = pos + (dir * BLADE_NEAR) - (right * BLADE_HALF_WIDTH);
+    corners[1] = pos + (dir * BLADE_NEAR) + (right * BLADE_HALF_WIDTH);
+    corners[2] = pos + (dir * BLADE_FAR) + (right * BLADE_HALF_WIDTH);
+    corners[3] = pos + (dir * BLADE_FAR) - (right * BLADE_HALF_WIDTH);
+}
 
-    glTexImage2D(
-        GL_TEXTURE_2D,
-        0,
-        _comp == 4 ? GL_RGBA : GL_RGB,
-        static_cast<GLsizei>(_textureSize.x),
-        static_cast<GLsizei>(_textureSize.y),
-        0,
-        _comp == 4 ? GL_RGBA : GL_RGB,
-        GL_UNSIGNED_BYTE,
-        _pixels);
+bool UpdatingTexture::setGpuPainting(
+    bool enabled)
+{
+    if (_mask.empty() || enabled == _gpuPainting)
+    {
+        return _gpuPainting == enabled;
+    }
+
+    if (enabled)
+    {
+        if (!_gpuPainter.setup(_maskAtlas.textureId))
+        {
+            return false;
+        }
+
+        // Whatever the CPU painted must be in the atlas before the GPU paints on top of it
+        uploadChanges();
+    }
+    else
+    {
+        // The tiles are behind on what was painted on the GPU, this waits once when switching back
+        _gpuPainter.cancelReadback();
+        requestReadback();
+        applyReadback(true);
+    }
+
+    _gpuPainting = enabled;
+
+    return true;
+}
+
+bool UpdatingTexture::gpuPainting() const
+{
+    return _gpuPainting;
+}
+
+void UpdatingTexture::markPainted(
+    int index)
+{
+    if (!_tilePainted[index])
+    {
+        _tilePainted[index] = true;
+        _paintedTiles.push_back(index);
+    }
+}
+
+void UpdatingTexture::requestReadback()
+{
+    if (!_gpuPainting || _gpuPainter.isReadbackPending())
+    {
+        return;
+    }
+
+    // A request that was cancelled or failed never reached the tiles, they go out again
+    for (auto &entry : _readbackTiles)
+    {
+        markPainted(entry.x);
+    }
+
+    _readbackTiles.clear();
+    _readbackOrigins.clear();
+
+    for (auto index : _paintedTiles)
+    {
+        _tilePainted[index] = false;
+
+        auto slot = _mask.tile(index).slot;
+        if (slot >= 0)
+        {
+            _readbackTiles.push_back(glm::ivec2(index, slot));
+            _readbackOrigins.push_back(slotOrigin(slot));
+        }
+    }
+
+    _paintedTiles.clear();
+
+    // Nothing was plowed since the last request
+    if (_readbackTiles.empty())
+    {
+        return;
+    }
+
+    _gpuPainter.requestReadback(_readbackOrigins.data(), int(_readbackOrigins.size()), TiledMask::TILE_SIZE);
 }
 
-std::vector<glm::vec2> UpdatingTexture::listBluePixels()
+void UpdatingTexture::applyReadback(
+    bool wait)
 {
-    std::vector<glm::vec2> result;
-    for (int y = 0; y < _textureSize.y; ++y)
+    auto data = _gpuPainter.mapReadback(wait);
+    if (data == nullptr)
     {
-        for (int x = 0; x < _textureSize.x; ++x)
+        return;
+    }
+
+    auto tileBytes = _mask.tileBytes();
+
+    for (size_t i = 0; i < _readbackTiles.size(); i++)
+    {
+        auto &entry = _readbackTiles[i];
+        auto &tile = _mask.tile(entry.x);
+
+        // Tiles that moved, were freed or were replaced after the request are newer than the readback
+        if (tile.slot != entry.y || tile.isUniform() || tile.dirty)
+        {
+            continue;
+        }
+
+        memcpy(tile.pixels.get(), data + (i * tileBytes), tileBytes);
+
+        _statistics.recountTile(_mask, entry.x);
+        _save.markTile(entry.x);
+    }
+
+    _gpuPainter.unmapReadback();
+
+    _readbackTiles.clear();
+}
+
+void UpdatingTexture::uploadChanges()
+{
+    _bytesUploadedLastFrame = 0;
+
+    if (_mask.empty())
+    {
+        return;
+    }
+
+    if (_gpuPainting)
+    {
+        // Does not wait, the tiles are only refreshed when the GPU is done with the atlas
+        applyReadback(false);
+    }
+
+    if (!_dirtyTiles.empty() && _asyncUploads && uploadBufferBusy())
+    {
+        // The driver is still copying out of the next staging buffer, try again next frame instead of waiting
+        _uploadsDeferred++;
+    }
+    else
+    {
+        _uploadTiles.clear();
+
+        for (auto index : _dirtyTiles)
+        {
+            auto &tile = _mask.tile(index);
+
+            if (!tile.dirty)
+            {
+                continue;
+            }
+
+            tile.dirty = false;
+
+            // While painting on the GPU the tile pixels are behind on the atlas and cannot be trusted to collapse
+            if (!_gpuPainting)
+            {
+                _mask.tryCollapse(index);
+            }
+
+            if (tile.isUniform() && tile.slot >= 0)
+            {
+                _maskAtlas.freeSlots.push_back(tile.slot);
+                tile.slot = -1;
+            }
+            else if (!tile.isUniform() && tile.slot < 0)
+            {
+                tile.slot = allocateSlot(_maskAtlas);
+            }
+
+            updatePageEntry(index);
+
+            if (tile.slot >= 0)
+            {
+                _uploadTiles.push_back(index);
+            }
+        }
+
+        _dirtyTiles.clear();
+
+        if (!_uploadTiles.empty() && !(_asyncUploads && uploadThroughPixelBuffer(_uploadTiles)))
         {
-            auto pixelOffset = int((y * _textureSize.x) + x) * _comp;
-            if (_pixels[pixelOffset + 2] > 1)
+            for (auto index : _uploadTiles)
             {
-                result.push_back(glm::vec2(
-                    (-_planeSize.x / 2.0f) + (x / _textureSize.x) * _planeSize.x,
-                    (-_planeSize.y / 2.0f) + (y / _textureSize.y) * _planeSize.y));
+                uploadTile(index);
             }
         }
     }
 
-    return result;
+    // Depth changes can move page entries too, so the page table goes up last
+    uploadDepth();
+    uploadPageTable();
+}
+
+void UpdatingTexture::resetDepth()
+{
+    _depth.reset(_mask);
+
+    // The atlas storage is kept, every depth tile that is not uniform comes back as changed
+    _depthSlots.assign(tileCount(), -1);
+    _depthAtlas.freeSlots.clear();
+    _depthAtlas.nextSlot = 0;
+}
+
+void UpdatingTexture::uploadDepth()
+{
+    _depthUploads.clear();
+    _depth.takeChangedTiles(_depthUploads);
+
+    if (_depthUploads.empty())
+    {
+        return;
+    }
+
+    auto &tiles = _depth.tiles();
+
+    GlState::current().bindTexture(_depthAtlas.textureId);
+
+    // Uniform tiles are drawn from their page entry, only the others have pixels to upload
+    for (auto index : _depthUploads)
+    {
+        auto &tile = tiles.tile(index);
+        auto &slot = _depthSlots[size_t(index)];
+
+        if (tile.isUniform() && slot >= 0)
+        {
+            _depthAtlas.freeSlots.push_back(slot);
+            slot = -1;
+        }
+        else if (!tile.isUniform() && slot < 0)
+        {
+            slot = allocateSlot(_depthAtlas);
+
+            // Growing the atlas binds the new texture and unbinds it again
+            GlState::current().bindTexture(_depthAtlas.textureId);
+        }
+
+        updatePageEntry(index);
+
+        if (slot < 0)
+        {
+            continue;
+        }
+
+        auto origin = slotOrigin(slot);
+
+        glTexSubImage2D(
+            GL_TEXTURE_2D,
+            0,
+            origin.x,
+            origin.y,
+            TiledMask::TILE_SIZE,
+            TiledMask::TILE_SIZE,
+            GL_RED,
+            GL_UNSIGNED_SHORT,
+            tile.pixels.get());
+
+        _bytesUploadedLastFrame += tiles.tileBytes();
+        _bytesUploadedTotal += tiles.tileBytes();
+    }
+
+    GlState::current().bindTexture(0);
+}
+
+void UpdatingTexture::uploadTile(
+    int index)
+{
+    auto &tile = _mask.tile(index);
+    auto origin = slotOrigin(tile.slot);
+
+    GlState::current().bindTexture(_maskAtlas.textureId);
+
+    glTexSubImage2D(
+        GL_TEXTURE_2D,
+        0,
+        origin.x,
+        origin.y,
+        TiledMask::TILE_SIZE,
+        TiledMask::TILE_SIZE,
+        GL_RED,
+        GL_UNSIGNED_BYTE,
+        tile.pixels.get());
+
+    GlState::current().bindTexture(0);
+
+    _bytesUploadedLastFrame += _mask.tileBytes();
+    _bytesUploadedTotal += _mask.tileBytes();
+}
+
+bool UpdatingTexture::uploadBufferBusy()
+{
+    auto &buffer = _uploadBuffers[_nextUploadBuffer];
+
+    if (buffer.fence == nullptr)
+    {
+        return false;
+    }
+
+    if (glClientWaitSync(buffer.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+    {
+        return true;
+    }
+
+    glDeleteSync(buffer.fence);
+    buffer.fence = nullptr;
+
+    return false;
+}
+
+bool UpdatingTexture::uploadThroughPixelBuffer(
+    std::vector<int> const &tiles)
+{
+    auto &buffer = _uploadBuffers[_nextUploadBuffer];
+    auto tileBytes = _mask.tileBytes();
+    auto size = tileBytes * tiles.size();
+
+    if (buffer.bufferId == 0)
+    {
+        glGenBuffers(1, &buffer.bufferId);
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.bufferId);
+
+    if (size > buffer.capacity)
+    {
+        buffer.capacity = std::max(size, buffer.capacity * 2);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, GLsizeiptr(buffer.capacity), nullptr, GL_STREAM_DRAW);
+    }
+
+    // uploadBufferBusy() made sure the GPU is done with this buffer, so there is no need to synchronize the map
+    auto data = static_cast<unsigned char *>(glMapBufferRange(
+        GL_PIXEL_UNPACK_BUFFER,
+        0,
+        GLsizeiptr(size),
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+
+    if (data == nullptr)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        return false;
+    }
+
+    for (size_t i = 0; i < tiles.size(); i++)
+    {
+        memcpy(data + (i * tileBytes), _mask.tile(tiles[i]).pixels.get(), tileBytes);
+    }
+
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    GlState::current().bindTexture(_maskAtlas.textureId);
+
+    // With an unpack buffer bound the last argument is an offset and the calls return without copying
+    for (size_t i = 0; i < tiles.size(); i++)
+    {
+        auto origin = slotOrigin(_mask.tile(tiles[i]).slot);
+
+        glTexSubImage2D(
+            GL_TEXTURE_2D,
+            0,
+            origin.x,
+            origin.y,
+            TiledMask::TILE_SIZE,
+            TiledMask::TILE_SIZE,
+            GL_RED,
+            GL_UNSIGNED_BYTE,
+            reinterpret_cast<const GLvoid *>(i * tileBytes));
+    }
+
+    GlState::current().bindTexture(0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    buffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    _nextUploadBuffer = (_nextUploadBuffer + 1) % UPLOAD_BUFFER_COUNT;
+
+    _bytesUploadedLastFrame += size;
+    _bytesUploadedTotal += size;
+
+    return true;
+}
+
+void UpdatingTexture::setAsyncUploads(
+    bool enabled)
+{
+    _asyncUploads = enabled;
+}
+
+bool UpdatingTexture::asyncUploads() const
+{
+    return _asyncUploads;
+}
+
+size_t UpdatingTexture::uploadsDeferred() const
+{
+    return _uploadsDeferred;
+}
+
+size_t UpdatingTexture::bytesUploadedLastFrame() const
+{
+    return _bytesUploadedLastFrame;
+}
+
+size_t UpdatingTexture::bytesUploadedTotal() const
+{
+    return _bytesUploadedTotal;
+}
+
+bool UpdatingTexture::resumeSave(
+    std::string const &filename)
+{
+    if (_mask.empty() || !_save.load(filename, _mask))
+    {
+        return false;
+    }
+
+    _snowfall.reset(_mask);
+    _statistics.reset(_mask);
+    resetDepth();
+    markAllDirty();
+
+    return true;
+}
+
+bool UpdatingTexture::save(
+    std::string const &filename)
+{
+    if (_mask.empty())
+    {
+        return false;
+    }
+
+    return _save.save(filename, _mask);
+}
+
+MaskSave &UpdatingTexture::maskSave()
+{
+    return _save;
+}
+
+size_t UpdatingTexture::allocatedTiles() const
+{
+    return _mask.allocatedTiles();
+}
+
+size_t UpdatingTexture::allocatedBytes() const
+{
+    return _mask.allocatedBytes();
+}
+
+size_t UpdatingTexture::tileCount() const
+{
+    return size_t(_mask.tileCount().x) * size_t(_mask.tileCount().y);
+}
+
+bool UpdatingTexture::atlasFull() const
+{
+    return _maskAtlas.full || _depthAtlas.full;
+}
+
+void UpdatingTexture::updateSnowfall(
+    float seconds)
+{
+    if (_mask.empty())
+    {
+        return;
+    }
+
+    // The depth only lives in memory, so it keeps settling while painting on the GPU
+    _depth.update(seconds, _snowfall.regrowTime());
+
+    if (_gpuPainting)
+    {
+        return;
+    }
+
+    _snowfall.update(_mask, seconds, _snowedTiles);
+
+    for (auto &change : _snowedTiles)
+    {
+        _statistics.add(change.index, -change.roadCovered, -change.grassCovered);
+        markTileDirty(change.index);
+    }
+    _snowedTiles.clear();
+}
+
+Snowfall &UpdatingTexture::snowfall()
+{
+    return _snowfall;
+}
+
+SnowDepth const &UpdatingTexture::snowDepth() const
+{
+    return _depth;
+}
+
+float UpdatingTexture::snowDepthAt(
+    glm::vec2 const &position) const
+{
+    if (_mask.empty())
+    {
+        return 0.0f;
+    }
+
+    auto pixel = (position + (_planeSize / 2.0f)) * (_textureSize / _planeSize);
+
+    return _depth.sample(pixel) / 1000.0f;
+}
+
+MaskStatistics const &UpdatingTexture::statistics() const
+{
+    return _statistics;
+}
+
+void UpdatingTexture::saveSnapshot(
+    TiledMask &mask) const
+{
+    if (_mask.empty())
+    {
+        return;
+    }
+
+    mask.copyFrom(_mask);
+}
+
+void UpdatingTexture::restoreSnapshot(
+    TiledMask const &mask)
+{
+    if (_mask.empty() || mask.size() != _mask.size() || mask.comp() != _mask.comp())
+    {
+        return;
+    }
+
+    // A readback still in flight would overwrite the restored tiles, and what was painted is gone
+    _gpuPainter.cancelReadback();
+    _readbackTiles.clear();
+    _paintedTiles.clear();
+    _tilePainted.assign(_tilePainted.size(), false);
+
+    // Do not sweep from where the plow was before the restore
+    liftPlow();
+
+    _mask.copyFrom(mask);
+    _snowfall.reset(_mask);
+    _statistics.reset(_mask);
+    resetDepth();
+
+    // The atlas storage is kept, slots are handed out again with the next upload
+    markAllDirty();
 }
@@ -1,6 +1,15 @@
 #ifndef UPDATINGTEXTURE_H
 #define UPDATINGTEXTURE_H
 
+#include "gpumaskpainter.h"
+#include "level.h"
+#include "masksave.h"
+#include "maskstatistics.h"
+#include "snowdepth.h"
+#include "snowfall.h"
+#include "tiledmask.h"
+
+#include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <string>
 #include <vector>
@@ -12,33 +21,271 @@ public:
 
     glm::vec2 _textureSize;
 
+    // Atlas with the pixels of all tiles that are not uniform
     uint32_t textureId() const;
 
-    void loadTexture(
-        std::string const &filename);
+    // One 16 bit integer texel per tile. Red and green hold the slot of the mask pixels in
+    // textureId(), or PAGE_UNIFORM and the uniform mask value. Blue and alpha do the same
+    // for the depth in depthTextureId().
+    uint32_t pageTableId() const;
+
+    // Atlas with the snow depth in millimetres of all tiles that are not uniform
+    uint32_t depthTextureId() const;
 
-    void setPlaneSize(
-        glm::vec2 const &planeSize);
+    // Red of a page table entry for a tile drawn from its uniform value
+    static const uint16_t PAGE_UNIFORM = 0xffff;
 
+    // Takes the mask and plane size of the level, the level has to stay open for saving
+    bool loadLevel(
+        Level const &level);
+
+    // Clears the snow under the plow blade and everything it swept over since the previous call
     void paintOn(
         glm::mat4 const &modelMatrix);
 
-    std::vector<glm::vec2> listBluePixels();
+    // The next paintOn() starts a new stroke instead of sweeping from the last blade position
+    void liftPlow();
+
+    // Pixels that still had snow on them when the last paintOn() swept over them, counted
+    // from the depth so it is the same with painting on the GPU
+    size_t pixelsClearedLastPaint() const;
+
+    // Lets snow fall back on cleared pixels, call once per update with the elapsed time.
+    // Paused while painting on the GPU, the tiles in memory are behind on the atlas then.
+    void updateSnowfall(
+        float seconds);
+
+    Snowfall &snowfall();
+
+    SnowDepth const &snowDepth() const;
+
+    // Snow depth in meters at a position on the ground plane
+    float snowDepthAt(
+        glm::vec2 const &position) const;
+
+    // Cleared pixel counts, kept up to date by painting and snowfall. While painting on
+    // the GPU they only catch up when a readback lands.
+    MaskStatistics const &statistics() const;
+
+    void saveSnapshot(
+        TiledMask &mask) const;
+
+    void restoreSnapshot(
+        TiledMask const &mask);
+
+    // Puts back the plowed state of an earlier session, call right after loadLevel()
+    bool resumeSave(
+        std::string const &filename);
+
+    // Writes the tiles that differ from the level on a background thread, returns false
+    // while the previous save is still being written. While painting on the GPU the
+    // save holds what the last readback brought back.
+    bool save(
+        std::string const &filename);
+
+    MaskSave &maskSave();
+
+    size_t allocatedTiles() const;
+
+    size_t allocatedBytes() const;
+
+    size_t tileCount() const;
+
+    // A tile needed a slot when an atlas could not grow, it is drawn from its uniform value
+    bool atlasFull() const;
+
+    // Uploads the tiles changed since the last call, call this once per rendered frame
+    void uploadChanges();
+
+    size_t bytesUploadedLastFrame() const;
+
+    size_t bytesUploadedTotal() const;
+
+    // Stage uploads through a ring of pixel unpack buffers so the driver copies asynchronously
+    void setAsyncUploads(
+        bool enabled);
+
+    bool asyncUploads() const;
+
+    // Number of times an upload was postponed because all staging buffers were still in use
+    size_t uploadsDeferred() const;
+
+    // Paint the plow into the atlas on the GPU instead of into the tiles
+    bool setGpuPainting(
+        bool enabled);
+
+    bool gpuPainting() const;
+
+    // Refreshes the tiles the GPU painted from the atlas, the copy lands in a later uploadChanges()
+    void requestReadback();
 
 private:
-    uint32_t _textureId = 0;
-    int _comp = 0;
+    // Plow blade in front of the car, in meters
+    const float BLADE_NEAR = 0.8f;
+    const float BLADE_FAR = 1.0f;
+    const float BLADE_HALF_WIDTH = 1.0f;
+
+    // Blade movements longer than this between two calls are teleports and are not swept
+    const float MAX_SWEEP_DISTANCE = 4.0f;
+
+    // Width of the berms the blade leaves at both ends, in meters
+    const float BERM_WIDTH = 0.4f;
+
+    TiledMask _mask;
     glm::vec2 _planeSize;
-    unsigned char *_pixels = nullptr;
 
-    void paintPixel(
-        glm::vec2 const &at,
-        std::vector<unsigned char> const &color);
+    // Texture with a grid of tile sized slots, grown by doubling its rows
+    struct Atlas
+    {
+        GLenum internalFormat = GL_R8;
+        GLenum type = GL_UNSIGNED_BYTE;
+        char const *name = "";
+        uint32_t textureId = 0;
+        int rows = 0;
+        int nextSlot = 0;
+        std::vector<int> freeSlots;
+        bool full = false;
+    };
+
+    Atlas _maskAtlas;
+    Atlas _depthAtlas;
+    uint32_t _pageTableId = 0;
+    int _slotsPerRow = 0;
+    int _maxAtlasRows = 0;
+
+    // Depth slots are kept here, the depth tiles are made anew on every reset
+    std::vector<int> _depthSlots;
+
+    // CPU copy of the page table, rows in [min, max) still have to be uploaded
+    std::vector<uint16_t> _pageTable;
+    int _pageRowsDirtyMin = 0;
+    int _pageRowsDirtyMax = 0;
+
+    std::vector<int> _dirtyTiles;
+    std::vector<Snowfall::Change> _snowedTiles;
+    Snowfall _snowfall;
+    MaskStatistics _statistics;
+    SnowDepth _depth;
+    MaskSave _save;
+    size_t _bytesUploadedLastFrame = 0;
+    size_t _bytesUploadedTotal = 0;
+
+    void createTextures();
+
+    bool resizeAtlas(
+        Atlas &atlas,
+        int rows);
+
+    glm::ivec2 slotOrigin(
+        int slot) const;
+
+    int allocateSlot(
+        Atlas &atlas);
+
+    void updatePageEntry(
+        int index);
+
+    void uploadPageTable();
+
+    std::vector<int> _depthUploads;
+
+    // Depth from the mask, the depth atlas is handed out again from the start
+    void resetDepth();
+
+    void uploadDepth();
+
+    void markTileDirty(
+        int index);
+
+    void markAllDirty();
+
+    // Gives the tile its own pixels and atlas slot right away, for painting on the GPU
+    bool makeResident(
+        int index);
+
+    static const int UPLOAD_BUFFER_COUNT = 3;
+
+    struct UploadBuffer
+    {
+        uint32_t bufferId = 0;
+        size_t capacity = 0;
+        GLsync fence = nullptr;
+    };
+
+    bool _asyncUploads = true;
+    UploadBuffer _uploadBuffers[UPLOAD_BUFFER_COUNT];
+    int _nextUploadBuffer = 0;
+    size_t _uploadsDeferred = 0;
+
+    bool uploadBufferBusy();
+
+    bool uploadThroughPixelBuffer(
+        std::vector<int> const &tiles);
+
+    void uploadTile(
+        int index);
+
+    std::vector<int> _uploadTiles;
+
+    bool _gpuPainting = false;
+    GpuMaskPainter _gpuPainter;
+
+    // Tiles the GPU painted since the last readback request, each listed once
+    std::vector<int> _paintedTiles;
+    std::vector<bool> _tilePainted;
+
+    void markPainted(
+        int index);
+
+    // Tiles and the slots they were in when the readback was requested, in readback order
+    std::vector<glm::ivec2> _readbackTiles;
+    std::vector<glm::ivec2> _readbackOrigins;
+
+    void applyReadback(
+        bool wait);
+
+    std::vector<GpuMaskPainter::Region> _paintRegions;
+
+    void paintOnGpu(
+        glm::vec2 const *polygon,
+        int count);
+
+    void plowFootprint(
+        glm::mat4 const &modelMatrix,
+        glm::vec2 corners[4]) const;
+
+    glm::vec2 _lastFootprint[4];
+    bool _plowDown = false;
+    size_t _pixelsClearedLastPaint = 0;
+
+    static int convexHull(
+        glm::vec2 *points,
+        int count,
+        glm::vec2 *hull);
+
+    // Piles the snow the blade took up along both ends of its footprint
+    void pushBerms(
+        glm::vec2 const corners[4],
+        long long volume);
+
+    // Brings back snow on pixels the depth says are covered again
+    void coverSpan(
+        int y,
+        int x0,
+        int x1);
+
+    void fillSpan(
+        int y,
+        int x0,
+        int x1);
 
-    void paintLine(
-        glm::vec2 const &from,
-        glm::vec2 const &to,
-        std::vector<unsigned char> const &color);
+    // Clears count pixels and adds how many of them were not cleared before to road and grass,
+    // returns false when every pixel was fully cleared already
+    static bool clearPixels(
+        unsigned char *pixels,
+        int count,
+        int &road,
+        int &grass);
 };
 
 #endif // UPDATINGTEXTURE_H
@@ -0,0 +1,131 @@
+#include "workerpool.h"
+
+WorkerPool::WorkerPool()
+    : _job(nullptr),
+      _next(0),
+      _count(0),
+      _busy(0),
+      _generation(0),
+      _quit(false)
+{}
+
+WorkerPool::~WorkerPool()
+{
+    stop();
+}
+
+void WorkerPool::setThreadCount(
+    int count)
+{
+    if (count == int(_threads.size()))
+    {
+        return;
+    }
+
+    stop();
+
+    _quit = false;
+    for (int i = 0; i < count; i++)
+    {
+        // Started at the current generation, so a job that already finished is not picked up again
+        _threads.emplace_back(&WorkerPool::workerLoop, this, _generation);
+    }
+}
+
+int WorkerPool::threadCount() const
+{
+    return int(_threads.size());
+}
+
+void WorkerPool::run(
+    int count,
+    std::function<void(int)> const &job)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    if (_threads.empty() || count == 1)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            job(i);
+        }
+
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _job = &job;
+        _count = count;
+        _next = 0;
+        _busy = int(_threads.size());
+        _generation++;
+    }
+
+    _wake.notify_all();
+
+    // The calling thread helps instead of only waiting
+    runJobs();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this]() { return _busy == 0; });
+
+    _job = nullptr;
+}
+
+void WorkerPool::workerLoop(
+    unsigned generation)
+{
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [this, generation]() { return _quit || _generation != generation; });
+
+            if (_quit)
+            {
+                return;
+            }
+
+            generation = _generation;
+        }
+
+        runJobs();
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _busy--;
+        }
+
+        _done.notify_one();
+    }
+}
+
+void WorkerPool::runJobs()
+{
+    for (int i = _next++; i < _count; i = _next++)
+    {
+        (*_job)(i);
+    }
+}
+
+void WorkerPool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _quit = true;
+    }
+
+    _wake.notify_all();
+
+    for (auto &thread : _threads)
+    {
+        thread.join();
+    }
+
+    _threads.clear();
+}
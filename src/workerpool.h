@@ -0,0 +1,52 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads that stay around between jobs, so spreading a small
+// amount of work over them every tick does not pay for creating threads.
+class WorkerPool
+{
+public:
+    WorkerPool();
+
+    virtual ~WorkerPool();
+
+    // Zero threads runs every job on the calling thread
+    void setThreadCount(
+        int count);
+
+    int threadCount() const;
+
+    // Calls job(i) for every i in [0, count) on the workers and the calling thread,
+    // returns when all of them are done
+    void run(
+        int count,
+        std::function<void(int)> const &job);
+
+private:
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    std::function<void(int)> const *_job;
+    std::atomic<int> _next;
+    int _count;
+    int _busy;
+    unsigned _generation;
+    bool _quit;
+
+    void workerLoop(
+        unsigned generation);
+
+    void runJobs();
+
+    void stop();
+};
+
+#endif // WORKERPOOL_H
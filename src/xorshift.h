@@ -0,0 +1,18 @@
+#ifndef XORSHIFT_H
+#define XORSHIFT_H
+
+#include <cstdint>
+
+// Steps the xorshift32 state and returns a value in [0, 1). Not a good generator,
+// but plenty for spreading particles and cheap enough to call per particle.
+inline float xorshiftFloat(
+    uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+
+    return float(state >> 8) / float(1 << 24);
+}
+
+#endif // XORSHIFT_H